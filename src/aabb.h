@@ -3,6 +3,7 @@
 
 
 #include <algorithm>
+#include <cfloat>
 
 #include "ray.h"
 
@@ -38,9 +39,27 @@ public:
 
     Vec3 min() const { return bb_min; }
     Vec3 max() const { return bb_max; }
+    Vec3 centroid() const { return 0.5f * (bb_min + bb_max); }
 
     bool hit(const Ray& r, float tmin, float tmax) const;
 
+    /**
+     * Surface area of the box, used by the SAH cost function.
+     *
+     * @return The surface area.
+     */
+    float surface_area() const;
+
+    /**
+     * Box that contains nothing: the neutral element of surrounding_box.
+     *
+     * @return The empty box.
+     */
+    static AABB empty()
+    {
+        return AABB(Vec3(FLT_MAX, FLT_MAX, FLT_MAX), Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+    }
+
 };
 
 
@@ -87,26 +106,25 @@ inline bool AABB::hit(const Ray &r, float tmin, float tmax) const
         tmax = t1 < tmax ? t1 : tmax;
 
         if (tmax <= tmin)
-            return true;
+            return false;
     }
 
     return true;
 }
 
 
+inline float AABB::surface_area() const
+{
+    auto d = bb_max - bb_min;
+
+    return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+
 AABB surrounding_box(AABB box0, AABB box1)
 {
-    auto small = Vec3 {
-            ffmin(box0.min().x(), box1.min().x()),
-            ffmin(box0.min().y(), box1.min().y()),
-            ffmin(box0.min().z(), box1.min().z())
-    };
-
-    auto big = Vec3{
-            ffmin(box0.max().x(), box1.max().x()),
-            ffmin(box0.max().y(), box1.max().y()),
-            ffmin(box0.max().z(), box1.max().z())
-    };
+    auto small = Vec3(_mm_min_ps(box0.min().v, box1.min().v));
+    auto big = Vec3(_mm_max_ps(box0.max().v, box1.max().v));
 
     return AABB(small, big);
 }
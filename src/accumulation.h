@@ -0,0 +1,172 @@
+/**
+ * Accumulation buffer.
+ *
+ * Sum of the samples of every pixel, kept in float together with the
+ * running variance of their luminance, so that the frame can be refined
+ * pass after pass and resolved into a (linear) framebuffer at any time.
+ *
+ * The tiles rendered concurrently write disjoint pixels.
+ */
+
+#ifndef RAYTRACING_ACCUMULATION_H
+#define RAYTRACING_ACCUMULATION_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "color.h"
+#include "framebuffer.h"
+#include "variance.h"
+
+
+class AccumulationBuffer
+{
+
+private:
+    int size_x;
+    int size_y;
+    std::vector<Color> sums;
+    std::vector<PixelVariance> variances;
+    std::vector<char> active;
+
+    inline std::size_t index(int x, int y) const { return static_cast<std::size_t>(y) * size_x + x; }
+
+public:
+    /**
+     * Deleted default empty constructor.
+     */
+    AccumulationBuffer() = delete;
+
+    /**
+     * Size constructor, with no samples and all the pixels active.
+     *
+     * @param size_x Width of the buffer.
+     * @param size_y Height of the buffer.
+     */
+    AccumulationBuffer(int size_x, int size_y)
+        : size_x{size_x}, size_y{size_y},
+          sums(static_cast<std::size_t>(size_x) * size_y, Color(0.0f, 0.0f, 0.0f)),
+          variances(static_cast<std::size_t>(size_x) * size_y),
+          active(static_cast<std::size_t>(size_x) * size_y, 1) {}
+
+    /**
+     * Add a sample to a pixel.
+     * The origin (0, 0) is the bottom left corner of the image.
+     *
+     * @param x Horizontal pixel coordinate.
+     * @param y Vertical pixel coordinate.
+     * @param sample Radiance of the sample.
+     */
+    inline void add(int x, int y, const Color &sample)
+    {
+        sums[index(x, y)] += sample;
+        variances[index(x, y)].add(sample.luminance());
+    }
+
+    inline const PixelVariance& variance(int x, int y) const { return variances[index(x, y)]; }
+
+    inline const Color& sum(int x, int y) const { return sums[index(x, y)]; }
+
+    /**
+     * Restore the state of a pixel, from a checkpoint.
+     *
+     * @param x Horizontal pixel coordinate.
+     * @param y Vertical pixel coordinate.
+     * @param sum Sum of the samples.
+     * @param variance Variance of the samples.
+     * @param is_active True if the pixel still needs samples.
+     */
+    void restore(int x, int y, const Color &sum, const PixelVariance &variance, bool is_active)
+    {
+        sums[index(x, y)] = sum;
+        variances[index(x, y)] = variance;
+        active[index(x, y)] = is_active;
+    }
+
+    /**
+     * @return True if the pixel still needs samples.
+     */
+    inline bool is_active(int x, int y) const { return active[index(x, y)] != 0; }
+
+    /**
+     * Keep active the pixels whose error, or the error of one of their
+     * neighbours, is above the threshold. Looking at the neighbours keeps
+     * the pixels that were lucky in their first samples from stopping
+     * early: the error of a single pixel is noisy, and stopping them
+     * would bias the image.
+     *
+     * The stopped pixels are not restarted, so the active pixels always
+     * have all the samples of the previous passes.
+     *
+     * @param threshold Error threshold, in display units (see PixelVariance::display_error).
+     *
+     * @return The amount of active pixels.
+     */
+    int update_active(float threshold)
+    {
+        std::vector<float> errors(variances.size());
+        std::transform(variances.begin(), variances.end(), errors.begin(),
+                       [](const PixelVariance &v) { return v.display_error(); });
+
+        auto count = 0;
+
+        for (int y=0; y<size_y; ++y)
+        {
+            for (int x=0; x<size_x; ++x)
+            {
+                auto error = 0.0f;
+
+                for (int ny=std::max(y - 1, 0); ny<=std::min(y + 1, size_y - 1); ++ny)
+                    for (int nx=std::max(x - 1, 0); nx<=std::min(x + 1, size_x - 1); ++nx)
+                        error = std::max(error, errors[index(nx, ny)]);
+
+                active[index(x, y)] = active[index(x, y)] && error >= threshold;
+                count += active[index(x, y)];
+            }
+        }
+
+        return count;
+    }
+
+    /**
+     * Write the mean of the samples of every pixel into the framebuffer.
+     *
+     * @param framebuffer Framebuffer of the same size.
+     */
+    void resolve(Framebuffer &framebuffer) const
+    {
+        for (int y=0; y<size_y; ++y)
+        {
+            for (int x=0; x<size_x; ++x)
+            {
+                auto col = sums[index(x, y)];
+                col /= static_cast<float>(std::max(variances[index(x, y)].count(), 1));
+
+                framebuffer.at(x, y) = col;
+            }
+        }
+    }
+
+    /**
+     * @return Total amount of samples in the buffer.
+     */
+    std::uint64_t samples() const
+    {
+        std::uint64_t total = 0;
+
+        for (const auto &v : variances)
+            total += static_cast<std::uint64_t>(v.count());
+
+        return total;
+    }
+
+    inline int width() const { return size_x; }
+
+    inline int height() const { return size_y; }
+
+};
+
+
+#endif //RAYTRACING_ACCUMULATION_H
@@ -20,6 +20,10 @@ public:
     bool hit(const Ray &r, float t0, float t1, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
 
+    bool occluded(const Ray &r, float t0, float t1) const override { return list_ptr->occluded(r, t0, t1); }
+
+    void collect_emitters(std::vector<Emitter> &emitters) override { list_ptr->collect_emitters(emitters); }
+
 };
 
 
@@ -0,0 +1,159 @@
+/**
+ * BVH benchmark.
+ *
+ * Builds the acceleration structure of a scene with every builder and
+ * traces the same camera rays through each of them, reporting the build
+ * time against the trace cost, for closest hit and occlusion queries.
+ */
+
+#ifndef RAYTRACING_BVHBENCHMARK_H
+#define RAYTRACING_BVHBENCHMARK_H
+
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "camera.h"
+#include "hitablelist.h"
+#include "bvhnode.h"
+#include "bvhbuilder.h"
+#include "lbvhbuilder.h"
+#include "linearbvh.h"
+#include "random.h"
+#include "scheduler.h"
+
+
+/**
+ * Trace one ray per pixel, without any shading.
+ *
+ * @param bvh The acceleration structure to trace.
+ * @param camera Camera generating the rays.
+ * @param width Width of the frame.
+ * @param height Height of the frame.
+ * @param seed Seed of the rays, the same for every structure.
+ * @param occlusion Trace occlusion queries instead of closest hit ones.
+ *
+ * @return Amount of rays that hit something.
+ */
+std::uint64_t trace_primary_rays(const Hitable &bvh, Camera &camera, int width, int height, std::uint64_t seed,
+                                 bool occlusion = false)
+{
+    std::uint64_t hits = 0;
+    HitRecord rec;
+
+    for (auto y=0; y<height; ++y)
+        for (auto x=0; x<width; ++x)
+        {
+            seed_sample(seed, static_cast<std::uint64_t>(y) * width + x, 0);
+
+            auto r = camera.get_ray((x + random_float()) / width, (y + random_float()) / height);
+
+            ++traversal_stats.rays;
+
+            auto hit = occlusion ? bvh.occluded(r, 0.001f, std::numeric_limits<float>::max())
+                                 : bvh.hit(r, 0.001f, std::numeric_limits<float>::max(), rec);
+            if (hit)
+                ++hits;
+        }
+
+    return hits;
+}
+
+
+/**
+ * Compare the median, SAH and LBVH builders on the given scene.
+ * The SAH and LBVH trees are traced as binary LinearBVHs, so only the
+ * quality of the hierarchy differs.
+ *
+ * @param scene The scene, as a HitableList object.
+ * @param camera Camera generating the rays.
+ * @param width Width of the frame.
+ * @param height Height of the frame.
+ * @param seed Seed of the rays.
+ * @param time0 Start of the time interval of the bounding boxes.
+ * @param time1 End of the time interval of the bounding boxes.
+ * @param scheduler Scheduler running the build tasks.
+ */
+void bvh_benchmark(Hitable *scene, Camera &camera, int width, int height, std::uint64_t seed,
+                   float time0, float time1, TaskScheduler *scheduler)
+{
+    auto *list = dynamic_cast<HitableList*>(scene);
+
+    if (list == nullptr || list->size() == 0)
+    {
+        std::cerr << "The BVH benchmark needs a list of objects." << std::endl;
+        return;
+    }
+
+    using clock = std::chrono::high_resolution_clock;
+
+    auto elapsed_ms = [](clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+
+    std::cout << "Objects: " << list->size() << ", rays: " << width * height << std::cout.widen('\n');
+    std::cout << std::left << std::setw(10) << "builder"
+              << std::right << std::setw(12) << "build ms"
+              << std::setw(12) << "trace ms"
+              << std::setw(14) << "visits/ray"
+              << std::setw(14) << "occluded ms"
+              << std::setw(10) << "hits" << std::cout.widen('\n');
+
+    for (const std::string method : {"median", "sah", "lbvh30", "lbvh63"})
+    {
+        auto build_start = clock::now();
+
+        std::unique_ptr<Hitable> bvh;
+
+        if (method == "median")
+        {
+            // The BVHNode children are not owned by their parents, and are leaked.
+            bvh.reset(new BVHNode(list->objects(), list->size(), time0, time1));
+        }
+        else
+        {
+            BVHBuildOptions options;
+            options.morton_bits = method == "lbvh30" ? 30 : 63;
+
+            std::unique_ptr<BVHBuilder> builder;
+
+            if (method == "sah")
+                builder.reset(new SAHBuilder(list->objects(), list->size(), time0, time1, options));
+            else
+                builder.reset(new LBVHBuilder(list->objects(), list->size(), time0, time1, options));
+
+            builder->build(scheduler);
+            bvh.reset(new LinearBVH(builder->build_nodes(), builder->ordered_primitives()));
+        }
+
+        auto build_ms = elapsed_ms(build_start);
+
+        traversal_stats = TraversalStats();
+
+        auto trace_start = clock::now();
+        auto hits = trace_primary_rays(*bvh, camera, width, height, seed);
+        auto trace_ms = elapsed_ms(trace_start);
+        auto visits = traversal_stats.node_visits;
+        auto rays = traversal_stats.rays;
+
+        auto occlusion_start = clock::now();
+        trace_primary_rays(*bvh, camera, width, height, seed, true);
+        auto occlusion_ms = elapsed_ms(occlusion_start);
+
+        std::cout << std::left << std::setw(10) << method
+                  << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << build_ms
+                  << std::setw(12) << trace_ms
+                  << std::setw(14) << static_cast<double>(visits) / std::max<std::uint64_t>(rays, 1)
+                  << std::setw(14) << occlusion_ms
+                  << std::setw(10) << hits << std::cout.widen('\n');
+    }
+}
+
+
+#endif //RAYTRACING_BVHBENCHMARK_H
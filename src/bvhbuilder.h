@@ -0,0 +1,449 @@
+/**
+ * BVH builders.
+ *
+ * The builders work on a flat array of primitive references (bounds and
+ * centroid computed once) and output an intermediate tree of build nodes,
+ * where every leaf holds a range of the reordered primitives.
+ * The build tree is then flattened into the LinearBVH used for traversal.
+ */
+
+#ifndef RAYTRACING_BVHBUILDER_H
+#define RAYTRACING_BVHBUILDER_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "hitable.h"
+#include "bvhnode.h"
+#include "scheduler.h"
+
+
+struct BVHBuildOptions
+{
+    /**
+     * Amount of bins along every axis for the binned SAH.
+     */
+    int bins = 16;
+
+    /**
+     * Above this size a node is always split, even if the SAH says otherwise.
+     */
+    int max_leaf_size = 4;
+
+    /**
+     * Cost of visiting a node, relative to intersection_cost.
+     */
+    float traversal_cost = 1.0f;
+
+    /**
+     * Cost of intersecting a primitive.
+     */
+    float intersection_cost = 1.0f;
+
+    /**
+     * Past this depth the nodes are split in halves instead of using the SAH,
+     * bounding the depth of the tree (and the traversal stack size).
+     */
+    int max_sah_depth = 64;
+
+    /**
+     * Nodes with more primitives than this build their children in parallel tasks.
+     */
+    std::size_t parallel_threshold = 4096;
+
+    /**
+     * Length of the Morton codes of the LBVH builder: 30 (10 bits per axis)
+     * or 63 (21 bits per axis). Shorter codes sort faster, longer ones
+     * separate the primitives of big scenes better.
+     */
+    int morton_bits = 63;
+};
+
+
+struct BVHBuildNode
+{
+    AABB box;
+    int children[2] = {-1, -1};
+    int split_axis = 0;
+    std::size_t first = 0;
+    std::size_t count = 0;
+
+    bool leaf() const { return count > 0; }
+};
+
+
+/**
+ * Common part of the BVH builders: the primitive references, the node
+ * storage shared by the parallel tasks and the accessors to the result.
+ */
+class BVHBuilder
+{
+
+protected:
+    BVHBuildOptions options;
+    Hitable **objects;
+    std::size_t objects_count;
+    float time0;
+    float time1;
+
+    std::vector<BVHPrimitive> primitives;
+    std::vector<BVHBuildNode> nodes;
+    std::atomic<int> nodes_used{0};
+    TaskScheduler *scheduler = nullptr;
+
+    BVHBuilder(Hitable **l, std::size_t n, float time0, float time1, const BVHBuildOptions &options);
+
+    /**
+     * Split [0, count) in chunks of the given size and run the function
+     * on every chunk, as parallel tasks when there is a scheduler.
+     *
+     * @param count Amount of elements.
+     * @param chunk Size of a chunk.
+     * @param function Function called with the range of a chunk.
+     */
+    void parallel_for(std::size_t count, std::size_t chunk, const std::function<void(std::size_t, std::size_t)> &function);
+
+    /**
+     * Compute the bounds and centroids of all the objects
+     * and reserve the storage for the nodes.
+     *
+     * @param task_scheduler Scheduler running the build tasks, nullptr for a serial build.
+     */
+    void prepare(TaskScheduler *task_scheduler);
+
+    void compute_bounds(std::size_t first, std::size_t last);
+    int make_leaf(const AABB &box, std::size_t first, std::size_t count);
+
+public:
+    virtual ~BVHBuilder() = default;
+
+    /**
+     * Build the tree.
+     *
+     * @param task_scheduler Scheduler running the build tasks, nullptr for a serial build.
+     *
+     * @return The index of the root node, -1 if there are no objects.
+     */
+    virtual int build(TaskScheduler *task_scheduler = nullptr) = 0;
+
+    /**
+     * Returns the build nodes, the root is the first one.
+     *
+     * @return The build nodes.
+     */
+    const std::vector<BVHBuildNode>& build_nodes() const { return nodes; }
+
+    /**
+     * Returns the primitives, in the order referenced by the leaves.
+     *
+     * @return The primitives.
+     */
+    const std::vector<BVHPrimitive>& ordered_primitives() const { return primitives; }
+
+};
+
+
+BVHBuilder::BVHBuilder(Hitable **l, std::size_t n, float time0, float time1, const BVHBuildOptions &options)
+    : options{options}, objects{l}, objects_count{n}, time0{time0}, time1{time1}
+{
+}
+
+
+void BVHBuilder::parallel_for(std::size_t count, std::size_t chunk, const std::function<void(std::size_t, std::size_t)> &function)
+{
+    chunk = std::max<std::size_t>(chunk, 1);
+
+    if (scheduler == nullptr || count <= chunk)
+    {
+        for (std::size_t first=0; first<count; first+=chunk)
+            function(first, std::min(first + chunk, count));
+
+        return;
+    }
+
+    TaskGroup group;
+
+    for (std::size_t first=0; first<count; first+=chunk)
+    {
+        auto last = std::min(first + chunk, count);
+        scheduler->submit(group, [&function, first, last]() { function(first, last); });
+    }
+
+    scheduler->wait(group);
+}
+
+
+void BVHBuilder::prepare(TaskScheduler *task_scheduler)
+{
+    scheduler = task_scheduler;
+
+    primitives.resize(objects_count);
+    nodes.clear();
+    nodes_used = 0;
+
+    if (objects_count == 0)
+        return;
+
+    parallel_for(objects_count, options.parallel_threshold, [this](std::size_t first, std::size_t last)
+    {
+        compute_bounds(first, last);
+    });
+
+    nodes.resize(2 * objects_count - 1);
+}
+
+
+void BVHBuilder::compute_bounds(std::size_t first, std::size_t last)
+{
+    for (auto i=first; i<last; ++i)
+    {
+        auto &primitive = primitives[i];
+
+        if (!objects[i]->bounding_box(time0, time1, primitive.box))
+            std::cerr << "No bounding box in BVHBuilder." << std::endl;
+
+        primitive.centroid = primitive.box.centroid();
+        primitive.object = objects[i];
+    }
+}
+
+
+int BVHBuilder::make_leaf(const AABB &box, std::size_t first, std::size_t count)
+{
+    auto index = nodes_used++;
+
+    nodes[index].box = box;
+    nodes[index].first = first;
+    nodes[index].count = count;
+
+    return index;
+}
+
+
+/**
+ * Binned SAH builder: every node is split along the plane with the
+ * lowest surface area heuristic cost, evaluated at the borders of bins
+ * of centroids. Slow to build, fast to trace.
+ */
+class SAHBuilder : public BVHBuilder
+{
+
+private:
+    int build_recursive(std::size_t first, std::size_t count, int depth);
+
+    /**
+     * @param offset Distance of a centroid from the start of the bins.
+     * @param scale Amount of bins per unit of distance.
+     * @param bins_count Amount of bins.
+     *
+     * @return The bin of the centroid, clamped to the bins (NaN goes to the first one).
+     */
+    static inline int bin_index(float offset, float scale, int bins_count);
+
+public:
+    /**
+     * Store the objects to build the tree for.
+     *
+     * @param l List of objects.
+     * @param n Amount of objects.
+     * @param time0 Start of the time interval of the bounding boxes.
+     * @param time1 End of the time interval of the bounding boxes.
+     * @param options Build parameters.
+     */
+    SAHBuilder(Hitable **l, std::size_t n, float time0, float time1, const BVHBuildOptions &options = BVHBuildOptions())
+        : BVHBuilder(l, n, time0, time1, options) {}
+
+    /**
+     * Build the tree.
+     *
+     * The bounds of the objects are computed once, then the subtrees
+     * are built in parallel when a scheduler is given.
+     *
+     * @param task_scheduler Scheduler running the build tasks, nullptr for a serial build.
+     *
+     * @return The index of the root node, -1 if there are no objects.
+     */
+    int build(TaskScheduler *task_scheduler = nullptr) override;
+
+};
+
+
+int SAHBuilder::build(TaskScheduler *task_scheduler)
+{
+    prepare(task_scheduler);
+
+    if (objects_count == 0)
+        return -1;
+
+    auto root = build_recursive(0, objects_count, 0);
+
+    nodes.resize(nodes_used);
+
+    return root;
+}
+
+
+inline int SAHBuilder::bin_index(float offset, float scale, int bins_count)
+{
+    auto b = offset * scale;
+
+    // Written to also reject NaN, before the conversion to int.
+    if (!(b > 0.0f))
+        return 0;
+
+    return b < bins_count ? std::min(static_cast<int>(b), bins_count - 1) : bins_count - 1;
+}
+
+
+int SAHBuilder::build_recursive(std::size_t first, std::size_t count, int depth)
+{
+    auto box = AABB::empty();
+    auto centroid_box = AABB::empty();
+
+    for (auto i=first; i<first+count; ++i)
+    {
+        box = surrounding_box(box, primitives[i].box);
+        centroid_box = surrounding_box(centroid_box, AABB(primitives[i].centroid, primitives[i].centroid));
+    }
+
+    if (count == 1)
+        return make_leaf(box, first, count);
+
+    struct Bin
+    {
+        AABB box = AABB::empty();
+        std::size_t count = 0;
+    };
+
+    auto bins_count = std::max(options.bins, 2);
+    std::vector<Bin> bins(bins_count);
+    std::vector<float> cost(bins_count - 1);
+
+    auto best_cost = FLT_MAX;
+    auto best_axis = -1;
+    auto best_split = 0;
+
+    auto extent = centroid_box.max() - centroid_box.min();
+
+    for (auto axis=0; axis<3 && depth<options.max_sah_depth; ++axis)
+    {
+        // Flat, or made infinite or NaN by broken primitives.
+        if (!(extent[axis] > 0.0f) || !std::isfinite(extent[axis]))
+            continue;
+
+        std::fill(bins.begin(), bins.end(), Bin());
+
+        auto scale = bins_count / extent[axis];
+
+        for (auto i=first; i<first+count; ++i)
+        {
+            auto b = bin_index(primitives[i].centroid[axis] - centroid_box.min()[axis], scale, bins_count);
+
+            bins[b].count++;
+            bins[b].box = surrounding_box(bins[b].box, primitives[i].box);
+        }
+
+        // Sweep from the left to accumulate the left side, then from the
+        // right to complete the cost of every split plane.
+        auto left_box = AABB::empty();
+        std::size_t left_count = 0;
+
+        for (auto b=0; b<bins_count-1; ++b)
+        {
+            left_box = surrounding_box(left_box, bins[b].box);
+            left_count += bins[b].count;
+            cost[b] = left_count > 0 ? left_count * left_box.surface_area() : 0.0f;
+        }
+
+        auto right_box = AABB::empty();
+        std::size_t right_count = 0;
+
+        for (auto b=bins_count-1; b>0; --b)
+        {
+            right_box = surrounding_box(right_box, bins[b].box);
+            right_count += bins[b].count;
+            cost[b-1] += right_count > 0 ? right_count * right_box.surface_area() : 0.0f;
+        }
+
+        for (auto b=0; b<bins_count-1; ++b)
+        {
+            if (cost[b] < best_cost)
+            {
+                best_cost = cost[b];
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    auto area = box.surface_area();
+    auto leaf_cost = options.intersection_cost * count;
+    auto split_cost = options.traversal_cost + (area > 0.0f ? options.intersection_cost * best_cost / area : leaf_cost);
+
+    if (count <= static_cast<std::size_t>(options.max_leaf_size) && (best_axis < 0 || leaf_cost <= split_cost))
+        return make_leaf(box, first, count);
+
+    auto begin = primitives.begin() + first;
+    auto end = begin + count;
+    auto middle = begin;
+
+    if (best_axis >= 0)
+    {
+        auto scale = bins_count / extent[best_axis];
+        auto axis_min = centroid_box.min()[best_axis];
+
+        middle = std::partition(begin, end, [=](const BVHPrimitive &p)
+        {
+            return bin_index(p.centroid[best_axis] - axis_min, scale, bins_count) <= best_split;
+        });
+    }
+
+    // All the centroids fall in the same bin, or the tree is too deep: split in two halves.
+    if (middle == begin || middle == end)
+    {
+        if (best_axis < 0)
+            best_axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2) : (extent.y() > extent.z() ? 1 : 2);
+
+        middle = begin + count / 2;
+
+        std::nth_element(begin, middle, end, [=](const BVHPrimitive &a, const BVHPrimitive &b)
+        {
+            return a.centroid[best_axis] < b.centroid[best_axis];
+        });
+    }
+
+    auto left_count = static_cast<std::size_t>(middle - begin);
+
+    auto node_index = nodes_used++;
+
+    int left, right;
+
+    if (scheduler != nullptr && count > options.parallel_threshold)
+    {
+        // The two halves touch disjoint ranges of the primitives.
+        TaskGroup group;
+        scheduler->submit(group, [&]() { left = build_recursive(first, left_count, depth + 1); });
+        right = build_recursive(first + left_count, count - left_count, depth + 1);
+        scheduler->wait(group);
+    }
+    else
+    {
+        left = build_recursive(first, left_count, depth + 1);
+        right = build_recursive(first + left_count, count - left_count, depth + 1);
+    }
+
+    nodes[node_index].box = box;
+    nodes[node_index].children[0] = left;
+    nodes[node_index].children[1] = right;
+    nodes[node_index].split_axis = best_axis;
+
+    return node_index;
+}
+
+
+#endif //RAYTRACING_BVHBUILDER_H
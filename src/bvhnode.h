@@ -3,11 +3,43 @@
 
 
 #include "hitable.h"
+#include "random.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <vector>
 
-int box_x_compare(const void *a, const void *b);
-int box_y_compare(const void *a, const void *b);
-int box_z_compare(const void *a, const void *b);
+
+/**
+ * Traversal counters, used to compare the quality of the BVH builders.
+ * Every thread counts its own rays and visited nodes.
+ */
+struct TraversalStats
+{
+    std::uint64_t rays = 0;
+    std::uint64_t node_visits = 0;
+
+    /**
+     * The occlusion queries are counted apart.
+     */
+    std::uint64_t shadow_rays = 0;
+    std::uint64_t shadow_node_visits = 0;
+};
+
+
+thread_local TraversalStats traversal_stats;
+
+
+/**
+ * Primitive reference used while building a BVH: the bounds and the
+ * centroid are computed once, instead of at every comparison.
+ */
+struct BVHPrimitive
+{
+    AABB box;
+    Vec3 centroid;
+    Hitable *object;
+};
 
 
 class BVHNode : public Hitable
@@ -18,141 +50,116 @@ private:
     Hitable *right;
     AABB box;
 
+    BVHNode(BVHPrimitive *primitives, std::size_t n);
+
 public:
     BVHNode() = default;
+
+    /**
+     * Median split constructor.
+     * Sort the objects along a random axis and split them in two halves.
+     *
+     * @param l List of objects.
+     * @param n Amount of objects.
+     * @param time0 Start of the time interval of the bounding boxes.
+     * @param time1 End of the time interval of the bounding boxes.
+     */
     BVHNode(Hitable **l, std::size_t n, float time0, float time1);
+
+    /**
+     * Children constructor, used by the other BVH builders.
+     *
+     * @param left Left child.
+     * @param right Right child.
+     * @param box Box containing both the children.
+     */
+    BVHNode(Hitable *left, Hitable *right, const AABB &box) : left{left}, right{right}, box{box} {}
+
     bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &b) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
 
 };
 
 
 BVHNode::BVHNode(Hitable **l, std::size_t n, float time0, float time1)
 {
-    auto axis = static_cast<int>(3 * dist(m));
+    std::vector<BVHPrimitive> primitives(n);
 
-    if (axis == 0)
-        std::qsort(l, n, sizeof(Hitable*), box_x_compare);
-    else if (axis == 1)
-        std::qsort(l, n, sizeof(Hitable*), box_y_compare);
-    else
-        std::qsort(l, n, sizeof(Hitable*), box_z_compare);
+    for (std::size_t i=0; i<n; ++i)
+    {
+        if (!l[i]->bounding_box(time0, time1, primitives[i].box))
+            std::cerr << "No bounding box in BVHNode constructor." << std::endl;
+
+        primitives[i].centroid = primitives[i].box.centroid();
+        primitives[i].object = l[i];
+    }
+
+    *this = BVHNode(primitives.data(), n);
+}
+
+
+BVHNode::BVHNode(BVHPrimitive *primitives, std::size_t n)
+{
+    auto axis = static_cast<int>(3 * random_float());
+
+    std::sort(primitives, primitives + n, [axis](const BVHPrimitive &a, const BVHPrimitive &b)
+    {
+        return a.box.min()[axis] < b.box.min()[axis];
+    });
 
     if (n == 1)
     {
-        left = right = l[0];
+        left = right = primitives[0].object;
     }
     else if (n == 2)
     {
-        left = l[0];
-        right = l[1];
+        left = primitives[0].object;
+        right = primitives[1].object;
     }
     else
     {
-        left = new BVHNode(l, n/2, time0, time1);
-        right = new BVHNode(l + n/2, n - n/2, time0, time1);
+        left = new BVHNode(primitives, n/2);
+        right = new BVHNode(primitives + n/2, n - n/2);
     }
 
-    AABB box_left, box_right;
-
-    if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
-        std::cerr << "No bounding box in BVHNode constructor." << std::endl;
-
-    box = surrounding_box(box_left, box_right);
+    box = primitives[0].box;
 
+    for (std::size_t i=1; i<n; ++i)
+        box = surrounding_box(box, primitives[i].box);
 }
 
 
 bool BVHNode::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
 {
-    if (box.hit(r, tmin, tmax))
-    {
-        HitRecord left_rec, right_rec;
-        auto hit_left = left->hit(r, tmin, tmax, left_rec);
-        auto hit_right = right->hit(r, tmin, tmax, right_rec);
-
-        if (hit_left && hit_right)
-        {
-            if (left_rec.t < right_rec.t)
-                rec = left_rec;
-            else
-                rec = right_rec;
-
-            return true;
-        }
-        else if (hit_left)
-        {
-            rec = left_rec;
-            return true;
-        }
-        else if (hit_right)
-        {
-            rec = right_rec;
-            return true;
-        }
-        else
-            return false;
-    }
+    ++traversal_stats.node_visits;
 
-    return false;
-}
+    if (!box.hit(r, tmin, tmax))
+        return false;
 
+    // The right child only overwrites the record with a closer hit.
+    auto hit_left = left->hit(r, tmin, tmax, rec);
+    auto hit_right = right->hit(r, tmin, hit_left ? rec.t : tmax, rec);
 
-bool BVHNode::bounding_box(float t0, float t1, AABB &b) const
-{
-    b = box;
-    return true;
+    return hit_left || hit_right;
 }
 
 
-int box_x_compare(const void *a, const void *b)
+bool BVHNode::occluded(const Ray &r, float tmin, float tmax) const
 {
-    AABB box_left, box_right;
-
-    Hitable *ah = *(Hitable**)a;
-    Hitable *bh = *(Hitable**)b;
+    ++traversal_stats.node_visits;
 
-    if (!ah->bounding_box(0, 0, box_left) || !bh->bounding_box(0, 0, box_right))
-        std::cerr << "No BVH node in BVH constructor" << std::endl;
+    if (!box.hit(r, tmin, tmax))
+        return false;
 
-    if (box_left.min()._x() - box_right.min()._x() < 0.0f)
-        return -1;
-    else
-        return 1;
+    return left->occluded(r, tmin, tmax) || right->occluded(r, tmin, tmax);
 }
 
 
-int box_y_compare(const void *a, const void *b)
-{
-    AABB box_left, box_right;
-
-    Hitable *ah = *(Hitable**)a;
-    Hitable *bh = *(Hitable**)b;
-
-    if (!ah->bounding_box(0, 0, box_left) || !bh->bounding_box(0, 0, box_right))
-        std::cerr << "No BVH node in BVH constructor" << std::endl;
-
-    if (box_left.min()._y() - box_right.min()._y() < 0.0f)
-        return -1;
-    else
-        return 1;
-}
-
-
-int box_z_compare(const void *a, const void *b)
+bool BVHNode::bounding_box(float t0, float t1, AABB &b) const
 {
-    AABB box_left, box_right;
-
-    Hitable *ah = *(Hitable**)a;
-    Hitable *bh = *(Hitable**)b;
-
-    if (!ah->bounding_box(0, 0, box_left) || !bh->bounding_box(0, 0, box_right))
-        std::cerr << "No BVH node in BVH constructor" << std::endl;
-
-    if (box_left.min()._z() - box_right.min()._z() < 0.0f)
-        return -1;
-    else
-        return 1;
+    b = box;
+    return true;
 }
 
 
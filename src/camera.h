@@ -16,6 +16,8 @@
 
 
 #include "ray.h"
+#include "random.h"
+#include "sampling.h"
 
 
 Vec3 random_in_unit_disc();
@@ -179,7 +181,7 @@ Ray Camera::get_ray(float s, float t)
 {
     auto rd = lens_radius * random_in_unit_disc();
     auto offset = u * rd.x() + v * rd.y();
-    auto time = time0 + dist(m) * (time1 - time0);
+    auto time = time0 + random_float() * (time1 - time0);
 
     return {
         origin + offset,
@@ -191,13 +193,8 @@ Ray Camera::get_ray(float s, float t)
 
 Vec3 random_in_unit_disc()
 {
-    Vec3 p;
-
-    do {
-        p = 2.0f * Vec3(dist(m), dist(m), dist(m)) - Vec3(1.0f, 1.0f, 0.0f);
-    } while(dot(p, p) >= 1.0f);
-
-    return p;
+    auto u = random_float2();
+    return sample_concentric_disk(u.first, u.second);
 }
 
 
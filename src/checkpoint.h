@@ -0,0 +1,198 @@
+/**
+ * Checkpoints.
+ *
+ * Binary snapshot of an in-progress render: the settings that decide the
+ * samples (size, samples per pixel, seed, sampler), hashes of the scene
+ * and of the other settings that change the image, the next pass, and
+ * for every pixel the float sum of its samples, its variance estimate
+ * (so also its amount of samples) and whether it is still active.
+ *
+ * Every sample only depends on the seed, the pixel and its index, and
+ * the sums are restored bit for bit, so a resumed render gives the same
+ * image as an uninterrupted one.
+ */
+
+#ifndef RAYTRACING_CHECKPOINT_H
+#define RAYTRACING_CHECKPOINT_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "accumulation.h"
+#include "color.h"
+#include "fileutils.h"
+#include "variance.h"
+
+
+struct CheckpointHeader
+{
+    int width = 0;
+    int height = 0;
+    int samples = 0;
+    std::uint64_t seed = 0;
+    std::string sampler;
+
+    /**
+     * Hash of the scene (its source and its geometry), and of the other
+     * render settings (integrator, light sampler, depths, noise threshold).
+     */
+    std::uint64_t scene_hash = 0;
+    std::uint64_t settings_hash = 0;
+
+    /**
+     * First sample index of the next pass, and amount of passes done.
+     */
+    int next_sample = 0;
+    int passes = 0;
+
+    /**
+     * @return True if the checkpoint was written by a render with the same settings.
+     */
+    bool matches(const CheckpointHeader &other) const
+    {
+        return width == other.width && height == other.height && samples == other.samples &&
+               seed == other.seed && sampler == other.sampler && scene_hash == other.scene_hash &&
+               settings_hash == other.settings_hash;
+    }
+};
+
+
+constexpr char checkpoint_magic[4] = {'R', 'T', 'C', 'K'};
+constexpr std::uint32_t checkpoint_version = 2;
+
+
+template <typename T>
+void write_value(std::ostream &out, const T &value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+template <typename T>
+bool read_value(std::istream &in, T &value)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+
+/**
+ * Write the checkpoint into the given file, through a temporary file so
+ * that a process killed while writing leaves the previous checkpoint.
+ *
+ * @param filename Checkpoint filename.
+ * @param header Settings and progress of the render.
+ * @param accumulation The accumulated samples.
+ *
+ * @return True if the checkpoint was written, otherwise the previous one is left.
+ */
+bool write_checkpoint(const std::string &filename, const CheckpointHeader &header, const AccumulationBuffer &accumulation)
+{
+    auto temporary = filename + ".tmp";
+
+    {
+        std::ofstream out(temporary, std::ios::binary);
+
+        out.write(checkpoint_magic, sizeof(checkpoint_magic));
+        write_value(out, checkpoint_version);
+        write_value(out, header.width);
+        write_value(out, header.height);
+        write_value(out, header.samples);
+        write_value(out, header.seed);
+        write_value(out, static_cast<std::uint32_t>(header.sampler.size()));
+        out.write(header.sampler.data(), static_cast<std::streamsize>(header.sampler.size()));
+        write_value(out, header.scene_hash);
+        write_value(out, header.settings_hash);
+        write_value(out, header.next_sample);
+        write_value(out, header.passes);
+
+        for (int y=0; y<accumulation.height(); ++y)
+        {
+            for (int x=0; x<accumulation.width(); ++x)
+            {
+                const auto &sum = accumulation.sum(x, y);
+                const auto &variance = accumulation.variance(x, y);
+
+                write_value(out, sum.r());
+                write_value(out, sum.g());
+                write_value(out, sum.b());
+                write_value(out, variance.count());
+                write_value(out, variance.exact_mean());
+                write_value(out, variance.squared_differences());
+                write_value(out, static_cast<std::uint8_t>(accumulation.is_active(x, y)));
+            }
+        }
+
+        if (!out)
+        {
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    return replace_file(temporary, filename);
+}
+
+
+/**
+ * Read a checkpoint.
+ *
+ * @param filename Checkpoint filename.
+ * @param header Read settings and progress of the render.
+ * @param accumulation Buffer to restore, of the size of the checkpoint.
+ *
+ * @return True if the checkpoint was read; false if it is missing, damaged
+ *         or for a different image size.
+ */
+bool read_checkpoint(const std::string &filename, CheckpointHeader &header, AccumulationBuffer &accumulation)
+{
+    std::ifstream in(filename, std::ios::binary);
+
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t sampler_length;
+
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + 4, checkpoint_magic) ||
+        !read_value(in, version) || version != checkpoint_version)
+        return false;
+
+    if (!read_value(in, header.width) || !read_value(in, header.height) || !read_value(in, header.samples) ||
+        !read_value(in, header.seed) || !read_value(in, sampler_length) || sampler_length > 256)
+        return false;
+
+    header.sampler.resize(sampler_length);
+
+    if (!in.read(&header.sampler[0], sampler_length) ||
+        !read_value(in, header.scene_hash) || !read_value(in, header.settings_hash) ||
+        !read_value(in, header.next_sample) || !read_value(in, header.passes))
+        return false;
+
+    if (header.width != accumulation.width() || header.height != accumulation.height())
+        return false;
+
+    for (int y=0; y<header.height; ++y)
+    {
+        for (int x=0; x<header.width; ++x)
+        {
+            float r, g, b;
+            int n;
+            double mean, m2;
+            std::uint8_t active;
+
+            if (!read_value(in, r) || !read_value(in, g) || !read_value(in, b) || !read_value(in, n) ||
+                !read_value(in, mean) || !read_value(in, m2) || !read_value(in, active))
+                return false;
+
+            accumulation.restore(x, y, Color(r, g, b), PixelVariance(n, mean, m2), active != 0);
+        }
+    }
+
+    return true;
+}
+
+
+#endif //RAYTRACING_CHECKPOINT_H
@@ -93,6 +93,11 @@ public:
     float g() const { return _g; }
     float b() const { return _b; }
 
+    /**
+     * @return Luminance of the color, with the Rec. 709 weights.
+     */
+    float luminance() const { return 0.2126f * _r + 0.7152f * _g + 0.0722f * _b; }
+
     Color& operator+=(const Color &a);
     Color& operator/=(float a);
 
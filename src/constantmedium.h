@@ -4,6 +4,7 @@
 
 #include "hitable.h"
 #include "material.h"
+#include "random.h"
 
 
 class ConstantMedium : public Hitable
@@ -24,7 +25,7 @@ public:
 
 bool ConstantMedium::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
 {
-    bool db = (dist(m) < 0.00001);
+    bool db = (random_float() < 0.00001);
 
     db = false; // ???
 
@@ -44,14 +45,18 @@ bool ConstantMedium::hit(const Ray &r, float t_min, float t_max, HitRecord &rec)
             if (rec1.t < 0) rec1.t = 0;
 
             auto distance_inside_boundary = (rec2.t - rec1.t) * r.direction().length();
-            auto hit_distance = -(1.0f / density) * std::log(dist(m));
+            auto hit_distance = -(1.0f / density) * std::log(random_float());
 
             if (hit_distance < distance_inside_boundary)
             {
                 rec.t = rec1.t + hit_distance / r.direction().length();
                 rec.p = r.point_at_parameter(rec.t);
-                rec.normal = Vec3(1.0f, 0.0f, 0.0f); // arbitrary... ???
+                // A point inside the medium has no surface: the light sampler skips the cosine bound.
+                rec.normal = Vec3(0.0f, 0.0f, 0.0f);
                 rec.mat_ptr = phase_function;
+                rec.object = this;
+                rec.instance = nullptr;
+                rec.deferred = false;
 
                 return true;
             }
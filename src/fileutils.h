@@ -0,0 +1,49 @@
+/**
+ * File helpers.
+ *
+ * The outputs of the renderer (images, checkpoints, scene caches) are
+ * written into a temporary file and then moved over the destination, so
+ * that a process killed while writing never leaves a truncated file.
+ */
+
+#ifndef RAYTRACING_FILEUTILS_H
+#define RAYTRACING_FILEUTILS_H
+
+
+#include <cstdio>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+
+/**
+ * Move a file over another one, replacing it if it exists: std::rename
+ * does not replace an existing file on Windows. The source is removed if
+ * it cannot be moved, so that no temporary file is left behind.
+ *
+ * @param source The file to move, usually a temporary file.
+ * @param destination The file to replace.
+ *
+ * @return True if the file was moved.
+ */
+bool replace_file(const std::string &source, const std::string &destination)
+{
+#if defined(_WIN32)
+    auto moved = MoveFileExA(source.c_str(), destination.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    auto moved = std::rename(source.c_str(), destination.c_str()) == 0;
+#endif
+
+    if (!moved)
+        std::remove(source.c_str());
+
+    return moved;
+}
+
+
+#endif //RAYTRACING_FILEUTILS_H
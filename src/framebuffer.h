@@ -0,0 +1,72 @@
+/**
+ * Framebuffer.
+ *
+ * In-memory storage for the rendered pixels, as linear radiance.
+ * The accumulated samples are resolved into the framebuffer, which is
+ * then handed to an image writer (see image.h).
+ */
+
+#ifndef RAYTRACING_FRAMEBUFFER_H
+#define RAYTRACING_FRAMEBUFFER_H
+
+
+#include <vector>
+
+#include "color.h"
+
+
+class Framebuffer
+{
+
+private:
+    int size_x;
+    int size_y;
+    std::vector<Color> pixels;
+
+public:
+    /**
+     * Deleted default empty constructor.
+     */
+    Framebuffer() = delete;
+
+    /**
+     * Size constructor.
+     *
+     * Will allocate the pixels, initialised to black.
+     *
+     * @param size_x Width of the framebuffer.
+     * @param size_y Height of the framebuffer.
+     */
+    Framebuffer(int size_x, int size_y)
+        : size_x{size_x}, size_y{size_y}, pixels(static_cast<std::size_t>(size_x) * size_y) {}
+
+    /**
+     * Access the pixel at the given coordinate.
+     * The origin (0, 0) is the bottom left corner of the image.
+     *
+     * @param x Horizontal pixel coordinate.
+     * @param y Vertical pixel coordinate.
+     *
+     * @return Reference to the pixel color.
+     */
+    inline Color& at(int x, int y) { return pixels[static_cast<std::size_t>(y) * size_x + x]; }
+    inline const Color& at(int x, int y) const { return pixels[static_cast<std::size_t>(y) * size_x + x]; }
+
+    /**
+     * Returns the width of the framebuffer.
+     *
+     * @return Width of the framebuffer.
+     */
+    inline int width() const { return size_x; }
+
+    /**
+     * Returns the height of the framebuffer.
+     *
+     * @return Height of the framebuffer.
+     */
+    inline int height() const { return size_y; }
+
+};
+
+
+#endif //RAYTRACING_FRAMEBUFFER_H
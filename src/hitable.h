@@ -6,9 +6,11 @@
 #include "ray.h"
 
 #include <cfloat>
+#include <vector>
 
 
 class Material;
+class Hitable;
 
 
 struct HitRecord
@@ -19,6 +21,73 @@ struct HitRecord
     Vec3 p;
     Vec3 normal;
 	Material *mat_ptr;
+
+    /**
+     * The primitive that was hit, the instancing wrappers keep the one of the wrapped object.
+     */
+    const Hitable *object = nullptr;
+
+    /**
+     * The outermost wrapper placing the primitive (translate, rotate_y), nullptr
+     * if none: with object, it tells the instances of a primitive apart.
+     */
+    const Hitable *instance = nullptr;
+
+    /**
+     * Set by the primitives that only record t and their local parameters
+     * while intersecting: p, normal, u, v and mat_ptr are valid only after
+     * finalize_hit().
+     */
+    bool deferred = false;
+};
+
+
+/**
+ * Emissive primitive found in the scene.
+ */
+struct Emitter
+{
+    /**
+     * Object to sample, with the instancing wrappers of the primitive applied.
+     */
+    Hitable *shape;
+
+    /**
+     * The primitive itself, as reported in HitRecord::object.
+     */
+    const Hitable *primitive;
+
+    /**
+     * The outermost wrapper placing the primitive, as reported in HitRecord::instance.
+     */
+    const Hitable *instance = nullptr;
+};
+
+
+/**
+ * Bounds of the light emitted by a primitive, used to build the light BVH.
+ *
+ * The normals of the surface lie in the cone of half angle theta_o around
+ * the axis, and each point emits in the cone of half angle theta_e around
+ * its normal.
+ */
+struct LightBounds
+{
+    AABB bounds = AABB::empty();
+
+    /**
+     * Emitted power (luminance times area times pi).
+     */
+    float power = 0.0f;
+
+    Vec3 axis = Vec3::Z;
+    float cos_theta_o = -1.0f;
+    float cos_theta_e = 0.0f;
+
+    /**
+     * The surface emits on both sides of the normals.
+     */
+    bool two_sided = false;
 };
 
 
@@ -26,14 +95,110 @@ class Hitable
 {
 
 public:
+    virtual ~Hitable() = default;
+
+    /**
+     * Closest hit query. The record is written only when the ray hits, and
+     * the attributes of the hit point may be deferred (see finalize()).
+     *
+     * @param r The ray.
+     * @param t_min Start of the interval.
+     * @param t_max End of the interval.
+     * @param rec Output, the closest hit.
+     *
+     * @return True if the ray hits the object in the interval.
+     */
     virtual bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const = 0;
+
+    /**
+     * Compute the attributes deferred by hit(), once for the closest hit.
+     *
+     * @param r The ray given to hit().
+     * @param rec The record filled by hit().
+     */
+    virtual void finalize(const Ray &r, HitRecord &rec) const {}
     virtual bool bounding_box(float t0, float t1, AABB &box) const = 0;
 
+    /**
+     * Visibility query: true if the ray hits anything in the interval.
+     *
+     * Unlike hit(), it can stop at the first intersection found and skips
+     * the attributes of the hit point (uv, normal, material). The default
+     * falls back to hit().
+     *
+     * @param r The ray.
+     * @param t_min Start of the interval.
+     * @param t_max End of the interval.
+     *
+     * @return True if the ray is blocked.
+     */
+    virtual bool occluded(const Ray &r, float t_min, float t_max) const
+    {
+        HitRecord rec;
+        return hit(r, t_min, t_max, rec);
+    }
+
+    /**
+     * Density of the directions generated by random(), in solid angle.
+     *
+     * @param origin The point the object is seen from.
+     * @param direction The direction to evaluate.
+     *
+     * @return The density, 0 if the direction misses the object.
+     */
+    virtual float pdf_value(const Vec3 &origin, const Vec3 &direction) const { return 0.0f; }
+
+    /**
+     * Random direction from origin towards the object, used to sample the lights.
+     *
+     * @param origin The point the object is seen from.
+     *
+     * @return The direction, not normalized.
+     */
+    virtual Vec3 random(const Vec3 &origin) const { return Vec3::X; }
+
+    /**
+     * Append the emissive primitives that can be sampled with random().
+     *
+     * @param emitters List of emitters to fill.
+     */
+    virtual void collect_emitters(std::vector<Emitter> &emitters) {}
+
+    /**
+     * Bounds of the light emitted by the object, in the given time interval.
+     *
+     * @param t0 Start of the time interval.
+     * @param t1 End of the time interval.
+     * @param light Output, the bounds.
+     *
+     * @return False if the object can't report the bounds of its light.
+     */
+    virtual bool light_bounds(float t0, float t1, LightBounds &light) const { return false; }
+
 };
 
 
+/**
+ * Compute the deferred attributes of a hit, if any.
+ *
+ * @param r The ray that produced the hit.
+ * @param rec The hit record.
+ */
+inline void finalize_hit(const Ray &r, HitRecord &rec)
+{
+    if (rec.deferred)
+    {
+        rec.deferred = false;
+        rec.object->finalize(r, rec);
+    }
+}
+
+
 /* === INSTANCING SYSTEM === */
 
+// The wrappers transform the attributes of the hit point, so they finalize
+// the hits of their object right away, in the space of the object.
+
 
 /**
  * Translate Class
@@ -58,6 +223,16 @@ public:
     bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
 
+    bool occluded(const Ray &r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(Ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+    }
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override { return ptr->pdf_value(origin - offset, direction); }
+    Vec3 random(const Vec3 &origin) const override { return ptr->random(origin - offset); }
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
+
 };
 
 
@@ -67,7 +242,9 @@ bool Translate::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) cons
 
     if (ptr->hit(moved_r, t_min, t_max, rec))
     {
+        finalize_hit(moved_r, rec);
         rec.p += offset;
+        rec.instance = this;
         return true;
     }
 
@@ -87,6 +264,27 @@ bool Translate::bounding_box(float t0, float t1, AABB &box) const
 }
 
 
+void Translate::collect_emitters(std::vector<Emitter> &emitters)
+{
+    std::vector<Emitter> wrapped;
+    ptr->collect_emitters(wrapped);
+
+    for (const auto &e : wrapped)
+        emitters.push_back({new Translate(e.shape, offset), e.primitive, this});
+}
+
+
+bool Translate::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    if (!ptr->light_bounds(t0, t1, light))
+        return false;
+
+    light.bounds = AABB(light.bounds.min() + offset, light.bounds.max() + offset);
+
+    return true;
+}
+
+
 /**
  * Rotate Y Class
  */
@@ -95,6 +293,7 @@ class RotateY : public Hitable
 
 private:
     Hitable *ptr;
+    float angle;
     float sin_theta;
     float cos_theta;
     bool hasbox;
@@ -114,10 +313,44 @@ public:
     bool hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override { box = bbox; return hasbox; }
 
+    bool occluded(const Ray &r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(Ray(to_object(r.origin()), to_object(r.direction()), r.time()), t_min, t_max);
+    }
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override;
+    Vec3 random(const Vec3 &origin) const override;
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
+
+    /**
+     * Rotate a vector from the world space to the space of the object.
+     *
+     * @param v The vector to rotate.
+     *
+     * @return The rotated vector.
+     */
+    Vec3 to_object(const Vec3 &v) const
+    {
+        return Vec3(cos_theta * v.x() - sin_theta * v.z(), v.y(), sin_theta * v.x() + cos_theta * v.z());
+    }
+
+    /**
+     * Rotate a vector from the space of the object to the world space.
+     *
+     * @param v The vector to rotate.
+     *
+     * @return The rotated vector.
+     */
+    Vec3 to_world(const Vec3 &v) const
+    {
+        return Vec3(cos_theta * v.x() + sin_theta * v.z(), v.y(), -sin_theta * v.x() + cos_theta * v.z());
+    }
+
 };
 
 
-RotateY::RotateY(Hitable *p, float angle) : ptr(p)
+RotateY::RotateY(Hitable *p, float angle) : ptr(p), angle(angle)
 {
     auto radians = static_cast<float>((M_PI / 180.0f) * angle);
 
@@ -154,35 +387,67 @@ RotateY::RotateY(Hitable *p, float angle) : ptr(p)
 
 bool RotateY::hit(const Ray &r, float t_min, float t_max, HitRecord &rec) const
 {
-    auto origin = r.origin();
-    auto direction = r.direction();
+    auto rotated_r = Ray(to_object(r.origin()), to_object(r.direction()), r.time());
+
+    if (ptr->hit(rotated_r, t_min, t_max, rec))
+    {
+        finalize_hit(rotated_r, rec);
+        rec.p = to_world(rec.p);
+        rec.normal = to_world(rec.normal);
+        rec.instance = this;
+
+        return true;
+    }
+
+    return false;
+}
+
+
+float RotateY::pdf_value(const Vec3 &origin, const Vec3 &direction) const
+{
+    return ptr->pdf_value(to_object(origin), to_object(direction));
+}
 
-    origin[0] = cos_theta * r.origin().x() - sin_theta * r.origin().z();
-    origin[2] = -sin_theta * r.origin().x() + cos_theta * r.origin().z();
 
-    direction[0] = cos_theta * r.direction().x() - sin_theta * r.direction().z();
-    direction[2] = -sin_theta * r.direction().x() + cos_theta * r.direction().z();
+Vec3 RotateY::random(const Vec3 &origin) const
+{
+    return to_world(ptr->random(to_object(origin)));
+}
 
-    auto rotated_r = Ray(origin, direction, r.time());
 
-    if (ptr->hit(rotated_r, t_min, t_max, rec))
-    {
-        auto p = rec.p;
-        auto normal = rec.normal;
+void RotateY::collect_emitters(std::vector<Emitter> &emitters)
+{
+    std::vector<Emitter> wrapped;
+    ptr->collect_emitters(wrapped);
+
+    for (const auto &e : wrapped)
+        emitters.push_back({new RotateY(e.shape, angle), e.primitive, this});
+}
 
-        p[0] = cos_theta * rec.p.x() + sin_theta * rec.p.z();
-        p[2] = -sin_theta * rec.p.x() + cos_theta * rec.p.z();
 
-        normal[0] = cos_theta * rec.normal.x() + sin_theta * rec.normal.z();
-        normal[2] = -sin_theta * rec.normal.x() + cos_theta * rec.normal.z();
+bool RotateY::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    if (!ptr->light_bounds(t0, t1, light))
+        return false;
 
-        rec.p = p;
-        rec.normal = normal;
+    auto box = AABB::empty();
 
-        return true;
+    for (auto i=0; i<8; ++i)
+    {
+        auto corner = Vec3(
+                (i & 1) ? light.bounds.max().x() : light.bounds.min().x(),
+                (i & 2) ? light.bounds.max().y() : light.bounds.min().y(),
+                (i & 4) ? light.bounds.max().z() : light.bounds.min().z()
+        );
+        auto rotated = to_world(corner);
+
+        box = surrounding_box(box, AABB(rotated, rotated));
     }
 
-    return false;
+    light.bounds = box;
+    light.axis = to_world(light.axis);
+
+    return true;
 }
 
 
@@ -198,6 +463,7 @@ public:
     {
         if(ptr->hit(r, t_min, t_max, rec)) 
         {
+            finalize_hit(r, rec);
             rec.normal = -rec.normal;
             return true;
         }
@@ -209,6 +475,30 @@ public:
     {
         return ptr->bounding_box(t0, t1, box);
     }
+
+    bool occluded(const Ray &r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(r, t_min, t_max);
+    }
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override { return ptr->pdf_value(origin, direction); }
+    Vec3 random(const Vec3 &origin) const override { return ptr->random(origin); }
+
+    void collect_emitters(std::vector<Emitter> &emitters) override
+    {
+        // The sampling does not depend on the orientation of the normals.
+        ptr->collect_emitters(emitters);
+    }
+
+    bool light_bounds(float t0, float t1, LightBounds &light) const override
+    {
+        if (!ptr->light_bounds(t0, t1, light))
+            return false;
+
+        light.axis = -light.axis;
+
+        return true;
+    }
 	
 };
 
@@ -18,23 +18,32 @@ public:
 
     bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    void collect_emitters(std::vector<Emitter> &emitters) override
+    {
+        for (std::size_t i=0; i<list_size; ++i)
+            list[i]->collect_emitters(emitters);
+    }
+
+    Hitable** objects() const { return list; }
+    std::size_t size() const { return list_size; }
 
 };
 
 
 bool HitableList::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
 {
-    HitRecord temp_rec;
     auto hit_anything = false;
     auto closest_so_far = tmax;
 
+    // The objects only write the record when they are hit, in a shorter interval every time.
     for (std::size_t idx=0; idx < list_size; ++idx)
     {
-        if (list[idx]->hit(r, tmin, closest_so_far, temp_rec))
+        if (list[idx]->hit(r, tmin, closest_so_far, rec))
         {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = rec.t;
         }
     }
 
@@ -42,6 +51,16 @@ bool HitableList::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) cons
 }
 
 
+bool HitableList::occluded(const Ray &r, float tmin, float tmax) const
+{
+    for (std::size_t idx=0; idx < list_size; ++idx)
+        if (list[idx]->occluded(r, tmin, tmax))
+            return true;
+
+    return false;
+}
+
+
 bool HitableList::bounding_box(float t0, float t1, AABB &box) const
 {
     if (list_size < 1)
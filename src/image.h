@@ -1,110 +1,210 @@
 /**
  * Image.
  *
- * Class used for handling the image generation process into a file.
- * The current implementation allows the creation of images in the PPM
- * ASCII format.
+ * Writers of the framebuffer into image files, chosen by the extension
+ * of the filename:
+ * - .png: 8 bit PNG, through the bundled stb_image_write;
+ * - .pfm: 32 bit float PFM, with the linear values (HDR);
+ * - anything else: 8 bit binary PPM (P6).
+ *
+ * The framebuffer holds linear radiance: the 8 bit formats gamma correct
+ * and clamp it. Every writer converts the whole framebuffer in memory
+ * and writes it with a single call.
  */
 
-#include <iostream>
-#include <fstream>
+#ifndef RAYTRACING_IMAGE_H
+#define RAYTRACING_IMAGE_H
 
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "color.h"
+#include "fileutils.h"
+#include "framebuffer.h"
+#include "stb_image_write.h"
 
 
-class Image
+class ImageWriter
 {
 
-private:
-    std::string filename;
-    std::ofstream output_file;
-
-    int size_x;
-    int size_y;
-
-    int line_counter;
-
 public:
-    /**
-     * Deleted default empty constructor.
-     */
-    Image() = delete;
+    virtual ~ImageWriter() = default;
 
     /**
-     * Filename and image size constructor.
+     * Write the framebuffer into the given file.
      *
-     * Will open the output image stream.
+     * @param filename Output image filename.
+     * @param framebuffer Framebuffer holding the rendered pixels.
      *
-     * @param filename Output image filename
-     * @param size_x Width of the image
-     * @param size_y Height of the image
+     * @return True if the image was written.
      */
-    explicit Image(const std::string &filename, int size_x = 200, int size_y = 100);
+    virtual bool write(const std::string &filename, const Framebuffer &framebuffer) const = 0;
 
-    /**
-     * Destructor.
-     *
-     * Will close the output image stream.
-     */
-    ~Image();
+};
 
 
-    /**
-     * Write into the image, appending the color information.
-     *
-     * @param color Color to add into the image.
-     */
-    void write(const Color &color);
+/**
+ * Convert the framebuffer into 8 bit gamma corrected RGB, in scanline
+ * order (from the top row to the bottom one). The NaN pixels are black.
+ *
+ * @param framebuffer Framebuffer holding the rendered pixels.
+ *
+ * @return The bytes of the image.
+ */
+std::vector<unsigned char> to_rgb8(const Framebuffer &framebuffer)
+{
+    std::vector<unsigned char> bytes(static_cast<std::size_t>(framebuffer.width()) * framebuffer.height() * 3);
+    auto out = bytes.begin();
 
-    /**
-     * Returns the width of the image.
-     *
-     * @return Width of the image.
-     */
-    inline int width() const { return size_x; }
+    auto quantize = [](float value)
+    {
+        if (std::isnan(value))
+            return static_cast<unsigned char>(0);
+
+        return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.99f);
+    };
+
+    for (auto idY=framebuffer.height() - 1; idY>=0; --idY)
+    {
+        for (auto idX=0; idX<framebuffer.width(); ++idX)
+        {
+            auto color = framebuffer.at(idX, idY);
+            color.gamma();
+
+            *out++ = quantize(color.r());
+            *out++ = quantize(color.g());
+            *out++ = quantize(color.b());
+        }
+    }
+
+    return bytes;
+}
+
+
+class PPMWriter : public ImageWriter
+{
+
+public:
+    bool write(const std::string &filename, const Framebuffer &framebuffer) const override
+    {
+        auto bytes = to_rgb8(framebuffer);
+        std::ofstream out(filename, std::ios::binary);
+
+        out << "P6\n" << framebuffer.width() << " " << framebuffer.height() << "\n255\n";
+        out.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+
+        return static_cast<bool>(out);
+    }
 
-    /**
-     * Returns the height of the image.
-     *
-     * @return Height of the image.
-     */
-    inline int height() const { return size_y; }
 };
 
 
-Image::Image(const std::string &filename, int size_x, int size_y) : filename{filename}, size_x{size_x}, size_y{size_y}
+class PNGWriter : public ImageWriter
 {
-    output_file.open(filename);
-    output_file << "P3\n";
-    output_file << size_x << " " << size_y << "\n";
-    output_file << "255\n";
-    line_counter = 0;
-}
 
+public:
+    bool write(const std::string &filename, const Framebuffer &framebuffer) const override
+    {
+        auto bytes = to_rgb8(framebuffer);
+
+        return stbi_write_png(filename.c_str(), framebuffer.width(), framebuffer.height(), 3,
+                              bytes.data(), framebuffer.width() * 3) != 0;
+    }
+
+};
 
-Image::~Image()
+
+/**
+ * Portable float map: linear RGB floats, little endian (negative scale),
+ * from the bottom row to the top one, as the framebuffer.
+ */
+class PFMWriter : public ImageWriter
 {
-    if (line_counter != (size_x * size_y))
+
+public:
+    bool write(const std::string &filename, const Framebuffer &framebuffer) const override
     {
-        std::cout << "WARNING!" << std::endl;
-        std::cout << "Line count is " << line_counter << ", and does not match the expected total line count ";
-        std::cout << "that should be " << (size_x * size_y) << "." << std::endl;
+        std::vector<float> values(static_cast<std::size_t>(framebuffer.width()) * framebuffer.height() * 3);
+        auto out_value = values.begin();
+
+        for (auto idY=0; idY<framebuffer.height(); ++idY)
+        {
+            for (auto idX=0; idX<framebuffer.width(); ++idX)
+            {
+                const auto &color = framebuffer.at(idX, idY);
+
+                *out_value++ = color.r();
+                *out_value++ = color.g();
+                *out_value++ = color.b();
+            }
+        }
+
+        std::ofstream out(filename, std::ios::binary);
+
+        out << "PF\n" << framebuffer.width() << " " << framebuffer.height() << "\n-1.0\n";
+        out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(float)));
+
+        return static_cast<bool>(out);
     }
 
-    output_file.close();
-}
+};
 
 
-void Image::write(const Color &color)
+/**
+ * Create the writer for the extension of the filename.
+ *
+ * @param filename Output image filename.
+ *
+ * @return The writer, PPM if the extension is not known.
+ */
+std::unique_ptr<ImageWriter> make_image_writer(const std::string &filename)
 {
-    auto write_color = color;
+    auto dot = filename.find_last_of('.');
+    auto extension = dot != std::string::npos ? filename.substr(dot + 1) : std::string();
+
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    if (extension == "png")
+        return std::unique_ptr<ImageWriter>(new PNGWriter());
+
+    if (extension == "pfm")
+        return std::unique_ptr<ImageWriter>(new PFMWriter());
+
+    return std::unique_ptr<ImageWriter>(new PPMWriter());
+}
 
-    if (std::isnan(color.r()) || std::isnan(color.g()) || std::isnan(color.b()))
-        write_color = Color(0.0f, 0.0f, 0.0f);
 
-    output_file << write_color << "\n";
+/**
+ * Write the framebuffer into the given file, in the format of its
+ * extension. The image is written to a temporary file first and then
+ * moved over the previous image, so that the file is always a complete
+ * image, also when the process is killed while writing it.
+ *
+ * @param filename Output image filename.
+ * @param framebuffer Framebuffer holding the rendered pixels.
+ */
+void write_image(const std::string &filename, const Framebuffer &framebuffer)
+{
+    auto temporary = filename + ".tmp";
 
-    ++line_counter;
+    if (!make_image_writer(filename)->write(temporary, framebuffer))
+    {
+        std::remove(temporary.c_str());
+        std::cerr << "Cannot write the image " << filename << "." << std::endl;
+    }
+    else if (!replace_file(temporary, filename))
+    {
+        std::cerr << "Cannot write the image " << filename << "." << std::endl;
+    }
 }
 
+
+#endif //RAYTRACING_IMAGE_H
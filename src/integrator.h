@@ -0,0 +1,421 @@
+/**
+ * Integrators.
+ *
+ * An integrator estimates the radiance arriving along a camera ray.
+ * The path tracer follows the ray through the scene in a loop, carrying
+ * the product of the attenuations met so far (the throughput), instead
+ * of recursing once per bounce.
+ *
+ * The next event estimation integrator also samples a light at every
+ * diffuse (or broadly glossy) bounce and traces a shadow ray to it,
+ * instead of waiting for the path to hit a light by chance.
+ *
+ * The MIS integrator counts both the light samples and the lights hit
+ * by the scattered rays, weighting each with the power heuristic: the
+ * light samples dominate for small lights, the scattered rays for big
+ * lights seen from glossy surfaces.
+ *
+ * Every bounce starts at a fixed dimension of the sample point, so that
+ * with the low discrepancy samplers the same decisions of every path
+ * (light choice, BSDF direction, ...) use the same dimensions.
+ */
+
+#ifndef RAYTRACING_INTEGRATOR_H
+#define RAYTRACING_INTEGRATOR_H
+
+
+#include <algorithm>
+#include <limits>
+
+#include "color.h"
+#include "hitable.h"
+#include "material.h"
+#include "bvhnode.h"
+#include "lightsampler.h"
+#include "random.h"
+
+
+class Integrator
+{
+
+public:
+    virtual ~Integrator() = default;
+
+    /**
+     * Estimate the radiance arriving along the ray.
+     *
+     * @param r The ray from the camera through the pixel.
+     * @param world The scene.
+     *
+     * @return The radiance estimate.
+     */
+    virtual Color li(const Ray &r, const Hitable &world) const = 0;
+
+};
+
+
+/**
+ * Dimensions of the sample point used by the camera (pixel, lens and time),
+ * and reserved for each bounce (light choice, light point, BSDF, roulette).
+ */
+constexpr int camera_dimensions = 5;
+constexpr int bounce_dimensions = 8;
+
+
+/**
+ * Move the sampler to the first dimension of the given bounce.
+ *
+ * @param depth Index of the bounce.
+ */
+inline void start_bounce(int depth)
+{
+    random_skip_to(camera_dimensions + depth * bounce_dimensions);
+}
+
+
+/**
+ * Russian roulette: dim paths are terminated with a high probability, and
+ * the survivors are weighted up to keep the estimate unbiased.
+ *
+ * @param throughput Throughput of the path, reweighted if it survives.
+ *
+ * @return True if the path is terminated.
+ */
+inline bool russian_roulette(Color &throughput)
+{
+    auto survival = std::min(std::max(throughput.r(), std::max(throughput.g(), throughput.b())), 0.95f);
+
+    if (random_float() >= survival)
+        return true;
+
+    throughput = throughput * (1.0f / survival);
+
+    return false;
+}
+
+
+/**
+ * Power heuristic (with exponent 2) weight of a sampling technique.
+ *
+ * @param pdf Density of the technique that generated the sample.
+ * @param other_pdf Density of the other technique for the same sample.
+ *
+ * @return The weight of the sample.
+ */
+inline float power_heuristic(float pdf, float other_pdf)
+{
+    auto a = pdf * pdf;
+    auto b = other_pdf * other_pdf;
+
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+
+/**
+ * Sample a light from the shading point and trace the shadow ray.
+ *
+ * @param lights The lights of the scene.
+ * @param r The ray arriving at the shading point.
+ * @param rec The shading point.
+ * @param world The scene, for the shadow ray.
+ * @param direction Output, the sampled direction, normalized.
+ * @param pdf Output, the density of the direction, including the choice of the light.
+ *
+ * @return Light arriving from the sample times the BSDF and the cosine, divided by the pdf.
+ *         Black when the light is occluded.
+ */
+Color sample_light(const LightSampler &lights, const Ray &r, const HitRecord &rec, const Hitable &world,
+                   Vec3 &direction, float &pdf)
+{
+    auto black = Color(0.0f, 0.0f, 0.0f);
+    pdf = 0.0f;
+
+    float pmf;
+    auto index = lights.sample(rec.p, rec.normal, random_float(), pmf);
+
+    if (index < 0)
+        return black;
+
+    const auto &light = lights.light(index);
+
+    auto to_light = light.shape->random(rec.p);
+    auto shadow = Ray(rec.p, to_light, r.time());
+
+    HitRecord light_rec;
+    if (!light.shape->hit(shadow, 0.001f, std::numeric_limits<float>::max(), light_rec))
+        return black;
+
+    finalize_hit(shadow, light_rec);
+
+    pdf = pmf * light.shape->pdf_value(rec.p, to_light);
+    if (pdf <= 0.0f)
+        return black;
+
+    direction = unit_vector(to_light);
+
+    auto f = rec.mat_ptr->eval(r, rec, direction);
+    if (f.r() <= 0.0f && f.g() <= 0.0f && f.b() <= 0.0f)
+        return black;
+
+    ++traversal_stats.shadow_rays;
+    auto node_visits = traversal_stats.node_visits;
+
+    auto blocked = world.occluded(shadow, 0.001f, light_rec.t * (1.0f - 1e-4f));
+
+    traversal_stats.shadow_node_visits += traversal_stats.node_visits - node_visits;
+    traversal_stats.node_visits = node_visits;
+
+    if (blocked)
+        return black;
+
+    return f * light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p) * (1.0f / pdf);
+}
+
+
+class PathIntegrator : public Integrator
+{
+
+private:
+    int max_depth;
+    int rr_depth;
+
+public:
+    /**
+     * Depth limits constructor.
+     *
+     * @param max_depth Maximum amount of bounces of a path.
+     * @param rr_depth Amount of bounces after which the paths can be terminated
+     *                 with Russian roulette.
+     */
+    explicit PathIntegrator(int max_depth = 20, int rr_depth = 3) : max_depth{max_depth}, rr_depth{rr_depth} {}
+
+    Color li(const Ray &r, const Hitable &world) const override;
+
+};
+
+
+Color PathIntegrator::li(const Ray &r, const Hitable &world) const
+{
+    auto radiance = Color(0.0f, 0.0f, 0.0f);
+    auto throughput = Color(1.0f, 1.0f, 1.0f);
+    auto ray = r;
+
+    HitRecord rec;
+
+    for (auto depth=0; ; ++depth)
+    {
+        start_bounce(depth);
+        ++traversal_stats.rays;
+
+        if (!world.hit(ray, 0.001f, std::numeric_limits<float>::max(), rec))
+            break;
+
+        finalize_hit(ray, rec);
+
+        radiance += throughput * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+        Ray scattered;
+        Color attenuation;
+
+        if (depth >= max_depth || !rec.mat_ptr->scatter(ray, rec, attenuation, scattered))
+            break;
+
+        throughput = throughput * attenuation;
+
+        if (depth >= rr_depth && russian_roulette(throughput))
+            break;
+
+        ray = scattered;
+    }
+
+    return radiance;
+}
+
+
+class NEEIntegrator : public Integrator
+{
+
+private:
+    const LightSampler *lights;
+    int max_depth;
+    int rr_depth;
+
+public:
+    /**
+     * Lights and depth limits constructor.
+     *
+     * @param lights The lights of the scene.
+     * @param max_depth Maximum amount of bounces of a path.
+     * @param rr_depth Amount of bounces after which the paths can be terminated
+     *                 with Russian roulette.
+     */
+    NEEIntegrator(const LightSampler *lights, int max_depth = 20, int rr_depth = 3)
+        : lights{lights}, max_depth{max_depth}, rr_depth{rr_depth} {}
+
+    Color li(const Ray &r, const Hitable &world) const override;
+
+};
+
+
+Color NEEIntegrator::li(const Ray &r, const Hitable &world) const
+{
+    auto radiance = Color(0.0f, 0.0f, 0.0f);
+    auto throughput = Color(1.0f, 1.0f, 1.0f);
+    auto ray = r;
+    auto specular_bounce = true;
+
+    HitRecord rec;
+
+    for (auto depth=0; ; ++depth)
+    {
+        start_bounce(depth);
+        ++traversal_stats.rays;
+
+        if (!world.hit(ray, 0.001f, std::numeric_limits<float>::max(), rec))
+            break;
+
+        finalize_hit(ray, rec);
+
+        // The lights hit after a bounce that sampled them are already counted.
+        if (specular_bounce || lights->find(rec) < 0)
+            radiance += throughput * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+
+        if (depth >= max_depth)
+            break;
+
+        if (rec.mat_ptr->prefers_light_samples())
+        {
+            Vec3 light_direction;
+            float light_pdf;
+
+            radiance += throughput * sample_light(*lights, ray, rec, world, light_direction, light_pdf);
+        }
+
+        Ray scattered;
+        Color attenuation;
+
+        if (!rec.mat_ptr->scatter(ray, rec, attenuation, scattered))
+            break;
+
+        specular_bounce = !rec.mat_ptr->prefers_light_samples();
+        throughput = throughput * attenuation;
+
+        if (depth >= rr_depth && russian_roulette(throughput))
+            break;
+
+        ray = scattered;
+    }
+
+    return radiance;
+}
+
+
+class MISIntegrator : public Integrator
+{
+
+private:
+    const LightSampler *lights;
+    int max_depth;
+    int rr_depth;
+
+public:
+    /**
+     * Lights and depth limits constructor.
+     *
+     * @param lights The lights of the scene.
+     * @param max_depth Maximum amount of bounces of a path.
+     * @param rr_depth Amount of bounces after which the paths can be terminated
+     *                 with Russian roulette.
+     */
+    MISIntegrator(const LightSampler *lights, int max_depth = 20, int rr_depth = 3)
+        : lights{lights}, max_depth{max_depth}, rr_depth{rr_depth} {}
+
+    Color li(const Ray &r, const Hitable &world) const override;
+
+};
+
+
+Color MISIntegrator::li(const Ray &r, const Hitable &world) const
+{
+    auto radiance = Color(0.0f, 0.0f, 0.0f);
+    auto throughput = Color(1.0f, 1.0f, 1.0f);
+    auto ray = r;
+    auto specular_bounce = true;
+
+    // Density of the last scattered direction, and the point it was sampled from.
+    auto scatter_pdf = 0.0f;
+    auto scatter_origin = Vec3();
+    auto scatter_normal = Vec3();
+
+    HitRecord rec;
+
+    for (auto depth=0; ; ++depth)
+    {
+        start_bounce(depth);
+        ++traversal_stats.rays;
+
+        if (!world.hit(ray, 0.001f, std::numeric_limits<float>::max(), rec))
+            break;
+
+        finalize_hit(ray, rec);
+
+        auto emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        auto light = specular_bounce ? -1 : lights->find(rec);
+
+        if (light < 0)
+        {
+            radiance += throughput * emitted;
+        }
+        else
+        {
+            auto light_pdf = lights->pmf(scatter_origin, scatter_normal, light)
+                           * lights->light(light).shape->pdf_value(scatter_origin, ray.direction());
+
+            radiance += throughput * emitted * power_heuristic(scatter_pdf, light_pdf);
+        }
+
+        if (depth >= max_depth)
+            break;
+
+        if (!rec.mat_ptr->is_specular())
+        {
+            Vec3 light_direction;
+            float light_pdf;
+
+            auto contribution = sample_light(*lights, ray, rec, world, light_direction, light_pdf);
+
+            if (light_pdf > 0.0f)
+            {
+                auto bsdf_pdf = rec.mat_ptr->pdf(ray, rec, light_direction);
+                radiance += throughput * contribution * power_heuristic(light_pdf, bsdf_pdf);
+            }
+        }
+
+        Ray scattered;
+        Color attenuation;
+
+        if (!rec.mat_ptr->scatter(ray, rec, attenuation, scattered))
+            break;
+
+        specular_bounce = rec.mat_ptr->is_specular();
+
+        if (!specular_bounce)
+        {
+            scatter_pdf = rec.mat_ptr->pdf(ray, rec, unit_vector(scattered.direction()));
+            scatter_origin = rec.p;
+            scatter_normal = rec.normal;
+        }
+
+        throughput = throughput * attenuation;
+
+        if (depth >= rr_depth && russian_roulette(throughput))
+            break;
+
+        ray = scattered;
+    }
+
+    return radiance;
+}
+
+
+#endif //RAYTRACING_INTEGRATOR_H
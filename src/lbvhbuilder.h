@@ -0,0 +1,339 @@
+/**
+ * Linear BVH builder.
+ *
+ * The centroids of the primitives are quantized on a grid and sorted
+ * along a Morton (Z-order) curve, with a parallel radix sort. Nearby
+ * primitives end up next to each other, and the hierarchy is emitted by
+ * splitting every range where the highest bit of the codes changes.
+ *
+ * The build is close to linear in the amount of primitives and much
+ * faster than the SAH build, at the cost of a lower quality tree: it is
+ * meant for scenes rebuilt at every frame.
+ */
+
+#ifndef RAYTRACING_LBVHBUILDER_H
+#define RAYTRACING_LBVHBUILDER_H
+
+
+#include <cstdint>
+#include <vector>
+
+#include "bvhbuilder.h"
+
+
+/**
+ * Spread the lowest 10 bits of v, inserting two zeros between every bit.
+ *
+ * @param v The value to spread.
+ *
+ * @return The spread bits.
+ */
+inline std::uint32_t expand_bits_10(std::uint32_t v)
+{
+    v &= 0x3ffu;
+    v = (v | (v << 16)) & 0x030000ffu;
+    v = (v | (v << 8)) & 0x0300f00fu;
+    v = (v | (v << 4)) & 0x030c30c3u;
+    v = (v | (v << 2)) & 0x09249249u;
+
+    return v;
+}
+
+
+/**
+ * Spread the lowest 21 bits of v, inserting two zeros between every bit.
+ *
+ * @param v The value to spread.
+ *
+ * @return The spread bits.
+ */
+inline std::uint64_t expand_bits_21(std::uint64_t v)
+{
+    v &= 0x1fffffull;
+    v = (v | (v << 32)) & 0x001f00000000ffffull;
+    v = (v | (v << 16)) & 0x001f0000ff0000ffull;
+    v = (v | (v << 8)) & 0x100f00f00f00f00full;
+    v = (v | (v << 4)) & 0x10c30c30c30c30c3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+
+    return v;
+}
+
+
+/**
+ * 30 bit Morton code of a point quantized on a 1024^3 grid.
+ * The x bit is the highest of every group of three.
+ *
+ * @return The interleaved bits of x, y and z.
+ */
+inline std::uint32_t morton_code_30(std::uint32_t x, std::uint32_t y, std::uint32_t z)
+{
+    return (expand_bits_10(x) << 2) | (expand_bits_10(y) << 1) | expand_bits_10(z);
+}
+
+
+/**
+ * 63 bit Morton code of a point quantized on a 2097152^3 grid.
+ * The x bit is the highest of every group of three.
+ *
+ * @return The interleaved bits of x, y and z.
+ */
+inline std::uint64_t morton_code_63(std::uint64_t x, std::uint64_t y, std::uint64_t z)
+{
+    return (expand_bits_21(x) << 2) | (expand_bits_21(y) << 1) | expand_bits_21(z);
+}
+
+
+class LBVHBuilder : public BVHBuilder
+{
+
+private:
+    struct MortonPrimitive
+    {
+        std::uint64_t code;
+        std::uint32_t index;
+    };
+
+    std::vector<MortonPrimitive> morton;
+
+    void compute_codes();
+    void radix_sort();
+    int emit(std::size_t first, std::size_t count);
+
+public:
+    /**
+     * Store the objects to build the tree for.
+     *
+     * @param l List of objects.
+     * @param n Amount of objects.
+     * @param time0 Start of the time interval of the bounding boxes.
+     * @param time1 End of the time interval of the bounding boxes.
+     * @param options Build parameters, the SAH costs are ignored.
+     */
+    LBVHBuilder(Hitable **l, std::size_t n, float time0, float time1, const BVHBuildOptions &options = BVHBuildOptions())
+        : BVHBuilder(l, n, time0, time1, options) {}
+
+    /**
+     * Build the tree.
+     *
+     * The codes, the sort passes and the subtrees are computed in
+     * parallel when a scheduler is given.
+     *
+     * @param task_scheduler Scheduler running the build tasks, nullptr for a serial build.
+     *
+     * @return The index of the root node, -1 if there are no objects.
+     */
+    int build(TaskScheduler *task_scheduler = nullptr) override;
+
+};
+
+
+int LBVHBuilder::build(TaskScheduler *task_scheduler)
+{
+    prepare(task_scheduler);
+
+    if (objects_count == 0)
+        return -1;
+
+    compute_codes();
+    radix_sort();
+
+    // Reorder the primitives along the curve.
+    std::vector<BVHPrimitive> sorted(objects_count);
+
+    parallel_for(objects_count, options.parallel_threshold, [&](std::size_t first, std::size_t last)
+    {
+        for (auto i=first; i<last; ++i)
+            sorted[i] = primitives[morton[i].index];
+    });
+
+    primitives.swap(sorted);
+
+    auto root = emit(0, objects_count);
+
+    nodes.resize(nodes_used);
+    morton = std::vector<MortonPrimitive>();
+
+    return root;
+}
+
+
+void LBVHBuilder::compute_codes()
+{
+    auto chunk = options.parallel_threshold;
+    auto chunks = (objects_count + chunk - 1) / chunk;
+
+    // Bounds of the centroids, reduced per chunk.
+    std::vector<AABB> chunk_bounds(chunks, AABB::empty());
+
+    parallel_for(objects_count, chunk, [&](std::size_t first, std::size_t last)
+    {
+        auto bounds = AABB::empty();
+
+        for (auto i=first; i<last; ++i)
+            bounds = surrounding_box(bounds, AABB(primitives[i].centroid, primitives[i].centroid));
+
+        chunk_bounds[first / chunk] = bounds;
+    });
+
+    auto centroid_box = AABB::empty();
+    for (const auto &b : chunk_bounds)
+        centroid_box = surrounding_box(centroid_box, b);
+
+    auto wide = options.morton_bits > 30;
+    auto grid = wide ? float(1u << 21) : float(1u << 10);
+    auto grid_max = wide ? (1u << 21) - 1u : (1u << 10) - 1u;
+
+    auto extent = centroid_box.max() - centroid_box.min();
+    float scale[3];
+
+    for (auto a=0; a<3; ++a)
+        scale[a] = extent[a] > 0.0f ? grid / extent[a] : 0.0f;
+
+    morton.resize(objects_count);
+
+    parallel_for(objects_count, chunk, [&](std::size_t first, std::size_t last)
+    {
+        for (auto i=first; i<last; ++i)
+        {
+            std::uint32_t q[3];
+
+            for (auto a=0; a<3; ++a)
+            {
+                auto offset = (primitives[i].centroid[a] - centroid_box.min()[a]) * scale[a];
+
+                // Written to also reject NaN, before the conversion to an integer.
+                if (!(offset > 0.0f))
+                    q[a] = 0u;
+                else
+                    q[a] = offset < grid_max ? static_cast<std::uint32_t>(offset) : grid_max;
+            }
+
+            morton[i].code = wide ? morton_code_63(q[0], q[1], q[2]) : morton_code_30(q[0], q[1], q[2]);
+            morton[i].index = static_cast<std::uint32_t>(i);
+        }
+    });
+}
+
+
+void LBVHBuilder::radix_sort()
+{
+    constexpr int bits_per_pass = 8;
+    constexpr int buckets = 1 << bits_per_pass;
+
+    auto code_bits = options.morton_bits > 30 ? 63 : 30;
+    auto passes = (code_bits + bits_per_pass - 1) / bits_per_pass;
+
+    auto chunk = options.parallel_threshold;
+    auto chunks = (objects_count + chunk - 1) / chunk;
+
+    std::vector<MortonPrimitive> temp(objects_count);
+    std::vector<std::size_t> offsets(chunks * buckets);
+
+    for (auto pass=0; pass<passes; ++pass)
+    {
+        auto shift = pass * bits_per_pass;
+
+        // Histogram of the digits of every chunk.
+        parallel_for(objects_count, chunk, [&](std::size_t first, std::size_t last)
+        {
+            auto *count = &offsets[(first / chunk) * buckets];
+            std::fill(count, count + buckets, 0);
+
+            for (auto i=first; i<last; ++i)
+                ++count[(morton[i].code >> shift) & (buckets - 1)];
+        });
+
+        // Exclusive prefix sum, digit major and chunk minor, keeps the sort stable.
+        std::size_t offset = 0;
+
+        for (auto digit=0; digit<buckets; ++digit)
+            for (std::size_t c=0; c<chunks; ++c)
+            {
+                auto count = offsets[c * buckets + digit];
+                offsets[c * buckets + digit] = offset;
+                offset += count;
+            }
+
+        parallel_for(objects_count, chunk, [&](std::size_t first, std::size_t last)
+        {
+            auto *destination = &offsets[(first / chunk) * buckets];
+
+            for (auto i=first; i<last; ++i)
+                temp[destination[(morton[i].code >> shift) & (buckets - 1)]++] = morton[i];
+        });
+
+        morton.swap(temp);
+    }
+}
+
+
+int LBVHBuilder::emit(std::size_t first, std::size_t count)
+{
+    auto first_code = morton[first].code;
+    auto last_code = morton[first + count - 1].code;
+
+    if (count <= static_cast<std::size_t>(options.max_leaf_size))
+    {
+        auto box = primitives[first].box;
+
+        for (auto i=first+1; i<first+count; ++i)
+            box = surrounding_box(box, primitives[i].box);
+
+        return make_leaf(box, first, count);
+    }
+
+    std::size_t left_count;
+    auto axis = 0;
+
+    if (first_code == last_code)
+    {
+        // Same cell of the grid: split in two halves.
+        left_count = count / 2;
+    }
+    else
+    {
+        // The codes are sorted: find the first one with the highest differing bit set.
+        auto bit = 63;
+        while (!(((first_code ^ last_code) >> bit) & 1u))
+            --bit;
+
+        auto mask = std::uint64_t(1) << bit;
+        auto begin = morton.begin() + first;
+
+        auto split = std::partition_point(begin, begin + count, [mask](const MortonPrimitive &m)
+        {
+            return !(m.code & mask);
+        });
+
+        left_count = static_cast<std::size_t>(split - begin);
+        axis = 2 - bit % 3;
+    }
+
+    auto node_index = nodes_used++;
+
+    int left, right;
+
+    if (scheduler != nullptr && count > options.parallel_threshold)
+    {
+        TaskGroup group;
+        scheduler->submit(group, [&]() { left = emit(first, left_count); });
+        right = emit(first + left_count, count - left_count);
+        scheduler->wait(group);
+    }
+    else
+    {
+        left = emit(first, left_count);
+        right = emit(first + left_count, count - left_count);
+    }
+
+    nodes[node_index].box = surrounding_box(nodes[left].box, nodes[right].box);
+    nodes[node_index].children[0] = left;
+    nodes[node_index].children[1] = right;
+    nodes[node_index].split_axis = axis;
+
+    return node_index;
+}
+
+
+#endif //RAYTRACING_LBVHBUILDER_H
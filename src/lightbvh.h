@@ -0,0 +1,514 @@
+/**
+ * Light BVH.
+ *
+ * Hierarchy over the emitters of the scene, where every node bounds the
+ * position, the power and the directions of emission of its lights. The
+ * sampler walks down from the root picking a child in proportion to a
+ * conservative estimate of its contribution at the shading point, so the
+ * lights are chosen in logarithmic time and the close, bright lights
+ * facing the point are chosen more often.
+ *
+ * The bits of the path from the root to each light are stored, to compute
+ * the probability of picking a given light (needed by MIS) without a search.
+ *
+ * Based on "Importance Sampling of Many Lights with Adaptive Tree Splitting"
+ * from Conty Estevez and Kulla, as implemented in PBRT v4.
+ */
+
+#ifndef RAYTRACING_LIGHTBVH_H
+#define RAYTRACING_LIGHTBVH_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "aabb.h"
+#include "hitable.h"
+#include "lightsampler.h"
+
+
+inline float safe_sqrt(float x) { return std::sqrt(std::max(x, 0.0f)); }
+inline float safe_acos(float x) { return std::acos(std::min(std::max(x, -1.0f), 1.0f)); }
+
+
+/**
+ * Rotate a vector around an axis (Rodrigues' formula).
+ *
+ * @param v The vector to rotate.
+ * @param axis The rotation axis, normalized.
+ * @param angle The rotation angle, in radians.
+ *
+ * @return The rotated vector.
+ */
+inline Vec3 rotate(const Vec3 &v, const Vec3 &axis, float angle)
+{
+    auto c = std::cos(angle);
+    auto s = std::sin(angle);
+
+    return v * c + cross(axis, v) * s + axis * (dot(axis, v) * (1.0f - c));
+}
+
+
+/**
+ * Smallest light bounds containing both the given ones.
+ *
+ * @param a First bounds.
+ * @param b Second bounds.
+ *
+ * @return The union of the bounds.
+ */
+LightBounds light_bounds_union(const LightBounds &a, const LightBounds &b)
+{
+    if (a.power == 0.0f) return b;
+    if (b.power == 0.0f) return a;
+
+    LightBounds out;
+    out.bounds = surrounding_box(a.bounds, b.bounds);
+    out.power = a.power + b.power;
+    out.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+    out.two_sided = a.two_sided || b.two_sided;
+
+    // Union of the cones of the normals.
+    auto theta_a = safe_acos(a.cos_theta_o);
+    auto theta_b = safe_acos(b.cos_theta_o);
+    auto theta_d = safe_acos(dot(a.axis, b.axis));
+    auto pi = static_cast<float>(M_PI);
+
+    if (std::min(theta_d + theta_b, pi) <= theta_a)
+    {
+        out.axis = a.axis;
+        out.cos_theta_o = a.cos_theta_o;
+        return out;
+    }
+
+    if (std::min(theta_d + theta_a, pi) <= theta_b)
+    {
+        out.axis = b.axis;
+        out.cos_theta_o = b.cos_theta_o;
+        return out;
+    }
+
+    auto theta_o = 0.5f * (theta_a + theta_d + theta_b);
+    auto rotation_axis = cross(a.axis, b.axis);
+
+    if (theta_o >= pi || rotation_axis.squared_length() == 0.0f)
+    {
+        out.axis = a.axis;
+        out.cos_theta_o = -1.0f;
+        return out;
+    }
+
+    out.axis = unit_vector(rotate(a.axis, unit_vector(rotation_axis), theta_o - theta_a));
+    out.cos_theta_o = std::cos(theta_o);
+
+    return out;
+}
+
+
+/**
+ * Upper bound of the light arriving at a point from the given bounds.
+ *
+ * @param light The bounds of the lights.
+ * @param p The shading point.
+ * @param n Normal at the shading point, normalized, zero inside the media.
+ *
+ * @return The importance, 0 if the lights can't reach the point.
+ */
+float light_importance(const LightBounds &light, const Vec3 &p, const Vec3 &n)
+{
+    // cos(max(0, a - b)) and sin(max(0, a - b)), from the sines and cosines of a and b.
+    auto cos_sub_clamped = [](float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        return cos_a > cos_b ? 1.0f : cos_a * cos_b + sin_a * sin_b;
+    };
+    auto sin_sub_clamped = [](float sin_a, float cos_a, float sin_b, float cos_b)
+    {
+        return cos_a > cos_b ? 0.0f : sin_a * cos_b - cos_a * sin_b;
+    };
+
+    auto center = light.bounds.centroid();
+    auto diagonal = light.bounds.max() - light.bounds.min();
+
+    auto to_point = p - center;
+    auto length_squared = to_point.squared_length();
+
+    // Clamped to the size of the bounds, not to blow up for the points inside.
+    auto distance_squared = std::max(length_squared, 0.5f * diagonal.length());
+
+    if (length_squared > 0.0f)
+        to_point = to_point / std::sqrt(length_squared);
+
+    auto cos_theta_w = dot(light.axis, to_point);
+    if (light.two_sided)
+        cos_theta_w = std::fabs(cos_theta_w);
+
+    auto sin_theta_w = safe_sqrt(1.0f - cos_theta_w * cos_theta_w);
+
+    // Cone of the directions towards the bounds, seen from the point.
+    auto radius_squared = 0.25f * diagonal.squared_length();
+    auto cos_theta_b = -1.0f;
+
+    if (length_squared > radius_squared)
+        cos_theta_b = safe_sqrt(1.0f - radius_squared / length_squared);
+
+    auto sin_theta_b = safe_sqrt(1.0f - cos_theta_b * cos_theta_b);
+
+    // Smallest angle between the point and the emission cone: theta_w - theta_o - theta_b.
+    auto sin_theta_o = safe_sqrt(1.0f - light.cos_theta_o * light.cos_theta_o);
+    auto cos_theta_x = cos_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, light.cos_theta_o);
+    auto sin_theta_x = sin_sub_clamped(sin_theta_w, cos_theta_w, sin_theta_o, light.cos_theta_o);
+    auto cos_theta_p = cos_sub_clamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+
+    if (cos_theta_p <= light.cos_theta_e)
+        return 0.0f;
+
+    auto importance = light.power * cos_theta_p / distance_squared;
+
+    // Smallest angle between the normal at the point and the bounds.
+    if (n.squared_length() > 0.0f)
+    {
+        auto cos_theta_i = std::fabs(dot(to_point, n));
+        auto sin_theta_i = safe_sqrt(1.0f - cos_theta_i * cos_theta_i);
+
+        importance *= cos_sub_clamped(sin_theta_i, cos_theta_i, sin_theta_b, cos_theta_b);
+    }
+
+    return std::max(importance, 0.0f);
+}
+
+
+struct LightBVHNode
+{
+    LightBounds light;
+
+    /**
+     * Leaf: index of the light. Interior: offset of the second child, the first follows the node.
+     */
+    int offset;
+    bool leaf;
+};
+
+
+class BVHLightSampler : public LightSampler
+{
+
+private:
+    std::vector<LightBVHNode> nodes;
+
+    /**
+     * Path from the root to each light: the bit i is set if the second child is taken at depth i.
+     */
+    std::vector<std::uint64_t> trails;
+
+    /**
+     * Lights that can't report their bounds, sampled uniformly.
+     */
+    std::vector<int> unbounded;
+
+    int build(std::vector<std::pair<int, LightBounds>> &lights, std::size_t begin, std::size_t end,
+              std::uint64_t trail, int depth);
+
+    /**
+     * Probability of picking a light of the tree instead of one of the unbounded lights.
+     */
+    float tree_probability() const
+    {
+        if (nodes.empty()) return 0.0f;
+        return 1.0f / (1.0f + static_cast<float>(unbounded.size()));
+    }
+
+public:
+    /**
+     * Collect the emitters of the scene and build the hierarchy.
+     *
+     * @param scene The scene, before building the BVH.
+     * @param time0 Start of the time interval of the frame.
+     * @param time1 End of the time interval of the frame.
+     */
+    explicit BVHLightSampler(Hitable *scene, float time0 = 0.0f, float time1 = 1.0f);
+
+    int sample(const Vec3 &p, const Vec3 &n, float u, float &pmf) const override;
+    float pmf(const Vec3 &p, const Vec3 &n, int light) const override;
+
+    std::size_t nodes_count() const { return nodes.size(); }
+
+};
+
+
+BVHLightSampler::BVHLightSampler(Hitable *scene, float time0, float time1) : LightSampler(scene)
+{
+    std::vector<std::pair<int, LightBounds>> lights;
+    trails.assign(emitters.size(), 0);
+
+    for (std::size_t i=0; i<emitters.size(); ++i)
+    {
+        LightBounds light;
+
+        if (emitters[i].shape->light_bounds(time0, time1, light))
+        {
+            // The lights that emit nothing can't be picked.
+            if (light.power > 0.0f)
+                lights.emplace_back(static_cast<int>(i), light);
+        }
+        else
+        {
+            unbounded.push_back(static_cast<int>(i));
+        }
+    }
+
+    if (!lights.empty())
+    {
+        nodes.reserve(2 * lights.size() - 1);
+        build(lights, 0, lights.size(), 0, 0);
+    }
+}
+
+
+/*
+ * The lights are split with the surface area orientation heuristic: the
+ * cost of a child grows with its power, its surface area and the solid
+ * angle of its directions of emission.
+ */
+int BVHLightSampler::build(std::vector<std::pair<int, LightBounds>> &lights, std::size_t begin, std::size_t end,
+                           std::uint64_t trail, int depth)
+{
+    auto offset = static_cast<int>(nodes.size());
+
+    if (end - begin == 1)
+    {
+        nodes.push_back({lights[begin].second, lights[begin].first, true});
+        trails[lights[begin].first] = trail;
+
+        return offset;
+    }
+
+    auto bounds = AABB::empty();
+    auto centroids = AABB::empty();
+
+    for (auto i=begin; i<end; ++i)
+    {
+        auto c = lights[i].second.bounds.centroid();
+
+        bounds = surrounding_box(bounds, lights[i].second.bounds);
+        centroids = surrounding_box(centroids, AABB(c, c));
+    }
+
+    auto orientation_cost = [](const LightBounds &light)
+    {
+        auto theta_o = safe_acos(light.cos_theta_o);
+        auto theta_e = safe_acos(light.cos_theta_e);
+        auto theta_w = std::min(theta_o + theta_e, static_cast<float>(M_PI));
+        auto sin_theta_o = safe_sqrt(1.0f - light.cos_theta_o * light.cos_theta_o);
+
+        return static_cast<float>(2.0f * M_PI * (1.0f - light.cos_theta_o) + M_PI / 2.0f *
+               (2.0f * theta_w * sin_theta_o - std::cos(theta_o - 2.0f * theta_w) -
+                2.0f * theta_o * sin_theta_o + light.cos_theta_o));
+    };
+
+    constexpr auto buckets_count = 12;
+
+    auto diagonal = bounds.max() - bounds.min();
+    auto max_extent = std::max(diagonal.x(), std::max(diagonal.y(), diagonal.z()));
+
+    auto best_cost = FLT_MAX;
+    auto best_axis = -1;
+    auto best_bucket = -1;
+
+    for (auto axis=0; axis<3; ++axis)
+    {
+        auto extent = centroids.max()[axis] - centroids.min()[axis];
+
+        if (extent <= 0.0f)
+            continue;
+
+        LightBounds buckets[buckets_count];
+
+        auto bucket_of = [&](const LightBounds &light)
+        {
+            auto b = static_cast<int>(buckets_count * (light.bounds.centroid()[axis] - centroids.min()[axis]) / extent);
+            return std::min(std::max(b, 0), buckets_count - 1);
+        };
+
+        for (auto i=begin; i<end; ++i)
+        {
+            auto &bucket = buckets[bucket_of(lights[i].second)];
+            bucket = light_bounds_union(bucket, lights[i].second);
+        }
+
+        // Longer boxes are split along their longest axis.
+        auto regularization = diagonal[axis] > 0.0f ? max_extent / diagonal[axis] : 1.0f;
+
+        for (auto split=0; split<buckets_count-1; ++split)
+        {
+            LightBounds below, above;
+
+            for (auto b=0; b<=split; ++b)
+                below = light_bounds_union(below, buckets[b]);
+
+            for (auto b=split+1; b<buckets_count; ++b)
+                above = light_bounds_union(above, buckets[b]);
+
+            auto cost = 0.0f;
+
+            if (below.power > 0.0f)
+                cost += below.power * orientation_cost(below) * below.bounds.surface_area();
+
+            if (above.power > 0.0f)
+                cost += above.power * orientation_cost(above) * above.bounds.surface_area();
+
+            cost *= regularization;
+
+            if (cost > 0.0f && cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bucket = split;
+            }
+        }
+    }
+
+    auto mid = begin + (end - begin) / 2;
+
+    if (best_axis >= 0)
+    {
+        auto extent = centroids.max()[best_axis] - centroids.min()[best_axis];
+
+        auto it = std::partition(lights.begin() + begin, lights.begin() + end,
+                                 [&](const std::pair<int, LightBounds> &light)
+        {
+            auto b = static_cast<int>(buckets_count * (light.second.bounds.centroid()[best_axis] - centroids.min()[best_axis]) / extent);
+            return std::min(std::max(b, 0), buckets_count - 1) <= best_bucket;
+        });
+
+        auto split = static_cast<std::size_t>(it - lights.begin());
+
+        if (split != begin && split != end)
+            mid = split;
+    }
+
+    // The trail has one bit per level: the deep subtrees are split in half to stay under 64 levels.
+    if (depth >= 32)
+        mid = begin + (end - begin) / 2;
+
+    nodes.push_back({LightBounds(), 0, false});
+
+    build(lights, begin, mid, trail, depth + 1);
+    auto second = build(lights, mid, end, trail | (std::uint64_t(1) << depth), depth + 1);
+
+    nodes[offset].offset = second;
+    nodes[offset].light = light_bounds_union(nodes[offset + 1].light, nodes[second].light);
+
+    return offset;
+}
+
+
+int BVHLightSampler::sample(const Vec3 &p, const Vec3 &normal, float u, float &pmf) const
+{
+    auto p_tree = tree_probability();
+
+    if (u >= p_tree)
+    {
+        if (unbounded.empty())
+            return -1;
+
+        // Remap u to pick one of the unbounded lights.
+        auto count = static_cast<int>(unbounded.size());
+        auto i = std::min(static_cast<int>((u - p_tree) / (1.0f - p_tree) * count), count - 1);
+
+        pmf = (1.0f - p_tree) / count;
+
+        return unbounded[i];
+    }
+
+    u = std::min(u / p_tree, 0x1.fffffep-1f);
+    pmf = p_tree;
+
+    auto n = normal.squared_length() > 0.0f ? unit_vector(normal) : normal;
+
+    auto current = 0;
+
+    while (!nodes[current].leaf)
+    {
+        auto first = current + 1;
+        auto second = nodes[current].offset;
+
+        auto importance0 = light_importance(nodes[first].light, p, n);
+        auto importance1 = light_importance(nodes[second].light, p, n);
+
+        if (importance0 == 0.0f && importance1 == 0.0f)
+            return -1;
+
+        auto p0 = importance0 / (importance0 + importance1);
+
+        if (u < p0)
+        {
+            u = std::min(u / p0, 0x1.fffffep-1f);
+            pmf *= p0;
+            current = first;
+        }
+        else
+        {
+            u = std::min((u - p0) / (1.0f - p0), 0x1.fffffep-1f);
+            pmf *= 1.0f - p0;
+            current = second;
+        }
+    }
+
+    // A single light in the tree is never tested on the way down.
+    if (current == 0 && light_importance(nodes[0].light, p, n) == 0.0f)
+        return -1;
+
+    return nodes[current].offset;
+}
+
+
+float BVHLightSampler::pmf(const Vec3 &p, const Vec3 &normal, int light) const
+{
+    auto p_tree = tree_probability();
+
+    if (std::find(unbounded.begin(), unbounded.end(), light) != unbounded.end())
+        return (1.0f - p_tree) / static_cast<float>(unbounded.size());
+
+    if (nodes.empty())
+        return 0.0f;
+
+    auto n = normal.squared_length() > 0.0f ? unit_vector(normal) : normal;
+    auto trail = trails[light];
+    auto pmf = p_tree;
+    auto current = 0;
+
+    while (!nodes[current].leaf)
+    {
+        auto first = current + 1;
+        auto second = nodes[current].offset;
+
+        auto importance0 = light_importance(nodes[first].light, p, n);
+        auto importance1 = light_importance(nodes[second].light, p, n);
+
+        if (importance0 == 0.0f && importance1 == 0.0f)
+            return 0.0f;
+
+        if (trail & 1)
+        {
+            pmf *= importance1 / (importance0 + importance1);
+            current = second;
+        }
+        else
+        {
+            pmf *= importance0 / (importance0 + importance1);
+            current = first;
+        }
+
+        trail >>= 1;
+    }
+
+    if (current == 0 && light_importance(nodes[0].light, p, n) == 0.0f)
+        return 0.0f;
+
+    return nodes[current].offset == light ? pmf : 0.0f;
+}
+
+
+#endif //RAYTRACING_LIGHTBVH_H
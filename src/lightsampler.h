@@ -0,0 +1,148 @@
+/**
+ * Light samplers.
+ *
+ * A light sampler holds the emissive primitives of the scene, collected
+ * once at setup, and picks the one to sample from a shading point.
+ */
+
+#ifndef RAYTRACING_LIGHTSAMPLER_H
+#define RAYTRACING_LIGHTSAMPLER_H
+
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hitable.h"
+
+
+class LightSampler
+{
+
+protected:
+    /**
+     * Lights are identified by their primitive and the instance it was hit through.
+     */
+    using LightKey = std::pair<const Hitable*, const Hitable*>;
+
+    struct LightKeyHash
+    {
+        std::size_t operator()(const LightKey &key) const
+        {
+            return std::hash<const Hitable*>()(key.first) * 31u + std::hash<const Hitable*>()(key.second);
+        }
+    };
+
+    std::vector<Emitter> emitters;
+    std::unordered_map<LightKey, int, LightKeyHash> indices;
+
+public:
+    /**
+     * Collect the emitters of the scene.
+     *
+     * @param scene The scene, before building the BVH.
+     */
+    explicit LightSampler(Hitable *scene);
+
+    virtual ~LightSampler() = default;
+
+    /**
+     * Pick a light to sample from the given point.
+     *
+     * @param p The shading point.
+     * @param n Normal at the shading point, zero inside the media.
+     * @param u Uniform random number in [0, 1).
+     * @param pmf Output, probability of picking the returned light.
+     *
+     * @return Index of the light, -1 if no light can be picked.
+     */
+    virtual int sample(const Vec3 &p, const Vec3 &n, float u, float &pmf) const = 0;
+
+    /**
+     * Probability of picking the given light from the given point.
+     *
+     * @param p The shading point.
+     * @param n Normal at the shading point, zero inside the media.
+     * @param light Index of the light.
+     *
+     * @return The probability.
+     */
+    virtual float pmf(const Vec3 &p, const Vec3 &n, int light) const = 0;
+
+    /**
+     * Index of the light that was hit.
+     *
+     * @param rec The hit record, with the primitive and its instance.
+     *
+     * @return The index of the light, -1 if the instance of the primitive is not sampled as a light.
+     */
+    int find(const HitRecord &rec) const
+    {
+        auto it = indices.find({rec.object, rec.instance});
+        return it != indices.end() ? it->second : -1;
+    }
+
+    const Emitter& light(int index) const { return emitters[index]; }
+    std::size_t size() const { return emitters.size(); }
+
+};
+
+
+LightSampler::LightSampler(Hitable *scene)
+{
+    std::vector<Emitter> collected;
+    scene->collect_emitters(collected);
+
+    // An instance added twice to the scene is the same surface: a ray hits
+    // one of the copies only, so it is sampled once.
+    std::size_t duplicates = 0;
+
+    for (const auto &emitter : collected)
+    {
+        if (!indices.emplace(LightKey(emitter.primitive, emitter.instance), static_cast<int>(emitters.size())).second)
+        {
+            ++duplicates;
+            continue;
+        }
+
+        emitters.push_back(emitter);
+    }
+
+    if (duplicates > 0)
+        std::cerr << "Ignored " << duplicates << " lights added more than once to the scene." << std::endl;
+}
+
+
+/**
+ * Every light has the same probability.
+ */
+class UniformLightSampler : public LightSampler
+{
+
+public:
+    explicit UniformLightSampler(Hitable *scene) : LightSampler(scene) {}
+
+    int sample(const Vec3 &p, const Vec3 &n, float u, float &pmf) const override
+    {
+        if (emitters.empty())
+            return -1;
+
+        auto count = static_cast<int>(emitters.size());
+        pmf = 1.0f / count;
+
+        return std::min(static_cast<int>(u * count), count - 1);
+    }
+
+    float pmf(const Vec3 &p, const Vec3 &n, int light) const override
+    {
+        return emitters.empty() ? 0.0f : 1.0f / emitters.size();
+    }
+
+};
+
+
+#endif //RAYTRACING_LIGHTSAMPLER_H
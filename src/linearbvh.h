@@ -0,0 +1,470 @@
+/**
+ * Linear BVH.
+ *
+ * The build tree is flattened into a contiguous array of 32 byte nodes,
+ * in depth-first order: the first child of an interior node always
+ * follows its parent, and the node stores the offset of the second one.
+ * Leaves store a range of the primitives array.
+ *
+ * The traversal uses an explicit stack, visits the nearer child first
+ * and shrinks tmax as closer hits are found.
+ *
+ * For moving geometry the bounds can be refitted for a new time interval
+ * without rebuilding the tree, or stored at two time keys and
+ * interpolated at the time of every ray, instead of being swept over the
+ * whole shutter interval.
+ *
+ * The nodes hold no pointers, so a flattened tree can be saved and used
+ * in place from a memory-mapped file (see scenecache.h).
+ */
+
+#ifndef RAYTRACING_LINEARBVH_H
+#define RAYTRACING_LINEARBVH_H
+
+
+#include <cstdint>
+#include <vector>
+
+#include "hitable.h"
+#include "bvhnode.h"
+#include "bvhbuilder.h"
+#include "nodebuffer.h"
+
+
+struct alignas(32) LinearBVHNode
+{
+    float bounds_min[3];
+    float bounds_max[3];
+    union {
+        std::uint32_t primitives_offset;    // leaf
+        std::uint32_t second_child_offset;  // interior
+    };
+    std::uint16_t primitives_count;         // 0 for interior nodes
+    std::uint8_t axis;
+    std::uint8_t pad;
+
+    /**
+     * Slab test against the node bounds.
+     *
+     * @param origin Origin of the ray.
+     * @param inv_dir Inverse of the direction of the ray.
+     * @param tmin Minimum distance along the ray.
+     * @param tmax Maximum distance along the ray.
+     *
+     * @return True if the ray enters the box between tmin and tmax.
+     */
+    inline bool hit(const Vec3 &origin, const Vec3 &inv_dir, float tmin, float tmax) const;
+
+    /**
+     * Returns the bounds of the node.
+     *
+     * @return The bounds of the node.
+     */
+    AABB box() const
+    {
+        return AABB(
+            Vec3(bounds_min[0], bounds_min[1], bounds_min[2]),
+            Vec3(bounds_max[0], bounds_max[1], bounds_max[2])
+        );
+    }
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must be 32 bytes");
+
+
+/**
+ * Load 3 floats in a SSE register. The 4th lane reads the next value in
+ * memory and is cleared: it may be an integer that reads as a denormal,
+ * which makes every operation on the register very slow.
+ *
+ * @param p The floats to load.
+ *
+ * @return The register with the 3 floats and a 0.
+ */
+inline __m128 load_bounds3(const float *p)
+{
+    return _mm_and_ps(_mm_loadu_ps(p), _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+}
+
+
+/**
+ * Bounds of a node at the end time key, the node itself holds the
+ * bounds at the start time key. The 4th floats are padding, so the
+ * bounds can be loaded in SSE registers.
+ */
+struct alignas(32) LinearBVHMotionBounds
+{
+    float bounds_min[4];
+    float bounds_max[4];
+};
+
+
+inline bool LinearBVHNode::hit(const Vec3 &origin, const Vec3 &inv_dir, float tmin, float tmax) const
+{
+    auto t0 = _mm_mul_ps(_mm_sub_ps(load_bounds3(bounds_min), origin.v), inv_dir.v);
+    auto t1 = _mm_mul_ps(_mm_sub_ps(load_bounds3(bounds_max), origin.v), inv_dir.v);
+
+    float tnear[4], tfar[4];
+    _mm_storeu_ps(tnear, _mm_min_ps(t0, t1));
+    _mm_storeu_ps(tfar, _mm_max_ps(t0, t1));
+
+    // NaN (0 * inf) values are discarded by ffmin/ffmax when in first position.
+    tmin = ffmax(tnear[0], ffmax(tnear[1], ffmax(tnear[2], tmin)));
+    tmax = ffmin(tfar[0], ffmin(tfar[1], ffmin(tfar[2], tmax)));
+
+    return tmin <= tmax;
+}
+
+
+/**
+ * Slab test against the bounds of a node interpolated between two time keys.
+ *
+ * @param node The node, with the bounds at the start key.
+ * @param end The bounds of the node at the end key.
+ * @param f Position of the ray time between the keys, in [0, 1].
+ * @param origin Origin of the ray.
+ * @param inv_dir Inverse of the direction of the ray.
+ * @param tmin Minimum distance along the ray.
+ * @param tmax Maximum distance along the ray.
+ *
+ * @return True if the ray enters the interpolated box between tmin and tmax.
+ */
+inline bool hit_motion_bounds(const LinearBVHNode &node, const LinearBVHMotionBounds &end, float f,
+                              const Vec3 &origin, const Vec3 &inv_dir, float tmin, float tmax)
+{
+    auto weight = _mm_set1_ps(f);
+
+    auto bounds_min = load_bounds3(node.bounds_min);
+    auto bounds_max = load_bounds3(node.bounds_max);
+    bounds_min = _mm_add_ps(bounds_min, _mm_mul_ps(weight, _mm_sub_ps(_mm_load_ps(end.bounds_min), bounds_min)));
+    bounds_max = _mm_add_ps(bounds_max, _mm_mul_ps(weight, _mm_sub_ps(_mm_load_ps(end.bounds_max), bounds_max)));
+
+    auto t0 = _mm_mul_ps(_mm_sub_ps(bounds_min, origin.v), inv_dir.v);
+    auto t1 = _mm_mul_ps(_mm_sub_ps(bounds_max, origin.v), inv_dir.v);
+
+    float tnear[4], tfar[4];
+    _mm_storeu_ps(tnear, _mm_min_ps(t0, t1));
+    _mm_storeu_ps(tfar, _mm_max_ps(t0, t1));
+
+    tmin = ffmax(tnear[0], ffmax(tnear[1], ffmax(tnear[2], tmin)));
+    tmax = ffmin(tfar[0], ffmin(tfar[1], ffmin(tfar[2], tmax)));
+
+    return tmin <= tmax;
+}
+
+
+class LinearBVH : public Hitable
+{
+
+private:
+    NodeBuffer<LinearBVHNode> nodes;
+    std::vector<Hitable*> primitives;
+
+    std::vector<LinearBVHMotionBounds> motion_bounds;
+    float motion_time0 = 0.0f;
+    float motion_inv_duration = 0.0f;
+
+    std::uint32_t flatten(const std::vector<BVHBuildNode> &build_nodes, int index);
+    void refit_nodes(float time0, float time1);
+
+    /**
+     * Closest hit traversal, or any hit (occlusion) traversal without a record.
+     */
+    template <bool Motion, bool AnyHit>
+    bool traverse(const Ray &r, float tmin, float tmax, HitRecord *rec) const;
+
+public:
+    /**
+     * Flatten the given build tree.
+     *
+     * @param build_nodes Nodes of the build tree, the root is the first one.
+     * @param ordered Primitives, in the order referenced by the leaves.
+     */
+    LinearBVH(const std::vector<BVHBuildNode> &build_nodes, const std::vector<BVHPrimitive> &ordered);
+
+    /**
+     * Use already flattened nodes, such as the ones of a scene cache.
+     *
+     * @param nodes The nodes, the root is the first one.
+     * @param primitives Primitives, in the order referenced by the leaves.
+     */
+    LinearBVH(NodeBuffer<LinearBVHNode> nodes, std::vector<Hitable*> primitives)
+        : nodes{std::move(nodes)}, primitives{std::move(primitives)} {}
+
+    bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
+    bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    /**
+     * Recompute the bounds of all the nodes for a new time interval,
+     * keeping the topology of the tree. Cheaper than a rebuild, but the
+     * tree gets worse as the primitives move away from their positions
+     * at build time. Drops the time keys set by set_motion_keys.
+     *
+     * @param time0 Start of the time interval.
+     * @param time1 End of the time interval.
+     */
+    void refit(float time0, float time1);
+
+    /**
+     * Store the bounds of every node at two instants, and interpolate
+     * them at the time of each ray. Tighter than the bounds of the whole
+     * interval, and conservative for primitives moving linearly.
+     *
+     * @param time0 Time of the first key.
+     * @param time1 Time of the second key.
+     */
+    void set_motion_keys(float time0, float time1);
+
+    /**
+     * Returns true if the bounds are interpolated between two time keys.
+     *
+     * @return True when set_motion_keys has been called.
+     */
+    bool has_motion_keys() const { return !motion_bounds.empty(); }
+
+    /**
+     * Returns the amount of nodes.
+     *
+     * @return Amount of nodes.
+     */
+    std::size_t size() const { return nodes.size(); }
+
+    /**
+     * Returns the flattened nodes, the root is the first one.
+     *
+     * @return The nodes.
+     */
+    const NodeBuffer<LinearBVHNode>& flat_nodes() const { return nodes; }
+
+    /**
+     * Returns the primitives, in the order referenced by the leaves.
+     *
+     * @return The primitives.
+     */
+    const std::vector<Hitable*>& flat_primitives() const { return primitives; }
+
+};
+
+
+LinearBVH::LinearBVH(const std::vector<BVHBuildNode> &build_nodes, const std::vector<BVHPrimitive> &ordered)
+{
+    primitives.reserve(ordered.size());
+    for (const auto &p : ordered)
+        primitives.push_back(p.object);
+
+    if (build_nodes.empty())
+        return;
+
+    nodes.reserve(build_nodes.size());
+    flatten(build_nodes, 0);
+}
+
+
+std::uint32_t LinearBVH::flatten(const std::vector<BVHBuildNode> &build_nodes, int index)
+{
+    const auto &build_node = build_nodes[index];
+    auto offset = static_cast<std::uint32_t>(nodes.size());
+
+    nodes.emplace_back();
+
+    for (auto a=0; a<3; ++a)
+    {
+        nodes[offset].bounds_min[a] = build_node.box.min()[a];
+        nodes[offset].bounds_max[a] = build_node.box.max()[a];
+    }
+    nodes[offset].axis = static_cast<std::uint8_t>(build_node.split_axis);
+    nodes[offset].pad = 0;
+
+    if (build_node.leaf())
+    {
+        nodes[offset].primitives_offset = static_cast<std::uint32_t>(build_node.first);
+        nodes[offset].primitives_count = static_cast<std::uint16_t>(build_node.count);
+    }
+    else
+    {
+        nodes[offset].primitives_count = 0;
+        flatten(build_nodes, build_node.children[0]);
+        nodes[offset].second_child_offset = flatten(build_nodes, build_node.children[1]);
+    }
+
+    return offset;
+}
+
+
+void LinearBVH::refit(float time0, float time1)
+{
+    motion_bounds.clear();
+
+    refit_nodes(time0, time1);
+}
+
+
+void LinearBVH::set_motion_keys(float time0, float time1)
+{
+    refit_nodes(time1, time1);
+
+    motion_bounds.resize(nodes.size());
+
+    for (std::size_t i=0; i<nodes.size(); ++i)
+    {
+        for (auto a=0; a<3; ++a)
+        {
+            motion_bounds[i].bounds_min[a] = nodes[i].bounds_min[a];
+            motion_bounds[i].bounds_max[a] = nodes[i].bounds_max[a];
+        }
+
+        motion_bounds[i].bounds_min[3] = motion_bounds[i].bounds_max[3] = 0.0f;
+    }
+
+    refit_nodes(time0, time0);
+
+    motion_time0 = time0;
+    motion_inv_duration = time1 > time0 ? 1.0f / (time1 - time0) : 0.0f;
+}
+
+
+void LinearBVH::refit_nodes(float time0, float time1)
+{
+    nodes.make_owned();
+
+    // The children always follow their parent: walk backwards to visit them first.
+    for (auto i=nodes.size(); i-->0;)
+    {
+        auto &node = nodes[i];
+        auto box = AABB::empty();
+
+        if (node.primitives_count > 0)
+        {
+            for (std::uint32_t p=0; p<node.primitives_count; ++p)
+            {
+                AABB primitive_box;
+                if (primitives[node.primitives_offset + p]->bounding_box(time0, time1, primitive_box))
+                    box = surrounding_box(box, primitive_box);
+            }
+        }
+        else
+        {
+            box = surrounding_box(nodes[i + 1].box(), nodes[node.second_child_offset].box());
+        }
+
+        for (auto a=0; a<3; ++a)
+        {
+            node.bounds_min[a] = box.min()[a];
+            node.bounds_max[a] = box.max()[a];
+        }
+    }
+}
+
+
+bool LinearBVH::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
+{
+    if (nodes.empty())
+        return false;
+
+    return motion_bounds.empty() ? traverse<false, false>(r, tmin, tmax, &rec) : traverse<true, false>(r, tmin, tmax, &rec);
+}
+
+
+bool LinearBVH::occluded(const Ray &r, float tmin, float tmax) const
+{
+    if (nodes.empty())
+        return false;
+
+    return motion_bounds.empty() ? traverse<false, true>(r, tmin, tmax, nullptr) : traverse<true, true>(r, tmin, tmax, nullptr);
+}
+
+
+template <bool Motion, bool AnyHit>
+bool LinearBVH::traverse(const Ray &r, float tmin, float tmax, HitRecord *rec) const
+{
+    auto origin = r.origin();
+    auto inv_dir = Vec3(_mm_div_ps(_mm_set1_ps(1.0f), r.direction().v));
+    int dir_is_neg[3] = {inv_dir.x() < 0.0f, inv_dir.y() < 0.0f, inv_dir.z() < 0.0f};
+
+    auto hit_anything = false;
+    auto closest_so_far = tmax;
+
+    // Deep enough for the trees produced with BVHBuildOptions::max_sah_depth.
+    std::uint32_t stack[128];
+    auto stack_size = 0;
+    std::uint32_t current = 0;
+
+    auto f = Motion ? ffmin(ffmax((r.time() - motion_time0) * motion_inv_duration, 0.0f), 1.0f) : 0.0f;
+    const auto *node_data = nodes.data();
+
+    while (true)
+    {
+        const auto &node = node_data[current];
+        ++traversal_stats.node_visits;
+
+        auto node_hit = Motion ? hit_motion_bounds(node, motion_bounds[current], f, origin, inv_dir, tmin, closest_so_far)
+                               : node.hit(origin, inv_dir, tmin, closest_so_far);
+
+        if (node_hit)
+        {
+            if (node.primitives_count > 0)
+            {
+                for (std::uint32_t i=0; i<node.primitives_count; ++i)
+                {
+                    const auto *primitive = primitives[node.primitives_offset + i];
+
+                    if (AnyHit)
+                    {
+                        if (primitive->occluded(r, tmin, closest_so_far))
+                            return true;
+                    }
+                    else if (primitive->hit(r, tmin, closest_so_far, *rec))
+                    {
+                        hit_anything = true;
+                        closest_so_far = rec->t;
+                    }
+                }
+
+                if (stack_size == 0) break;
+                current = stack[--stack_size];
+            }
+            else if (dir_is_neg[node.axis])
+            {
+                // The second child is the nearer one.
+                stack[stack_size++] = current + 1;
+                current = node.second_child_offset;
+            }
+            else
+            {
+                stack[stack_size++] = node.second_child_offset;
+                current = current + 1;
+            }
+        }
+        else
+        {
+            if (stack_size == 0) break;
+            current = stack[--stack_size];
+        }
+    }
+
+    return hit_anything;
+}
+
+
+bool LinearBVH::bounding_box(float t0, float t1, AABB &box) const
+{
+    if (nodes.empty())
+        return false;
+
+    box = nodes[0].box();
+
+    if (!motion_bounds.empty())
+    {
+        const auto &end = motion_bounds[0];
+        box = surrounding_box(box, AABB(
+            Vec3(end.bounds_min[0], end.bounds_min[1], end.bounds_min[2]),
+            Vec3(end.bounds_max[0], end.bounds_max[1], end.bounds_max[2])
+        ));
+    }
+
+    return true;
+}
+
+
+#endif //RAYTRACING_LINEARBVH_H
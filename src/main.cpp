@@ -1,12 +1,20 @@
 #include <iostream>
 #include <iomanip>
 #include <limits>
-#include <random>
 #include <chrono>
+#include <csignal>
 #include <fstream>
 #include <string>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 #include "image.h"
+#include "framebuffer.h"
+#include "writerthread.h"
+#include "tile.h"
+#include "renderer.h"
+#include "scheduler.h"
 #include "vec3.h"
 #include "ray.h"
 #include "sphere.h"
@@ -19,274 +27,386 @@
 #include "texture.h"
 #include "box.h"
 #include "constantmedium.h"
+#include "trianglemesh.h"
 #include "simd.h"
+#include "bvhnode.h"
+#include "bvhbuilder.h"
+#include "lbvhbuilder.h"
+#include "bvhbenchmark.h"
+#include "linearbvh.h"
+#include "widebvh.h"
+#include "random.h"
+#include "integrator.h"
+#include "lightsampler.h"
+#include "lightbvh.h"
+#include "sampler.h"
+#include "accumulation.h"
+#include "checkpoint.h"
+#include "scene.h"
+#include "scenecache.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
 
-Color ray_color(const Ray &r, Hitable *world, int depth);
-Hitable* random_scene();
-Hitable* test_perlin();
-Hitable* simple_liht();
-Hitable* cornell_box();
 void lambertian_cornell_box(Hitable **scene, Camera **camera, float aspect);
-Hitable* light_spheres();
+Hitable* build_bvh(Hitable *scene, const std::string &method, int width, bool motion_keys,
+                   float time0, float time1, TaskScheduler *scheduler);
+std::uint64_t render_settings_hash(const Parameter &input_data);
+
+
+/**
+ * Set by SIGTERM (and SIGINT) while checkpointing: the tiles stop tracing
+ * and the render is saved to the checkpoint.
+ */
+std::atomic<bool> stop_requested{false};
+
+void request_stop(int)
+{
+    stop_requested = true;
+}
 
 
 int main(int argc, char *argv[])
 {
     auto input_data = parser(argc, argv);
 
-    Image image(input_data.output_path, input_data.width, input_data.height);
-
     auto samples = input_data.samples;
 
     Hitable *world;
     Camera *camera;
 
-    lambertian_cornell_box(
-            &world,
-            &camera,
-            static_cast<float>(image.width())/ static_cast<float>(image.height())
-    );
-
-	// RANDOM GENERATORS
-	std::random_device d;
-	std::mt19937 m{ d() };
-	auto max_rand_jitter = 1.0f - 1.0f / samples;
-	std::uniform_real_distribution<float> jitter(0.0f, max_rand_jitter);
+    // The scene generation (the tables of the noise textures) uses the random generator of the main thread.
+    rng.seed(input_data.seed);
 
-    auto increment = 1.0f / (image.width() * image.height() * samples);
-    auto progress = increment;
+    auto aspect = static_cast<float>(input_data.width) / static_cast<float>(input_data.height);
+    auto load_start_time = std::chrono::high_resolution_clock::now();
 
-    auto start_time = std::chrono::high_resolution_clock::now();
+    // A scene file is parsed into records and saved with its BVH into a cache,
+    // which the next runs map and use in place, as long as the file and the BVH
+    // settings are the same. Without a scene file, the Cornell box.
+    auto cache_path = input_data.scene_cache_path.empty() ? input_data.scene_path + ".cache" : input_data.scene_cache_path;
+    auto caching = !input_data.scene_path.empty() && cache_path != "0";
 
-    auto ipercent = 0;
-    auto iprevpercent = 0;
+    SceneCacheKey cache_key;
+    SceneCache cache;
+    std::vector<std::uint32_t> records;
+    auto cached = false;
 
-    // IMAGE PROCESSING
-    for (int idY=image.height() - 1; idY>=0; --idY)
+    if (!input_data.scene_path.empty())
     {
-        for (int idX=0; idX<image.width(); ++idX)
+        std::string text;
+
+        if (!read_file(input_data.scene_path, text))
         {
-            auto col = Color(0.0f, 0.0f, 0.0f);
+            std::cerr << "Cannot open the scene " << input_data.scene_path << "." << std::endl;
+            return 1;
+        }
 
-            for (int s=0; s<samples; ++s)
-            {
-                float u = (idX + jitter(m)) / static_cast<float>(image.width());
-                float v = (idY + jitter(m)) / static_cast<float>(image.height());
+        cache_key.source_hash = hash_bytes(text.data(), text.size());
+        cache_key.bvh_method = input_data.bvh;
+        cache_key.bvh_width = input_data.bvh_width;
+        cache_key.motion_keys = input_data.motion_keys;
 
-                auto r = camera->get_ray(u, v);
-                col += ray_color(r, world, 0);
+        cached = caching && cache.open(cache_path, cache_key);
 
-                progress += increment;
-            }
+        if (!cached && !parse_scene(input_data.scene_path, text, records))
+            return 1;
 
+        Scene scene;
 
-            ipercent = static_cast<int>(std::round(progress * 100.0f));
-            if (ipercent != iprevpercent)
-            {
-                for (int i=0; i<(ipercent-iprevpercent); ++i)
-                    std::cout << "=" << std::flush;
+        if (!(cached ? build_scene(input_data.scene_path, cache.records(), cache.records_count(), aspect, scene)
+                     : build_scene(input_data.scene_path, records.data(), records.size(), aspect, scene)))
+            return 1;
 
-                iprevpercent = ipercent;
-            }
+        world = scene.world;
+        camera = scene.camera;
+    }
+    else
+    {
+        lambertian_cornell_box(&world, &camera, aspect);
+    }
 
-            col /= static_cast<float>(samples);
+    auto load_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - load_start_time);
 
-            image.write(col.gamma());
-        }
+    TaskScheduler scheduler(static_cast<unsigned int>(std::max(input_data.threads, 0)));
+
+    if (input_data.benchmark)
+    {
+        bvh_benchmark(world, *camera, input_data.width, input_data.height, input_data.seed, 0.0f, 1.0f, &scheduler);
+        return 0;
     }
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-    auto duration_s = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
+    auto build_start_time = std::chrono::high_resolution_clock::now();
 
-    std::cout << std::cout.widen('\n');
-    std::cout << "Render time: " << duration_ms.count() << "ms" << std::cout.widen('\n');
-    std::cout << "Render time: " << duration_s.count() << "s" << std::cout.widen('\n');
+    // The lights are collected from the scene list, before it is replaced by the BVH.
+    std::unique_ptr<LightSampler> lights;
 
-    return 0;
-}
+    if (input_data.light_sampler == "uniform")
+    {
+        lights.reset(new UniformLightSampler(world));
+    }
+    else
+    {
+        if (input_data.light_sampler != "bvh")
+            std::cerr << "Unknown light sampler " << input_data.light_sampler << ", using bvh." << std::endl;
 
+        lights.reset(new BVHLightSampler(world, 0.0f, 1.0f));
+    }
 
-/**
- * @brief Recursive ray/hit function with a depth limit level
- *
- * @param r They ray to go through.
- *          The first ray will be the ray from the camera through the pixel.
- * @param world The hitable object to inspect with the ray.
- * @param depth The depth level (the number of bounces of the ray)
- *
- * @return Color The pixel color evaluated at the end of the recursion.
- */
-Color ray_color(const Ray &r, Hitable *world, int depth)
-{
-    HitRecord rec;
+    auto *scene_list = dynamic_cast<HitableList*>(world);
+    Hitable *bvh = cached && cache.has_bvh() ? cache.bvh(*scene_list) : nullptr;
 
-    if (world->hit(r, 0.001f, std::numeric_limits<float>::max(), rec))
+    if (bvh == nullptr)
     {
-        Ray scattered;
-        Color attenuation;
+        bvh = build_bvh(world, input_data.bvh, input_data.bvh_width, input_data.motion_keys, 0.0f, 1.0f, &scheduler);
 
-        Color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        // A cached BVH rejected for the primitives (an edited mesh) is saved again,
+        // once the records are copied out of the mapping and the cache is closed.
+        auto rewrite = caching && (!cached || cache.has_bvh());
 
-        if (depth < 20 && rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+        if (rewrite && cached)
         {
-            return emitted + attenuation * ray_color(scattered, world, depth + 1);
+            records.assign(cache.records(), cache.records() + cache.records_count());
+            cache.close();
         }
 
-        return emitted;
+        if (rewrite)
+            write_scene_cache(cache_path, cache_key, records, *scene_list, bvh);
     }
 
-    return Color(0.0f, 0.0f, 0.0f);
-}
+    world = bvh;
 
+    auto build_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - build_start_time);
 
-/**
- * @brief Random scene from the Shirley's book.
- *
- * @return Hitable* The generated scene as a HitableList object.
- */
-Hitable* random_scene()
-{
-    auto n = 500;
-    auto **list = new Hitable*[n+1];
-
-	int nx, ny, nn;
-	auto file_path = "sample_texture.jpg";
-	unsigned char *texture_data = stbi_load(file_path, &nx, &ny, &nn, 0);
-	Material *img_mat = new Lambertian(new ImageTexture(texture_data, nx, ny));
-
-    list[0] = new Sphere(
-            {0.0f, -1000.0f, 0.0f},
-            1000,
-            img_mat
-    );
+    std::unique_ptr<Integrator> integrator;
 
-    std::size_t i = 1;
+    if (input_data.integrator == "path")
+    {
+        integrator.reset(new PathIntegrator(input_data.max_depth, input_data.rr_depth));
+    }
+    else if (input_data.integrator == "mis")
+    {
+        integrator.reset(new MISIntegrator(lights.get(), input_data.max_depth, input_data.rr_depth));
+    }
+    else
+    {
+        if (input_data.integrator != "nee")
+            std::cerr << "Unknown integrator " << input_data.integrator << ", using nee." << std::endl;
 
-    for (auto a = -11; a < 11; ++a)
+        integrator.reset(new NEEIntegrator(lights.get(), input_data.max_depth, input_data.rr_depth));
+    }
+
+    if (!is_sampler_name(input_data.sampler))
+    {
+        std::cerr << "Unknown sampler " << input_data.sampler << ", using independent." << std::endl;
+        input_data.sampler = "independent";
+    }
+
+    // The images are encoded and written on their own thread, while the next pass renders.
+    ImageWriterThread writer(input_data.width, input_data.height);
+    AccumulationBuffer accumulation(input_data.width, input_data.height);
+    auto tiles = make_tiles(input_data.width, input_data.height, input_data.tile_width, input_data.tile_height);
+
+    auto total_pixels = input_data.width * input_data.height;
+    auto total_samples = static_cast<double>(total_pixels) * samples;
+    auto iprevpercent = 0;
+
+    auto print_progress = [&](int ipercent)
     {
-        for (auto b = -11; b < 11; ++b)
+        for (int i=0; i<(ipercent-iprevpercent); ++i)
+            std::cout << "=" << std::flush;
+
+        iprevpercent = std::max(ipercent, iprevpercent);
+    };
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    // With a noise threshold, the pixels get batches of min_samples samples
+    // until their error is below it, up to the samples count.
+    auto adaptive = input_data.noise_threshold > 0.0f;
+    // Checkpoints are written between the passes, so a render with checkpoints
+    // is split in batches too (the samples, and the image, are the same).
+    auto checkpointing = !input_data.checkpoint_path.empty() || !input_data.resume_path.empty();
+    auto checkpoint_path = input_data.checkpoint_path.empty() ? input_data.resume_path : input_data.checkpoint_path;
+
+    auto batch_samples = adaptive || checkpointing ? std::max(1, std::min(input_data.min_samples, samples)) : samples;
+
+    CheckpointHeader checkpoint;
+    checkpoint.width = input_data.width;
+    checkpoint.height = input_data.height;
+    checkpoint.samples = samples;
+    checkpoint.seed = input_data.seed;
+    checkpoint.sampler = input_data.sampler;
+    checkpoint.scene_hash = cache_key.source_hash ^ (scene_list != nullptr ? hash_primitive_bounds(*scene_list) : 0);
+    checkpoint.settings_hash = render_settings_hash(input_data);
+
+    auto first_sample = 0;
+    auto passes = 0;
+
+    if (!input_data.resume_path.empty() && std::ifstream(input_data.resume_path).good())
+    {
+        CheckpointHeader saved;
+
+        if (!read_checkpoint(input_data.resume_path, saved, accumulation) || !saved.matches(checkpoint))
         {
-            auto choose_mat = dist(m);
-            auto center = Vec3{a + 0.9f * dist(m), 0.2f, b + 0.9f * dist(m)};
-
-            if ((center - Vec3{4.0f, 0.2f, 0.0f}).length() > 0.9f)
-            {
-                if (choose_mat < 0.8f)
-                {
-                    list[i++] = new MovingSphere(
-                            center,
-                            center + Vec3(0.0f, 0.5f * dist(m), 0.0f),
-                            0.0f, // Time 0
-                            1.0f, // Time 1
-                            0.2f,
-                            new Lambertian(
-                                new ConstantTexture(Color(dist(m) * dist(m), dist(m) * dist(m), dist(m) * dist(m)))
-                            )
-                    );
-                }
-                else if (choose_mat < 0.95f)
-                {
-                    list[i++] = new Sphere(
-                            center,
-                            // center + Vec3(0.0f, 0.5f * dist(m), 0.0f),
-                            // 0.0f,
-                            // 0.1f,
-                            0.2f,
-                            new Metal(
-                                    {0.5f * (1 + dist(m)), 0.5f * (1 + dist(m)), 0.5f * (1 + dist(m))},
-                                    0.5f * dist(m)
-                            )
-                    );
-                }
-                else
-                {
-                    list[i++] = new Sphere(
-                            center,
-                            // center + Vec3(0.0f, 0.5f * dist(m), 0.0f),
-                            // 0.0f,
-                            // 0.1f,
-                            0.2f,
-                            new Dielectric(1.5f)
-                    );
-                }
-            }
+            std::cerr << "Cannot resume from " << input_data.resume_path
+                      << ": damaged, or written by a render of another scene or with other settings." << std::endl;
+            return 1;
         }
+
+        first_sample = saved.next_sample;
+        passes = saved.passes;
+
+        std::cout << "Resuming from " << input_data.resume_path << ", sample " << first_sample << std::endl;
     }
 
-    list[i++] = new Sphere({0.0f, 1.0f, 0.0f}, 1.0f, new Dielectric(1.5));
-    list[i++] = new Sphere({-4.0f, 1.0f, 0.0f}, 1.0f, new Lambertian(new ConstantTexture(Color(0.4f, 0.2f, 0.1f))));
-    list[i++] = new Sphere({4.0f, 1.0f, 0.0f}, 1.0f, new Metal({0.7f, 0.6f, 0.5f}, 0.0f));
+    if (checkpointing)
+    {
+        std::signal(SIGTERM, request_stop);
+        std::signal(SIGINT, request_stop);
+    }
 
-    return new HitableList(list, i);
-}
+    TileRenderer renderer(*world, *camera, *integrator, accumulation, input_data.sampler, samples, input_data.seed, scheduler.threads());
+    renderer.set_stop_flag(&stop_requested);
 
+    auto tile_progress = [&](std::uint64_t samples_count)
+    {
+        print_progress(static_cast<int>(std::round(100.0 * samples_count / total_samples)));
+    };
 
-Hitable* test_perlin()
-{
-    auto **list = new Hitable*[2];
+    // Resolve the samples so far into a framebuffer and queue it to be written.
+    auto write_snapshot = [&]()
+    {
+        auto framebuffer = writer.acquire();
+        accumulation.resolve(framebuffer);
+        writer.submit(input_data.output_path, std::move(framebuffer));
+    };
 
-    list[0] = new Sphere({0.0f, 20.0f, 0.0f}, 20.0f, new Lambertian{new NoiseTexture(1.0f)});
-    list[1] = new XY_Rect(3, 5, 1, 3, -2, new Lambertian(new ConstantTexture(Color(1.0f, 0.0f, 0.0f))));
+    // IMAGE PROCESSING
+    // The frame is rendered in passes: a single one by default, batches of
+    // min_samples with adaptive sampling or checkpoints, doubling sample counts
+    // (1, 2, 4...) when progressive, with a snapshot of the image after some of them.
+    auto snapshot_time = start_time;
+    auto checkpoint_time = start_time;
 
-    return new HitableList(list, 2);
-}
+    for (int first=first_sample; first<samples; )
+    {
+        auto last = input_data.progressive ? std::min(samples, std::max(1, 2 * first))
+                                           : std::min(samples, first + batch_samples);
 
+        renderer.render_pass(scheduler, tiles, first, last, tile_progress);
 
-Hitable* simple_light()
-{
-    Texture *noiseText = new NoiseTexture(4);
+        if (stop_requested)
+        {
+            // The pass is not complete: it restarts from the samples of every pixel.
+            checkpoint.next_sample = first;
+            checkpoint.passes = passes;
+            auto saved = write_checkpoint(checkpoint_path, checkpoint, accumulation);
+
+            write_snapshot();
+            writer.flush();
+
+            if (saved)
+                std::cout << std::cout.widen('\n') << "Interrupted, checkpoint written to " << checkpoint_path << std::endl;
+            else
+                std::cerr << std::endl << "Interrupted, cannot write the checkpoint " << checkpoint_path
+                          << ": the render is lost." << std::endl;
+            return 1;
+        }
 
-    Hitable **list = new Hitable*[4];
-    list[0] = new Sphere({0.0f, -1000.0f, 0.0f}, 1000.0f, new Lambertian(noiseText));
-    list[1] = new Sphere({0.0f, 2.0f, 0.0f}, 2.0f, new Lambertian(noiseText));
-    list[2] = new Sphere({0.0f, 7.0f, 0.0f}, 2.0f, new DiffuseLight(new ConstantTexture(Color(4.0f, 4.0f, 4.0f))));
-    list[3] = new XY_Rect(3, 5, 1, 3, -2, new DiffuseLight(new ConstantTexture(Color(4.0f, 4.0f, 4.0f))));
+        first = last;
+        ++passes;
 
-    return new HitableList(list, 4);
-}
+        if (adaptive && first >= batch_samples && accumulation.update_active(input_data.noise_threshold) == 0)
+            break;
 
+        if (first >= samples)
+            continue;
 
-Hitable* cornell_box()
-{
-    Hitable **list = new Hitable*[8];
-    std::size_t i = 0;
+        auto now = std::chrono::high_resolution_clock::now();
 
-    auto c_green = Color(0.0f, 1.0f, 0.0f);
-    auto c_white = Color(0.8f, 0.8f, 0.8f);
+        if (checkpointing && std::chrono::duration<double>(now - checkpoint_time).count() >= input_data.checkpoint_seconds)
+        {
+            checkpoint.next_sample = first;
+            checkpoint.passes = passes;
+            // The render goes on, the checkpoint is tried again at the next interval.
+            if (!write_checkpoint(checkpoint_path, checkpoint, accumulation))
+                std::cerr << std::endl << "Cannot write the checkpoint " << checkpoint_path << "." << std::endl;
 
-    int nx, ny, nn;
-    auto file_path = "sample_texture.jpg";
-    unsigned char *texture_data = stbi_load(file_path, &nx, &ny, &nn, 0);
-    Material *image = new Lambertian(new ImageTexture(texture_data, nx, ny));
-    Material *white = new Lambertian(new ConstantTexture(c_white));
-    Material *green = new Lambertian(new ConstantTexture(c_green));
+            checkpoint_time = now;
+        }
 
-    Material *light = new DiffuseLight(new ConstantTexture(Color{1.0f, .0f}));
+        auto snapshot_seconds = std::chrono::duration<double>(now - snapshot_time).count();
 
-    list[i++] = new FlipNormals(new YZ_Rect(0, 555, 0, 555, 555, green));
-    list[i++] = new YZ_Rect(0, 555, 0, 555, 0, image);
+        if (input_data.progressive &&
+            ((input_data.snapshot_passes > 0 && passes % input_data.snapshot_passes == 0) ||
+             (input_data.snapshot_seconds > 0 && snapshot_seconds >= input_data.snapshot_seconds)))
+        {
+            write_snapshot();
 
-    list[i++] = new XZ_Rect(50, 505, 50, 505, 554, light);
+            snapshot_time = now;
+        }
+    }
 
-    list[i++] = new FlipNormals(new XZ_Rect(0, 555, 0, 555, 555, white));
-    list[i++] = new XZ_Rect(0, 555, 0, 555, 0, white);
-    list[i++] = new FlipNormals(new XY_Rect(0, 555, 0, 555, 555, white));
+    print_progress(100);
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto render_stats = renderer.stats();
+    auto duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    auto duration_s = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
+
+    std::cout << std::cout.widen('\n');
+    std::cout << "Scene load time: " << load_duration_ms.count() << "ms" << (cached ? " (cache)" : "") << std::cout.widen('\n');
+    std::cout << "BVH build time: " << build_duration_ms.count() << "ms" << std::cout.widen('\n');
+    std::cout << "Render time: " << duration_ms.count() << "ms" << std::cout.widen('\n');
+    std::cout << "Render time: " << duration_s.count() << "s" << std::cout.widen('\n');
+    std::cout << "Integrator: " << input_data.integrator << ", lights: " << lights->size() << " (" << input_data.light_sampler << ")" << std::cout.widen('\n');
+    std::cout << "Samples per pixel: " << static_cast<double>(render_stats.samples) / std::max(total_pixels, 1);
+    if (adaptive)
+        std::cout << " (adaptive, " << batch_samples << " to " << samples << ", threshold " << input_data.noise_threshold << ")";
+    std::cout << ", passes: " << passes << std::cout.widen('\n');
+    std::cout << "Threads: " << scheduler.threads() << ", tiles: " << tiles.size() << std::cout.widen('\n');
+
+    auto stats = scheduler.stats();
+    std::cout << "Tasks: " << stats.tasks << ", steals: " << stats.steals
+              << ", failed steals: " << stats.failed_steals
+              << ", idle time: " << static_cast<int>(stats.idle_ms) << "ms" << std::cout.widen('\n');
+    std::cout << "BVH: " << input_data.bvh
+              << " (width " << (input_data.bvh_width > 0 ? std::to_string(input_data.bvh_width) : "auto") << ")"
+              << ", node visits per ray: "
+              << static_cast<double>(render_stats.node_visits) / std::max<std::uint64_t>(render_stats.rays, 1)
+              << ", per shadow ray: "
+              << static_cast<double>(render_stats.shadow_node_visits) / std::max<std::uint64_t>(render_stats.shadow_rays, 1) << std::cout.widen('\n');
+    std::cout << "Tasks per worker:";
+    for (auto count : stats.tasks_per_worker)
+        std::cout << " " << count;
+    std::cout << std::cout.widen('\n');
 
-    auto *b1 = new Translate(new Box(Vec3(0, 0, 0), Vec3(165, 330, 165), white), Vec3(265,0,295));
-    list[i++] = new ConstantMedium(b1, 0.01f, new ConstantTexture(Color(1.0f, 1.0f, 1.0f)));
+    write_snapshot();
+    writer.flush();
 
-    auto *b2 = new Translate(new Box(Vec3(0, 0, 0), Vec3(165, 165, 165), white), Vec3(130,0,65));
-    list[i++] = new ConstantMedium(b2, 0.01f, new ConstantTexture(Color(0.0f, 0.0f, 0.0f)));
+    auto writer_stats = writer.stats();
+    std::cout << "Images written: " << writer_stats.images
+              << ", write time: " << static_cast<int>(writer_stats.write_ms) << "ms"
+              << ", render blocked: " << static_cast<int>(writer_stats.blocked_ms) << "ms" << std::endl;
 
-    return new HitableList(list, i);
+    return 0;
 }
 
 
+/**
+ * @brief Built-in Cornell box, rendered without a scene file (the same as scenes/cornell_box.scene).
+ *
+ * @param scene The generated scene as a HitableList object.
+ * @param camera The camera looking into the box.
+ * @param aspect Aspect ratio of the camera.
+ */
 void lambertian_cornell_box(Hitable **scene, Camera **camera, float aspect)
 {
     Hitable **list = new Hitable*[8];
@@ -327,46 +447,92 @@ void lambertian_cornell_box(Hitable **scene, Camera **camera, float aspect)
 }
 
 
-Hitable* light_spheres()
+/**
+ * @brief Build the acceleration structure over the objects of the scene.
+ *
+ * @param scene The scene, as a HitableList object.
+ * @param method The BVH builder: "sah", "lbvh" or "median".
+ * @param width Amount of children per node: 2, 4 (SSE) or 8 (AVX2), 0 picks the widest supported by the CPU.
+ * @param motion_keys Interpolate the node bounds between time0 and time1, only with the binary BVH.
+ * @param time0 Start of the time interval of the bounding boxes.
+ * @param time1 End of the time interval of the bounding boxes.
+ * @param scheduler Scheduler running the build tasks.
+ *
+ * @return Hitable* The root of the BVH, or the scene itself when it is not a list.
+ */
+Hitable* build_bvh(Hitable *scene, const std::string &method, int width, bool motion_keys,
+                   float time0, float time1, TaskScheduler *scheduler)
 {
-    auto **list = new Hitable*[1000];
-    auto idx = std::size_t(0);
+    auto *list = dynamic_cast<HitableList*>(scene);
 
-    // Top light
-    list[idx++] = new XZ_Rect(-20, 20, -20, 20, 40, new DiffuseLight(new ConstantTexture(Color(0.02f))));
+    if (list == nullptr || list->size() == 0)
+        return scene;
 
-    // Lights
-    for (std::size_t i=0; i<10; ++i)
+    if (method == "median")
+        return new BVHNode(list->objects(), list->size(), time0, time1);
+
+    std::unique_ptr<BVHBuilder> builder;
+
+    if (method == "lbvh")
+    {
+        builder.reset(new LBVHBuilder(list->objects(), list->size(), time0, time1));
+    }
+    else
     {
-        auto light_color = Color(dist(m) * 10.0f + 20.0f, .0f);
-        auto light_material = new DiffuseLight(new ConstantTexture(light_color));
-        auto position = Vec3(
-                (dist(m) * 20.0f) - 5.0f,
-                dist(m) * 2.0f + 0.2f,
-                (dist(m) * 20.0f) - 5.0f
-        );
-        list[idx++] = new Sphere(position, 0.25f, light_material);
+        if (method != "sah")
+            std::cerr << "Unknown BVH method " << method << ", using sah." << std::endl;
+
+        builder.reset(new SAHBuilder(list->objects(), list->size(), time0, time1));
     }
 
-    // Plane
-    list[idx++] = new XZ_Rect(-100, 100, -100, 100, 0, new Lambertian(new ConstantTexture(Color(0.6f, 0.6f, 0.6f))));
+    builder->build(scheduler);
+
+    auto *binary = new LinearBVH(builder->build_nodes(), builder->ordered_primitives());
 
-    // Spheres
-    for(std::size_t i=0; i<200; ++i)
+    if (motion_keys)
     {
-        auto sphere_color = Color(
-                dist(m) * 0.7f + 0.2f,
-                dist(m) * 0.7f + 0.2f,
-                dist(m) * 0.7f + 0.2f
-        );
-        auto sphere_material = new Metal(sphere_color, dist(m) * 0.5f + 0.25f);
-        auto position = Vec3(
-                (dist(m) * 30.0f) - 10.0f,
-                (dist(m) * 4.0f) + 1.0f,
-                (dist(m) * 30.0f) - 10.0f
-        );
-        list[idx++] = new Sphere(position, dist(m) * 1.0f + 0.1f, sphere_material);
+        if (width != 0 && width != 2)
+            std::cerr << "Motion keys are only supported by the binary BVH." << std::endl;
+
+        binary->set_motion_keys(time0, time1);
+
+        return binary;
     }
 
-    return new HitableList(list, idx);
+    auto has_avx2 = CPUInfo().is_avx2();
+
+    if (width == 0)
+        width = has_avx2 ? 8 : 4;
+
+    if (width == 8 && !has_avx2)
+    {
+        std::cerr << "AVX2 is not supported, using a 4 wide BVH." << std::endl;
+        width = 4;
+    }
+
+    if (width == 8)
+        return new WideBVH<8>(*binary);
+
+    if (width == 4)
+        return new WideBVH<4>(*binary);
+
+    return binary;
+}
+
+
+/**
+ * Hash of the settings that change the rendered image, other than the ones
+ * stored in the checkpoints on their own (size, samples, seed, sampler).
+ *
+ * @param input_data The command line parameters.
+ *
+ * @return The 64 bit hash.
+ */
+std::uint64_t render_settings_hash(const Parameter &input_data)
+{
+    auto settings = input_data.integrator + " " + input_data.light_sampler + " " +
+                    std::to_string(input_data.max_depth) + " " + std::to_string(input_data.rr_depth) + " " +
+                    std::to_string(input_data.noise_threshold) + " " + std::to_string(input_data.min_samples);
+
+    return hash_bytes(settings.data(), settings.size());
 }
@@ -10,6 +10,9 @@
 #include "ray.h"
 #include "hitable.h"
 #include "texture.h"
+#include "random.h"
+#include "onb.h"
+#include "sampling.h"
 
 
 /**
@@ -28,6 +31,57 @@ public:
         return Color(0.0f, 0.0f, 0.0f);
     }
 
+    /**
+     * Evaluate the scattering towards a given direction: the BSDF times
+     * the cosine with the normal, used to weight the light samples.
+     *
+     * @param ray_in The incoming ray.
+     * @param hit The hit point.
+     * @param direction The outgoing direction, normalized.
+     *
+     * @return The scattered fraction of the light coming from the direction.
+     */
+    virtual Color eval(const Ray& ray_in, const HitRecord& hit, const Vec3& direction) const
+    {
+        return Color(0.0f, 0.0f, 0.0f);
+    }
+
+    /**
+     * Density, in solid angle, of scatter() picking the direction.
+     *
+     * @param ray_in The incoming ray.
+     * @param hit The hit point.
+     * @param direction The outgoing direction, normalized.
+     *
+     * @return The density, 0 for the specular materials.
+     */
+    virtual float pdf(const Ray& ray_in, const HitRecord& hit, const Vec3& direction) const
+    {
+        return 0.0f;
+    }
+
+    /**
+     * Materials that don't implement eval(), like mirrors and glass, are
+     * only sampled through scatter(): the lights are not sampled on them.
+     *
+     * @return True if eval() can't be used.
+     */
+    virtual bool is_specular() const { return true; }
+
+    /**
+     * Next event estimation traces light samples only on the materials
+     * where they help: a lobe much narrower than the lights is better
+     * sampled by scatter() alone, the lights are then found by the paths.
+     *
+     * @return True if the lights are worth sampling at the hit point.
+     */
+    virtual bool prefers_light_samples() const { return !is_specular(); }
+
+    /**
+     * @return True if the material emits light, and its surfaces can be sampled as lights.
+     */
+    virtual bool is_emitter() const { return false; }
+
 };
 
 /**
@@ -70,15 +124,8 @@ float schlick(float cosine, float ref_idx)
 
 Vec3 random_in_unit_sphere()
 {
-	Vec3 p;
-
-	do {
-
-		p = 2.0f * Vec3(dist(m), dist(m), dist(m)) - Vec3(1.0f, 1.0f, 1.0f);
-
-	} while (p.squared_length() >= 1.0f);
-
-	return p;
+	auto u = random_float2();
+	return sample_uniform_ball(u.first, u.second, random_float());
 }
 
 /**
@@ -95,31 +142,96 @@ public:
 
 	bool scatter(const Ray& ray_in, const HitRecord& hit, Color& attenuation, Ray& scattered) const override
 	{
-		Vec3 target = hit.p + hit.normal + random_in_unit_sphere();
-		scattered = Ray(hit.p, target - hit.p, ray_in.time());
+		auto u = random_float2();
+		auto direction = ONB(hit.normal).local(sample_cosine_hemisphere(u.first, u.second));
+		scattered = Ray(hit.p, direction, ray_in.time());
 		attenuation = albedo->value(hit.u, hit.v, hit.p);
     
 		return true;
 	}
 
+	Color eval(const Ray& ray_in, const HitRecord& hit, const Vec3& direction) const override
+	{
+		auto cosine = dot(hit.normal, direction);
+
+		if (cosine <= 0.0f)
+			return Color(0.0f, 0.0f, 0.0f);
+
+		return albedo->value(hit.u, hit.v, hit.p) * static_cast<float>(cosine / M_PI);
+	}
+
+	float pdf(const Ray& ray_in, const HitRecord& hit, const Vec3& direction) const override
+	{
+		return cosine_hemisphere_pdf(dot(hit.normal, direction));
+	}
+
+	bool is_specular() const override { return false; }
+
 };
 
+/**
+ * Mirror, blurred when fuzzy by a Phong lobe around the mirror direction.
+ * The exponent 2 / fuzziness^2 - 2 spreads the reflections over about
+ * fuzziness radians, and over the whole hemisphere for a fuzziness of 1.
+ * Lobes sharper than glossy_exponent (a fuzziness below about 0.14) are
+ * left to scatter() by next event estimation.
+ */
 class Metal : public Material
 {
 public:
-	Metal(const Color& a, float f) : albedo(a) { if (f < 1) fuzziness = f; else fuzziness = 1; };
+	static constexpr float glossy_exponent = 100.0f;
+
+	Metal(const Color& a, float f) : albedo(a)
+	{
+		if (f < 1) fuzziness = f; else fuzziness = 1;
+		exponent = std::min(2.0f / (fuzziness * fuzziness) - 2.0f, 1.0e6f);
+	}
 	
 	Color albedo;
 	float fuzziness;
+	float exponent;
 
 	bool scatter(const Ray& ray_in, const HitRecord& hit, Color& attenuation, Ray& scattered) const override
 	{
 		Vec3 reflected = reflect(unit_vector(ray_in.direction()), hit.normal);
-		scattered = Ray(hit.p, reflected + fuzziness * random_in_unit_sphere(), ray_in.time());
 		attenuation = albedo;
 
+		if (fuzziness == 0.0f)
+		{
+			scattered = Ray(hit.p, reflected, ray_in.time());
+		}
+		else
+		{
+			// eval() / pdf() is the albedo, above the surface.
+			auto u = random_float2();
+			scattered = Ray(hit.p, ONB(reflected).local(sample_phong_lobe(u.first, u.second, exponent)), ray_in.time());
+		}
+
 		return (dot(scattered.direction(), hit.normal) > 0);
 	}
+
+	Color eval(const Ray& ray_in, const HitRecord& hit, const Vec3& direction) const override
+	{
+		if (dot(hit.normal, direction) <= 0.0f)
+			return Color(0.0f, 0.0f, 0.0f);
+
+		return albedo * pdf(ray_in, hit, direction);
+	}
+
+	float pdf(const Ray& ray_in, const HitRecord& hit, const Vec3& direction) const override
+	{
+		if (fuzziness == 0.0f)
+			return 0.0f;
+
+		Vec3 reflected = reflect(unit_vector(ray_in.direction()), hit.normal);
+
+		return phong_lobe_pdf(dot(reflected, direction), exponent);
+	}
+
+	bool is_specular() const override { return fuzziness == 0.0f; }
+
+	bool prefers_light_samples() const override { return exponent < glossy_exponent; }
+
 };
 
 
@@ -159,7 +271,7 @@ public:
         else
             reflect_prob = 1.0;
 
-        if (dist(m) < reflect_prob)
+        if (random_float() < reflect_prob)
             scattered = Ray(hit.p, reflected, r_in.time());
         else
             scattered = Ray(hit.p, refracted, r_in.time());
@@ -187,6 +299,8 @@ public:
     {
         return emit->value(u, v, p);
     }
+
+    bool is_emitter() const override { return true; }
 };
 
 
@@ -201,11 +315,24 @@ public:
 
     bool scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const override;
 
+    Color eval(const Ray &r_in, const HitRecord &rec, const Vec3 &direction) const override
+    {
+        return albedo->value(rec.u, rec.v, rec.p) * static_cast<float>(1.0 / (4.0 * M_PI));
+    }
+
+    float pdf(const Ray &r_in, const HitRecord &rec, const Vec3 &direction) const override
+    {
+        return uniform_sphere_pdf();
+    }
+
+    bool is_specular() const override { return false; }
+
 };
 
 bool Isotropic::scatter(const Ray &r_in, const HitRecord &rec, Color &attenuation, Ray &scattered) const
 {
-    scattered = Ray(rec.p, random_in_unit_sphere());
+    auto u = random_float2();
+    scattered = Ray(rec.p, sample_uniform_sphere(u.first, u.second));
     attenuation = albedo->value(rec.u, rec.v, rec.p);
 
     return true;
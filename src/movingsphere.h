@@ -48,6 +48,15 @@ public:
     bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
 
 
+    /**
+     * Compute the point, the normal and the material of the closest hit.
+     *
+     * @param r The ray given to hit().
+     * @param rec The record filled by hit().
+     */
+    void finalize(const Ray &r, HitRecord &rec) const override;
+
+
     /**
      *
      * @param t0
@@ -58,6 +67,12 @@ public:
     bool bounding_box(float t0, float t1, AABB &box) const override;
 
 
+    /**
+     * Same test as hit(), without filling the record.
+     */
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+
     /**
      *
      * @param time
@@ -82,42 +97,70 @@ bool MovingSphere::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) con
     auto c = dot(oc, oc) - radius * radius;
     auto discriminant = b * b - a * c;
 
-    if (discriminant > 0)
+    if (discriminant <= 0)
+        return false;
+
+    auto root = std::sqrt(discriminant);
+    auto temp = (-b - root) / a;
+
+    if (!(temp < tmax && temp > tmin))
     {
-        auto temp = (-b - std::sqrt(discriminant)) / a;
-
-        if (temp < tmax && temp > tmin)
-        {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center(r.time())) / radius;
-            rec.mat_ptr = mat_ptr;
-
-            return true;
-        }
-
-        temp = (-b + std::sqrt(discriminant)) / a;
-        if (temp < tmax && temp > tmin)
-        {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            rec.normal = (rec.p - center(r.time())) / radius;
-            rec.mat_ptr = mat_ptr;
-
-            return true;
-        }
+        temp = (-b + root) / a;
+
+        if (!(temp < tmax && temp > tmin))
+            return false;
     }
 
-    return false;
+    // The point and the normal are computed by finalize(), for the closest hit only.
+    rec.t = temp;
+    rec.object = this;
+    rec.instance = nullptr;
+    rec.deferred = true;
+
+    return true;
+}
+
+
+void MovingSphere::finalize(const Ray &r, HitRecord &rec) const
+{
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center(r.time())) / radius;
+    rec.mat_ptr = mat_ptr;
+}
+
+
+bool MovingSphere::occluded(const Ray &r, float tmin, float tmax) const
+{
+    auto oc = r.origin() - center(r.time());
+    auto a = dot(r.direction(), r.direction());
+    auto b = dot(oc, r.direction());
+    auto c = dot(oc, oc) - radius * radius;
+    auto discriminant = b * b - a * c;
+
+    if (discriminant <= 0)
+        return false;
+
+    auto root = std::sqrt(discriminant);
+    auto temp = (-b - root) / a;
+
+    if (temp < tmax && temp > tmin)
+        return true;
+
+    temp = (-b + root) / a;
+
+    return temp < tmax && temp > tmin;
 }
 
 
 bool MovingSphere::bounding_box(float t0, float t1, AABB &box) const
 {
-    auto box0 = center0 - Vec3{radius, radius, radius};
-    auto box1 = center1 - Vec3{radius, radius, radius};
+    // The center moves linearly: the boxes at the ends of the interval contain the whole path.
+    auto offset = Vec3{radius, radius, radius};
+
+    auto box0 = AABB(center(t0) - offset, center(t0) + offset);
+    auto box1 = AABB(center(t1) - offset, center(t1) + offset);
 
-    box = AABB(box0, box1);
+    box = surrounding_box(box0, box1);
 
     return true;
 }
@@ -0,0 +1,82 @@
+/**
+ * Node buffer.
+ *
+ * Contiguous storage of the nodes of a flattened BVH: either owned (the
+ * tree was built in this process) or borrowed from memory owned by
+ * someone else, such as a memory-mapped scene cache, and used in place.
+ * Only an owned buffer can be modified.
+ */
+
+#ifndef RAYTRACING_NODEBUFFER_H
+#define RAYTRACING_NODEBUFFER_H
+
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+
+template <typename T>
+class NodeBuffer
+{
+
+private:
+    std::vector<T> owned;
+    const T *borrowed = nullptr;
+    std::size_t borrowed_size = 0;
+
+public:
+    NodeBuffer() = default;
+
+    /**
+     * Borrowing constructor: the nodes must outlive the buffer.
+     *
+     * @param nodes The nodes, aligned for T.
+     * @param size Amount of nodes.
+     */
+    NodeBuffer(const T *nodes, std::size_t size) : borrowed{nodes}, borrowed_size{size} {}
+
+    /**
+     * Returns true if the nodes are borrowed, and so read only.
+     *
+     * @return True for borrowed nodes.
+     */
+    bool is_borrowed() const { return borrowed != nullptr; }
+
+    inline const T* data() const { return borrowed != nullptr ? borrowed : owned.data(); }
+    inline std::size_t size() const { return borrowed != nullptr ? borrowed_size : owned.size(); }
+    inline bool empty() const { return size() == 0; }
+
+    inline const T& operator[](std::size_t i) const { return data()[i]; }
+
+    inline T& operator[](std::size_t i)
+    {
+        assert(!is_borrowed());
+        return owned[i];
+    }
+
+    void reserve(std::size_t size) { owned.reserve(size); }
+
+    /**
+     * Copy borrowed nodes into the buffer, so that they can be modified.
+     */
+    void make_owned()
+    {
+        if (borrowed == nullptr)
+            return;
+
+        owned.assign(borrowed, borrowed + borrowed_size);
+        borrowed = nullptr;
+        borrowed_size = 0;
+    }
+
+    void emplace_back()
+    {
+        assert(!is_borrowed());
+        owned.emplace_back();
+    }
+
+};
+
+
+#endif //RAYTRACING_NODEBUFFER_H
@@ -0,0 +1,354 @@
+/**
+ * Wavefront OBJ loader.
+ *
+ * Reads the geometry of an OBJ file line by line, without holding the
+ * text in memory, into an indexed triangle mesh:
+ *
+ *   v <x> <y> <z>               position
+ *   vt <u> <v>                  texture coordinate
+ *   vn <x> <y> <z>              normal
+ *   f <v>[/<vt>][/<vn>] ...     face, with 1 based or negative (relative) indices
+ *
+ * The polygons are split in fans of triangles. Every distinct combination
+ * of position, texture coordinate and normal used by the faces becomes a
+ * vertex of the mesh, so that the triangles need a single index per
+ * vertex. The normals (and the texture coordinates) are kept only if all
+ * the vertices have one. The other statements (groups, materials, lines)
+ * are ignored.
+ */
+
+#ifndef RAYTRACING_OBJLOADER_H
+#define RAYTRACING_OBJLOADER_H
+
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "trianglemesh.h"
+#include "vec3.h"
+
+
+class ObjReader
+{
+
+private:
+    struct VertexKey
+    {
+        std::int64_t position;
+        std::int64_t uv;
+        std::int64_t normal;
+
+        bool operator==(const VertexKey &other) const
+        {
+            return position == other.position && uv == other.uv && normal == other.normal;
+        }
+    };
+
+    struct VertexKeyHash
+    {
+        std::size_t operator()(const VertexKey &key) const
+        {
+            auto h = static_cast<std::uint64_t>(key.position) * 0x9e3779b97f4a7c15ull;
+            h ^= static_cast<std::uint64_t>(key.uv) + 0x632be59bd9b4e019ull + (h << 6) + (h >> 2);
+            h ^= static_cast<std::uint64_t>(key.normal) + 0x85ebca6b0c2b7e3dull + (h << 6) + (h >> 2);
+            return static_cast<std::size_t>(h);
+        }
+    };
+
+    static constexpr std::uint32_t no_vertex = 0xffffffffu;
+
+    std::vector<Vec3> positions;
+    std::vector<MeshUV> uvs;
+    std::vector<Vec3> normals;
+
+    /**
+     * The first vertex made of every position, and its key: most positions
+     * are used with a single texture coordinate and normal, so the map of
+     * the vertices is only needed for the others.
+     */
+    std::vector<std::uint32_t> position_vertex;
+    std::vector<VertexKey> vertex_keys;
+    std::unordered_map<VertexKey, std::uint32_t, VertexKeyHash> vertices;
+    std::vector<std::uint32_t> polygon;
+    bool missing_uvs = false;
+    bool missing_normals = false;
+
+    TriangleMeshData *mesh = nullptr;
+    long line = 0;
+    std::string error;
+
+    bool fail(const std::string &message);
+
+    bool read_floats(const char *&cursor, float *values, int count);
+    bool read_index(const char *&cursor, std::size_t size, std::int64_t &index);
+    bool read_vertex(const char *&cursor, std::uint32_t &vertex);
+    bool read_face(const char *cursor);
+
+public:
+    /**
+     * Read an OBJ stream into a mesh.
+     *
+     * @param in The stream.
+     * @param out_mesh The mesh, with one vertex per distinct face corner.
+     *
+     * @return True if the stream was read, otherwise last_error() tells why.
+     */
+    bool read(std::istream &in, TriangleMeshData &out_mesh);
+
+    /**
+     * @return The line and the cause of the error.
+     */
+    const std::string& last_error() const { return error; }
+
+};
+
+
+bool ObjReader::fail(const std::string &message)
+{
+    error = "line " + std::to_string(line) + ": " + message;
+    return false;
+}
+
+
+bool ObjReader::read_floats(const char *&cursor, float *values, int count)
+{
+    for (auto i=0; i<count; ++i)
+    {
+        char *parsed;
+        values[i] = std::strtof(cursor, &parsed);
+
+        if (parsed == cursor)
+            return fail("missing number");
+
+        // NaN, infinities and the values out of the range of float.
+        if (!std::isfinite(values[i]))
+        {
+            while (*cursor == ' ' || *cursor == '\t')
+                ++cursor;
+
+            return fail("not a finite number: " + std::string(cursor, static_cast<std::size_t>(parsed - cursor)));
+        }
+
+        cursor = parsed;
+    }
+
+    return true;
+}
+
+
+bool ObjReader::read_index(const char *&cursor, std::size_t size, std::int64_t &index)
+{
+    char *parsed;
+    auto value = std::strtoll(cursor, &parsed, 10);
+
+    if (parsed == cursor)
+        return fail("missing index");
+
+    cursor = parsed;
+
+    // 1 based, or relative to the end of the list when negative.
+    index = value > 0 ? value - 1 : static_cast<std::int64_t>(size) + value;
+
+    if (value == 0 || index < 0 || index >= static_cast<std::int64_t>(size))
+        return fail("index out of range: " + std::to_string(value));
+
+    return true;
+}
+
+
+bool ObjReader::read_vertex(const char *&cursor, std::uint32_t &vertex)
+{
+    VertexKey key{0, -1, -1};
+
+    if (!read_index(cursor, positions.size(), key.position))
+        return false;
+
+    if (*cursor == '/')
+    {
+        ++cursor;
+
+        if (*cursor != '/' && !read_index(cursor, uvs.size(), key.uv))
+            return false;
+
+        if (*cursor == '/')
+        {
+            ++cursor;
+
+            if (!read_index(cursor, normals.size(), key.normal))
+                return false;
+        }
+    }
+
+    if (position_vertex.size() < positions.size())
+        position_vertex.resize(positions.size(), no_vertex);
+
+    auto &first = position_vertex[key.position];
+
+    if (first != no_vertex && vertex_keys[first] == key)
+    {
+        vertex = first;
+        return true;
+    }
+
+    if (first != no_vertex)
+    {
+        auto found = vertices.find(key);
+
+        if (found != vertices.end())
+        {
+            vertex = found->second;
+            return true;
+        }
+    }
+
+    vertex = static_cast<std::uint32_t>(mesh->positions.size());
+
+    if (first == no_vertex)
+        first = vertex;
+    else
+        vertices.emplace(key, vertex);
+
+    vertex_keys.push_back(key);
+
+    mesh->positions.push_back(positions[key.position]);
+    mesh->uvs.push_back(key.uv >= 0 ? uvs[key.uv] : MeshUV{0.0f, 0.0f});
+    mesh->normals.push_back(key.normal >= 0 ? normals[key.normal] : Vec3::ZERO);
+
+    missing_uvs |= key.uv < 0;
+    missing_normals |= key.normal < 0;
+
+    return true;
+}
+
+
+bool ObjReader::read_face(const char *cursor)
+{
+    polygon.clear();
+
+    while (true)
+    {
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')
+            ++cursor;
+
+        if (*cursor == '\0' || *cursor == '#')
+            break;
+
+        std::uint32_t vertex;
+
+        if (!read_vertex(cursor, vertex))
+            return false;
+
+        polygon.push_back(vertex);
+    }
+
+    if (polygon.size() < 3)
+        return fail("face with less than 3 vertices");
+
+    for (std::size_t i=2; i<polygon.size(); ++i)
+    {
+        mesh->indices.push_back(polygon[0]);
+        mesh->indices.push_back(polygon[i - 1]);
+        mesh->indices.push_back(polygon[i]);
+    }
+
+    return true;
+}
+
+
+bool ObjReader::read(std::istream &in, TriangleMeshData &out_mesh)
+{
+    mesh = &out_mesh;
+    line = 0;
+
+    std::string text;
+
+    while (std::getline(in, text))
+    {
+        ++line;
+
+        const char *cursor = text.c_str();
+
+        while (*cursor == ' ' || *cursor == '\t')
+            ++cursor;
+
+        auto ok = true;
+        float values[3];
+
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            cursor += 2;
+            ok = read_floats(cursor, values, 3);
+            positions.emplace_back(values[0], values[1], values[2]);
+        }
+        else if (cursor[0] == 'v' && cursor[1] == 't' && (cursor[2] == ' ' || cursor[2] == '\t'))
+        {
+            cursor += 3;
+            ok = read_floats(cursor, values, 2);
+            uvs.push_back({values[0], values[1]});
+        }
+        else if (cursor[0] == 'v' && cursor[1] == 'n' && (cursor[2] == ' ' || cursor[2] == '\t'))
+        {
+            cursor += 3;
+            ok = read_floats(cursor, values, 3);
+            normals.emplace_back(values[0], values[1], values[2]);
+        }
+        else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+        {
+            ok = read_face(cursor + 2);
+        }
+
+        if (!ok)
+            return false;
+    }
+
+    if (in.bad())
+        return fail("read error");
+
+    if (missing_uvs)
+        mesh->uvs.clear();
+
+    if (missing_normals)
+        mesh->normals.clear();
+
+    return true;
+}
+
+
+/**
+ * Load an OBJ file.
+ *
+ * @param filename The OBJ filename.
+ * @param mesh The loaded mesh.
+ * @param error Output, the cause of the error.
+ *
+ * @return True if the file was loaded.
+ */
+bool load_obj(const std::string &filename, TriangleMeshData &mesh, std::string &error)
+{
+    std::ifstream in(filename);
+
+    if (!in)
+    {
+        error = "cannot open " + filename;
+        return false;
+    }
+
+    ObjReader reader;
+
+    if (!reader.read(in, mesh))
+    {
+        error = filename + ", " + reader.last_error();
+        return false;
+    }
+
+    return true;
+}
+
+
+#endif //RAYTRACING_OBJLOADER_H
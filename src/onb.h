@@ -0,0 +1,68 @@
+/**
+ * Orthonormal basis.
+ *
+ * Local frame built around a direction, used to turn directions sampled
+ * around the z axis into world space directions around any axis.
+ */
+
+#ifndef RAYTRACING_ONB_H
+#define RAYTRACING_ONB_H
+
+
+#include <cmath>
+
+#include "vec3.h"
+
+
+class ONB
+{
+
+private:
+    Vec3 axis[3];
+
+public:
+    /**
+     * Build the basis with w along the given direction.
+     *
+     * @param n Direction of the w axis, doesn't need to be normalized.
+     */
+    explicit ONB(const Vec3 &n)
+    {
+        axis[2] = unit_vector(n);
+
+        // Branchless basis of Duff et al., "Building an Orthonormal Basis, Revisited".
+        auto x = axis[2].x();
+        auto y = axis[2].y();
+        auto z = axis[2].z();
+        auto sign = std::copysign(1.0f, z);
+        auto a = -1.0f / (sign + z);
+        auto b = x * y * a;
+
+        axis[0] = Vec3(1.0f + sign * x * x * a, sign * b, -sign * x);
+        axis[1] = Vec3(b, sign + y * y * a, -y);
+    }
+
+    Vec3 u() const { return axis[0]; }
+    Vec3 v() const { return axis[1]; }
+    Vec3 w() const { return axis[2]; }
+
+    /**
+     * Convert local coordinates into a world space vector.
+     *
+     * @return a * u + b * v + c * w.
+     */
+    Vec3 local(float a, float b, float c) const { return a * axis[0] + b * axis[1] + c * axis[2]; }
+
+    /**
+     * Convert a local vector into a world space vector.
+     *
+     * @param a The vector in the basis.
+     *
+     * @return The world space vector.
+     */
+    Vec3 local(const Vec3 &a) const { return local(a.x(), a.y(), a.z()); }
+
+};
+
+
+#endif //RAYTRACING_ONB_H
@@ -2,6 +2,7 @@
 #define RAYTRACING_PARSER_H
 
 
+#include <cstdint>
 #include <string>
 
 
@@ -10,7 +11,30 @@ struct Parameter
     int width = 200;
     int height = 100;
     int samples = 8;
+    int min_samples = 16;
+    float noise_threshold = 0.0f;
+    bool progressive = false;
+    int snapshot_seconds = 10;
+    int snapshot_passes = 0;
+    std::string checkpoint_path;
+    int checkpoint_seconds = 60;
+    std::string resume_path;
+    int max_depth = 20;
+    int rr_depth = 3;
+    std::string integrator = "nee";
+    std::string light_sampler = "bvh";
+    std::string sampler = "sobol";
+    int threads = 0;
+    int tile_width = 16;
+    int tile_height = 16;
+    std::uint64_t seed = 0;
+    std::string bvh = "sah";
+    int bvh_width = 0;
+    bool motion_keys = false;
+    bool benchmark = false;
     std::string output_path = "temp.ppm";
+    std::string scene_path;
+    std::string scene_cache_path;
 };
 
 
@@ -31,6 +55,12 @@ Parameter parser(int argc, char *argv[])
             if (param == "--output")
                 out_param.output_path = value;
 
+            if (param == "--scene")
+                out_param.scene_path = value;
+
+            if (param == "--scene-cache")
+                out_param.scene_cache_path = value;
+
             if (param == "--width")
                 out_param.width = std::stoi(value);
 
@@ -40,6 +70,70 @@ Parameter parser(int argc, char *argv[])
             if (param == "--samples")
                 out_param.samples = std::stoi(value);
 
+            if (param == "--min-samples")
+                out_param.min_samples = std::stoi(value);
+
+            if (param == "--noise-threshold")
+                out_param.noise_threshold = std::stof(value);
+
+            if (param == "--progressive")
+                out_param.progressive = value != "0";
+
+            if (param == "--snapshot-seconds")
+                out_param.snapshot_seconds = std::stoi(value);
+
+            if (param == "--snapshot-passes")
+                out_param.snapshot_passes = std::stoi(value);
+
+            if (param == "--checkpoint")
+                out_param.checkpoint_path = value;
+
+            if (param == "--checkpoint-seconds")
+                out_param.checkpoint_seconds = std::stoi(value);
+
+            if (param == "--resume")
+                out_param.resume_path = value;
+
+            if (param == "--max-depth")
+                out_param.max_depth = std::stoi(value);
+
+            if (param == "--rr-depth")
+                out_param.rr_depth = std::stoi(value);
+
+            if (param == "--integrator")
+                out_param.integrator = value;
+
+            if (param == "--light-sampler")
+                out_param.light_sampler = value;
+
+            if (param == "--sampler")
+                out_param.sampler = value;
+
+            if (param == "--threads")
+                out_param.threads = std::stoi(value);
+
+            if (param == "--bvh")
+                out_param.bvh = value;
+
+            if (param == "--bvh-width")
+                out_param.bvh_width = std::stoi(value);
+
+            if (param == "--motion-keys")
+                out_param.motion_keys = value != "0";
+
+            if (param == "--benchmark")
+                out_param.benchmark = value != "0";
+
+            if (param == "--seed")
+                out_param.seed = std::stoull(value);
+
+            if (param == "--tile")
+            {
+                auto sep = value.find('x');
+                out_param.tile_width = std::stoi(value.substr(0, sep));
+                out_param.tile_height = sep != std::string::npos ? std::stoi(value.substr(sep+1)) : out_param.tile_width;
+            }
+
             arg.erase(0, pos + 1);
         }
     }
@@ -4,6 +4,7 @@
 
 #include "vec3.h"
 #include "ray.h"
+#include "random.h"
 
 
 class Perlin
@@ -18,6 +19,15 @@ private:
 
 public:
 
+    /**
+     * Default constructor.
+     *
+     * The random tables, shared by all the noises, are generated by the
+     * first noise created, with the random generator of the calling thread:
+     * after the seed of the render, instead of at the static initialization.
+     */
+    Perlin();
+
     /**
      * Noise processing function.
      *
@@ -139,7 +149,7 @@ float Perlin::noise(const Vec3 &p) const
 //    auto *p = new float[256];
 //    for (auto i=0; i<256; ++i)
 //    {
-//        p[i] = dist(m);
+//        p[i] = random_float();
 //    }
 //
 //    return p;
@@ -152,7 +162,7 @@ static Vec3* perlin_generate()
 
     for (auto i=0; i<256; ++i)
     {
-        p[i] = unit_vector(Vec3(-1.0f + 2.0f * dist(m), -1.0f + 2.0f * dist(m), -1.0f + 2.0f * dist(m)));
+        p[i] = unit_vector(Vec3(-1.0f + 2.0f * random_float(), -1.0f + 2.0f * random_float(), -1.0f + 2.0f * random_float()));
     }
 
     return p;
@@ -169,7 +179,7 @@ void permute(int *p, int n)
 {
     for (auto i=n-1; i>0; i--)
     {
-        auto target = static_cast<int>(dist(m) * (i+1));
+        auto target = static_cast<int>(random_float() * (i+1));
         auto tmp = p[i];
         p[i] = p[target];
         p[target] = tmp;
@@ -195,10 +205,22 @@ static int* perlin_generate_perm()
 }
 
 
-Vec3 *Perlin::ranvec = perlin_generate();
-int *Perlin::perm_x = perlin_generate_perm();
-int *Perlin::perm_y = perlin_generate_perm();
-int *Perlin::perm_z = perlin_generate_perm();
+Vec3 *Perlin::ranvec = nullptr;
+int *Perlin::perm_x = nullptr;
+int *Perlin::perm_y = nullptr;
+int *Perlin::perm_z = nullptr;
+
+
+Perlin::Perlin()
+{
+    if (ranvec != nullptr)
+        return;
+
+    ranvec = perlin_generate();
+    perm_x = perlin_generate_perm();
+    perm_y = perlin_generate_perm();
+    perm_z = perlin_generate_perm();
+}
 
 
 #endif //RAYTRACING_PERLIN_H
@@ -0,0 +1,220 @@
+/**
+ * Random number generation.
+ *
+ * Every thread owns its own PCG32 generator, that the render loop
+ * reseeds for every pixel sample. This way the sequence of random
+ * numbers used by a sample only depends on the seed, the pixel and
+ * the sample index, and not on the thread that renders it.
+ *
+ * While a pixel sample is traced, the numbers can instead come from the
+ * active sampler of the thread (see sampler.h), that hands out the
+ * dimensions of a (low discrepancy) sample point one after the other.
+ */
+
+#ifndef RAYTRACING_RANDOM_H
+#define RAYTRACING_RANDOM_H
+
+
+#include <cstdint>
+#include <utility>
+
+
+/**
+ * PCG32 random number generator (M.E. O'Neill, pcg-random.org).
+ *
+ * 64 bit state, 32 bit output, with selectable stream.
+ */
+class PCG32
+{
+
+private:
+    std::uint64_t state;
+    std::uint64_t inc;
+
+public:
+    /**
+     * Seed and stream constructor.
+     *
+     * @param seed Initial state.
+     * @param stream Stream (sequence) selector.
+     */
+    constexpr explicit PCG32(std::uint64_t seed = 0x853c49e6748fea9bULL, std::uint64_t stream = 0xda3e39cb94b95bdbULL)
+        : state{0u}, inc{(stream << 1u) | 1u}
+    {
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    /**
+     * Reset the generator to the given seed and stream.
+     *
+     * @param seed Initial state.
+     * @param stream Stream (sequence) selector.
+     */
+    constexpr void seed(std::uint64_t seed, std::uint64_t stream = 0xda3e39cb94b95bdbULL)
+    {
+        state = 0u;
+        inc = (stream << 1u) | 1u;
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    /**
+     * Next 32 bit random integer.
+     *
+     * @return Uniformly distributed integer.
+     */
+    constexpr std::uint32_t next_uint()
+    {
+        auto old_state = state;
+        state = old_state * 6364136223846793005ULL + inc;
+
+        auto xorshifted = static_cast<std::uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+        auto rot = static_cast<std::uint32_t>(old_state >> 59u);
+
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    /**
+     * Next random float.
+     *
+     * @return Uniformly distributed float in [0, 1).
+     */
+    constexpr float next_float()
+    {
+        // 24 bits of mantissa, so the result is always strictly less than 1.
+        return static_cast<float>(next_uint() >> 8u) * (1.0f / 16777216.0f);
+    }
+
+};
+
+
+/**
+ * 64 bit finalizer from MurmurHash3, used to turn correlated integers
+ * (pixel and sample indices) into well distributed seeds.
+ *
+ * @param v Value to mix.
+ *
+ * @return The mixed value.
+ */
+inline std::uint64_t mix_bits(std::uint64_t v)
+{
+    v ^= v >> 33u;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33u;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33u;
+
+    return v;
+}
+
+
+/**
+ * The random generator owned by the current thread.
+ */
+thread_local PCG32 rng;
+
+
+/**
+ * Seed the current thread generator for the given pixel sample.
+ *
+ * @param seed Global seed of the render.
+ * @param pixel_index Index of the pixel in the frame.
+ * @param sample_index Index of the sample inside the pixel.
+ */
+inline void seed_sample(std::uint64_t seed, std::uint64_t pixel_index, std::uint64_t sample_index)
+{
+    rng.seed(mix_bits((pixel_index << 32u) ^ sample_index ^ mix_bits(seed)), seed);
+}
+
+
+/**
+ * Source of the sample points of the pixel samples.
+ *
+ * Every call consumes the next dimensions of the point: the consumers
+ * ask for the 2D values they need together, so that the samplers can
+ * stratify them jointly.
+ */
+class Sampler
+{
+
+public:
+    virtual ~Sampler() = default;
+
+    /**
+     * Start a new sample point, from the first dimension.
+     *
+     * @param pixel_index Index of the pixel in the frame.
+     * @param sample_index Index of the sample inside the pixel.
+     */
+    virtual void start_pixel_sample(std::uint64_t pixel_index, int sample_index) = 0;
+
+    /**
+     * @return The next dimension of the point, in [0, 1).
+     */
+    virtual float get_1d() = 0;
+
+    /**
+     * @return The next two dimensions of the point, in [0, 1).
+     */
+    virtual std::pair<float, float> get_2d() = 0;
+
+    /**
+     * Move to the given dimension, if not already past it. Used to give
+     * the same dimensions to the same uses in every sample (for example
+     * to every bounce of a path), without reusing any.
+     *
+     * @param dimension The dimension.
+     */
+    virtual void skip_to(int dimension) = 0;
+
+};
+
+
+/**
+ * The sampler of the current thread, null outside of the pixel samples.
+ */
+thread_local Sampler *active_sampler = nullptr;
+
+
+/**
+ * Next random float, from the active sampler or the thread generator.
+ *
+ * @return Uniformly distributed float in [0, 1).
+ */
+inline float random_float()
+{
+    return active_sampler != nullptr ? active_sampler->get_1d() : rng.next_float();
+}
+
+
+/**
+ * Next two random floats, to be used together.
+ *
+ * @return Uniformly distributed floats in [0, 1).
+ */
+inline std::pair<float, float> random_float2()
+{
+    if (active_sampler != nullptr)
+        return active_sampler->get_2d();
+
+    auto u = rng.next_float();
+    return {u, rng.next_float()};
+}
+
+
+/**
+ * Move the active sampler to the given dimension, see Sampler::skip_to.
+ *
+ * @param dimension The dimension.
+ */
+inline void random_skip_to(int dimension)
+{
+    if (active_sampler != nullptr)
+        active_sampler->skip_to(dimension);
+}
+
+
+#endif //RAYTRACING_RANDOM_H
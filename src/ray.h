@@ -10,11 +10,6 @@
 #endif
 
 
-std::random_device d;
-std::mt19937 m{ d() };
-std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-
-
 class Ray
 {
 
@@ -4,6 +4,68 @@
 
 #include "hitable.h"
 #include "material.h"
+#include "random.h"
+
+
+/**
+ * Density, in solid angle, of the directions towards a point sampled
+ * uniformly on the area of a rectangle.
+ *
+ * @param rect The rectangle.
+ * @param area Area of the rectangle.
+ * @param origin The point the rectangle is seen from.
+ * @param direction The direction to evaluate.
+ *
+ * @return The density, 0 if the direction misses the rectangle.
+ */
+float rect_pdf_value(const Hitable &rect, float area, const Vec3 &origin, const Vec3 &direction)
+{
+    HitRecord rec;
+    auto r = Ray(origin, direction);
+
+    if (!rect.hit(r, 0.001f, FLT_MAX, rec))
+        return 0.0f;
+
+    finalize_hit(r, rec);
+
+    auto distance_squared = rec.t * rec.t * direction.squared_length();
+    auto cosine = std::fabs(dot(direction, rec.normal)) / direction.length();
+
+    if (cosine <= 0.0f)
+        return 0.0f;
+
+    return distance_squared / (cosine * area);
+}
+
+
+/**
+ * Bounds of the light emitted by a rectangle (or any planar primitive), on both sides.
+ *
+ * @param rect The rectangle.
+ * @param material Material of the rectangle.
+ * @param area Area of the rectangle.
+ * @param normal Normal of the rectangle.
+ * @param light Output, the bounds.
+ *
+ * @return False if the rectangle doesn't emit light.
+ */
+bool rect_light_bounds(const Hitable &rect, const Material *material, float area, const Vec3 &normal,
+                       LightBounds &light)
+{
+    if (material == nullptr || !material->is_emitter())
+        return false;
+
+    rect.bounding_box(0.0f, 1.0f, light.bounds);
+
+    // The emission does not depend on the side of the surface.
+    light.power = material->emitted(0.5f, 0.5f, light.bounds.centroid()).luminance() * area * static_cast<float>(2.0f * M_PI);
+    light.axis = normal;
+    light.cos_theta_o = 1.0f;
+    light.cos_theta_e = 0.0f;
+    light.two_sided = true;
+
+    return true;
+}
 
 
 class XY_Rect : public Hitable
@@ -20,7 +82,14 @@ public:
             : x0(x0), x1(x1), y0(y0), y1(y1), k(k), material(material) {}
 
     bool hit(const Ray &r, float t0, float t1, HitRecord &rec) const override;
+    void finalize(const Ray &r, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float t0, float t1) const override;
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override;
+    Vec3 random(const Vec3 &origin) const override;
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
 
 };
 
@@ -29,21 +98,46 @@ bool XY_Rect::hit(const Ray &r, float t0, float t1, HitRecord &rec) const
 {
     auto t = (k - r.origin().z()) / r.direction().z();
 
-    if (t < t0 || t > t1) return false;
+    // Written to also reject NaN, when the ray lies in the plane.
+    if (!(t >= t0 && t <= t1)) return false;
 
     auto x = r.origin().x() + t * r.direction().x();
     auto y = r.origin().y() + t * r.direction().y();
 
-    if (x < x0 || x > x1 || y < y0 || y > y1) return false;
+    if (!(x >= x0 && x <= x1 && y >= y0 && y <= y1)) return false;
 
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (y - y0) / (y1 - y0);
+    // The local coordinates, normalized by finalize().
+    rec.u = x;
+    rec.v = y;
     rec.t = t;
+    rec.object = this;
+    rec.instance = nullptr;
+    rec.deferred = true;
+
+    return true;
+}
+
+
+void XY_Rect::finalize(const Ray &r, HitRecord &rec) const
+{
+    rec.u = (rec.u - x0) / (x1 - x0);
+    rec.v = (rec.v - y0) / (y1 - y0);
     rec.mat_ptr = material;
-    rec.p = r.point_at_parameter(t);
+    rec.p = r.point_at_parameter(rec.t);
     rec.normal = Vec3::Z;
+}
 
-    return true;
+
+bool XY_Rect::occluded(const Ray &r, float t0, float t1) const
+{
+    auto t = (k - r.origin().z()) / r.direction().z();
+
+    if (!(t >= t0 && t <= t1)) return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto y = r.origin().y() + t * r.direction().y();
+
+    return x >= x0 && x <= x1 && y >= y0 && y <= y1;
 }
 
 
@@ -55,6 +149,34 @@ bool XY_Rect::bounding_box(float t0, float t1, AABB &box) const
 }
 
 
+float XY_Rect::pdf_value(const Vec3 &origin, const Vec3 &direction) const
+{
+    return rect_pdf_value(*this, (x1 - x0) * (y1 - y0), origin, direction);
+}
+
+
+Vec3 XY_Rect::random(const Vec3 &origin) const
+{
+    auto u = random_float2();
+    auto point = Vec3(x0 + u.first * (x1 - x0), y0 + u.second * (y1 - y0), k);
+
+    return point - origin;
+}
+
+
+void XY_Rect::collect_emitters(std::vector<Emitter> &emitters)
+{
+    if (material != nullptr && material->is_emitter())
+        emitters.push_back({this, this});
+}
+
+
+bool XY_Rect::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    return rect_light_bounds(*this, material, (x1 - x0) * (y1 - y0), Vec3::Z, light);
+}
+
+
 
 
 class XZ_Rect : public Hitable
@@ -71,7 +193,14 @@ public:
             : x0(x0), x1(x1), z0(z0), z1(z1), k(k), material(material) {}
 
     bool hit(const Ray &r, float t0, float t1, HitRecord &rec) const override;
+    void finalize(const Ray &r, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float t0, float t1) const override;
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override;
+    Vec3 random(const Vec3 &origin) const override;
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
 
 };
 
@@ -80,21 +209,45 @@ bool XZ_Rect::hit(const Ray &r, float t0, float t1, HitRecord &rec) const
 {
     auto t = (k - r.origin().y()) / r.direction().y();
 
-    if (t < t0 || t > t1) return false;
+    if (!(t >= t0 && t <= t1)) return false;
 
     auto x = r.origin().x() + t * r.direction().x();
     auto z = r.origin().z() + t * r.direction().z();
 
-    if (x < x0 || x > x1 || z < z0 || z > z1) return false;
+    if (!(x >= x0 && x <= x1 && z >= z0 && z <= z1)) return false;
 
-    rec.u = (x - x0) / (x1 - x0);
-    rec.v = (z - z0) / (z1 / z0);
+    // The local coordinates, normalized by finalize().
+    rec.u = x;
+    rec.v = z;
     rec.t = t;
+    rec.object = this;
+    rec.instance = nullptr;
+    rec.deferred = true;
+
+    return true;
+}
+
+
+void XZ_Rect::finalize(const Ray &r, HitRecord &rec) const
+{
+    rec.u = (rec.u - x0) / (x1 - x0);
+    rec.v = (rec.v - z0) / (z1 - z0);
     rec.mat_ptr = material;
-    rec.p = r.point_at_parameter(t);
+    rec.p = r.point_at_parameter(rec.t);
     rec.normal = Vec3::Y;
+}
 
-    return true;
+
+bool XZ_Rect::occluded(const Ray &r, float t0, float t1) const
+{
+    auto t = (k - r.origin().y()) / r.direction().y();
+
+    if (!(t >= t0 && t <= t1)) return false;
+
+    auto x = r.origin().x() + t * r.direction().x();
+    auto z = r.origin().z() + t * r.direction().z();
+
+    return x >= x0 && x <= x1 && z >= z0 && z <= z1;
 }
 
 
@@ -106,6 +259,34 @@ bool XZ_Rect::bounding_box(float t0, float t1, AABB &box) const
 }
 
 
+float XZ_Rect::pdf_value(const Vec3 &origin, const Vec3 &direction) const
+{
+    return rect_pdf_value(*this, (x1 - x0) * (z1 - z0), origin, direction);
+}
+
+
+Vec3 XZ_Rect::random(const Vec3 &origin) const
+{
+    auto u = random_float2();
+    auto point = Vec3(x0 + u.first * (x1 - x0), k, z0 + u.second * (z1 - z0));
+
+    return point - origin;
+}
+
+
+void XZ_Rect::collect_emitters(std::vector<Emitter> &emitters)
+{
+    if (material != nullptr && material->is_emitter())
+        emitters.push_back({this, this});
+}
+
+
+bool XZ_Rect::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    return rect_light_bounds(*this, material, (x1 - x0) * (z1 - z0), Vec3::Y, light);
+}
+
+
 
 
 class YZ_Rect : public Hitable
@@ -122,7 +303,14 @@ public:
             : y0(y0), y1(y1), z0(z0), z1(z1), k(k), material(material) {}
 
     bool hit(const Ray &r, float t0, float t1, HitRecord &rec) const override;
+    void finalize(const Ray &r, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float t0, float t1) const override;
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override;
+    Vec3 random(const Vec3 &origin) const override;
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
 
 };
 
@@ -131,23 +319,48 @@ bool YZ_Rect::hit(const Ray &r, float t0, float t1, HitRecord &rec) const
 {
     auto t = (k - r.origin().x()) / r.direction().x();
 
-    if (t < t0 || t > t1) return false;
+    if (!(t >= t0 && t <= t1)) return false;
 
     auto y = r.origin().y() + t * r.direction().y();
     auto z = r.origin().z() + t * r.direction().z();
 
-    if (y < y0 || y > y1 || z < z0 || z > z1) return false;
+    if (!(y >= y0 && y <= y1 && z >= z0 && z <= z1)) return false;
 
-    rec.u = (y - y0) / (y1 - y0);
-    rec.v = (z - z0) / (z1 - z0);
+    // The local coordinates, normalized by finalize().
+    rec.u = y;
+    rec.v = z;
     rec.t = t;
+    rec.object = this;
+    rec.instance = nullptr;
+    rec.deferred = true;
+
+    return true;
+}
+
+
+void YZ_Rect::finalize(const Ray &r, HitRecord &rec) const
+{
+    rec.u = (rec.u - y0) / (y1 - y0);
+    rec.v = (rec.v - z0) / (z1 - z0);
     rec.mat_ptr = material;
-    rec.p = r.point_at_parameter(t);
+    rec.p = r.point_at_parameter(rec.t);
     rec.normal = Vec3::X;
+}
 
-    return true;
+
+bool YZ_Rect::occluded(const Ray &r, float t0, float t1) const
+{
+    auto t = (k - r.origin().x()) / r.direction().x();
+
+    if (!(t >= t0 && t <= t1)) return false;
+
+    auto y = r.origin().y() + t * r.direction().y();
+    auto z = r.origin().z() + t * r.direction().z();
+
+    return y >= y0 && y <= y1 && z >= z0 && z <= z1;
 }
 
+
 bool YZ_Rect::bounding_box(float t0, float t1, AABB &box) const
 {
     box = AABB(Vec3(k-0.0001f, y0, z0), Vec3(k+0.0001f, y1, z1));
@@ -156,4 +369,32 @@ bool YZ_Rect::bounding_box(float t0, float t1, AABB &box) const
 }
 
 
+float YZ_Rect::pdf_value(const Vec3 &origin, const Vec3 &direction) const
+{
+    return rect_pdf_value(*this, (y1 - y0) * (z1 - z0), origin, direction);
+}
+
+
+Vec3 YZ_Rect::random(const Vec3 &origin) const
+{
+    auto u = random_float2();
+    auto point = Vec3(k, y0 + u.first * (y1 - y0), z0 + u.second * (z1 - z0));
+
+    return point - origin;
+}
+
+
+void YZ_Rect::collect_emitters(std::vector<Emitter> &emitters)
+{
+    if (material != nullptr && material->is_emitter())
+        emitters.push_back({this, this});
+}
+
+
+bool YZ_Rect::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    return rect_light_bounds(*this, material, (y1 - y0) * (z1 - z0), Vec3::X, light);
+}
+
+
 #endif //RAYTRACING_RECT_H
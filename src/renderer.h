@@ -0,0 +1,224 @@
+/**
+ * Tile renderer.
+ *
+ * Traces the passes of a frame: a pass adds the samples [first, last) to
+ * the active pixels of the accumulation buffer, with a task per tile.
+ * Every pixel sample starts the sampler at its own point, so the image
+ * does not depend on the amount of threads, nor on the worker that
+ * renders a tile.
+ */
+
+#ifndef RAYTRACING_RENDERER_H
+#define RAYTRACING_RENDERER_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "accumulation.h"
+#include "bvhnode.h"
+#include "camera.h"
+#include "hitable.h"
+#include "integrator.h"
+#include "random.h"
+#include "sampler.h"
+#include "scheduler.h"
+#include "tile.h"
+
+
+/**
+ * Counters of the renderer, over all the passes.
+ */
+struct RenderStats
+{
+    std::uint64_t samples = 0;
+    std::uint64_t rays = 0;
+    std::uint64_t node_visits = 0;
+    std::uint64_t shadow_rays = 0;
+    std::uint64_t shadow_node_visits = 0;
+};
+
+
+class TileRenderer
+{
+
+private:
+    const Hitable &world;
+    Camera &camera;
+    const Integrator &integrator;
+    AccumulationBuffer &accumulation;
+    int size_x;
+    int size_y;
+
+    // One sampler per worker, started again at every pixel sample.
+    std::vector<std::unique_ptr<Sampler>> samplers;
+
+    const std::atomic<bool> *stop_flag = nullptr;
+
+    std::mutex progress_mutex;
+    std::atomic<std::uint64_t> samples_count{0};
+    std::atomic<std::uint64_t> rays_count{0};
+    std::atomic<std::uint64_t> node_visits{0};
+    std::atomic<std::uint64_t> shadow_rays_count{0};
+    std::atomic<std::uint64_t> shadow_node_visits{0};
+
+public:
+    /**
+     * Scene constructor.
+     *
+     * The samples already in the accumulation buffer (a resumed render) are counted.
+     *
+     * @param world The scene.
+     * @param camera The camera.
+     * @param integrator The integrator estimating the radiance of the camera rays.
+     * @param accumulation The buffer the samples are added to, with the size of the frame.
+     * @param sampler Name of the sampler, independent if unknown.
+     * @param samples_per_pixel Samples of every pixel, over all the passes.
+     * @param seed Seed of the samplers.
+     * @param threads Amount of workers of the scheduler rendering the tiles.
+     */
+    TileRenderer(const Hitable &world, Camera &camera, const Integrator &integrator, AccumulationBuffer &accumulation,
+                 const std::string &sampler, int samples_per_pixel, std::uint64_t seed, unsigned int threads);
+
+    TileRenderer(const TileRenderer&) = delete;
+    TileRenderer& operator=(const TileRenderer&) = delete;
+
+    /**
+     * Set the flag that stops the tracing of the tiles, leaving the pass incomplete.
+     *
+     * @param flag The flag, nullptr to never stop.
+     */
+    inline void set_stop_flag(const std::atomic<bool> *flag) { stop_flag = flag; }
+
+    /**
+     * Trace the samples [first, last) of the active pixels of the tile.
+     * Meant to run on a worker of the scheduler, whose sampler it uses.
+     *
+     * @param tile The tile.
+     * @param first First sample.
+     * @param last End of the samples.
+     */
+    void render_tile(const Tile &tile, int first, int last);
+
+    /**
+     * Trace the samples [first, last) of the active pixels of the frame,
+     * and wait for all the tiles.
+     *
+     * @param scheduler The scheduler, with the amount of workers given to the constructor.
+     * @param tiles The tiles of the frame.
+     * @param first First sample.
+     * @param last End of the samples.
+     * @param progress Called after every tile with the samples traced so far, one call at a time.
+     */
+    void render_pass(TaskScheduler &scheduler, const std::vector<Tile> &tiles, int first, int last,
+                     const std::function<void(std::uint64_t)> &progress = nullptr);
+
+    /**
+     * Collect the counters of the tiles rendered so far.
+     *
+     * @return The renderer counters.
+     */
+    RenderStats stats() const;
+
+};
+
+
+TileRenderer::TileRenderer(const Hitable &world, Camera &camera, const Integrator &integrator, AccumulationBuffer &accumulation,
+                           const std::string &sampler, int samples_per_pixel, std::uint64_t seed, unsigned int threads)
+    : world(world), camera(camera), integrator(integrator), accumulation(accumulation),
+      size_x(accumulation.width()), size_y(accumulation.height()), samples_count{accumulation.samples()}
+{
+    for (unsigned int i=0; i<std::max(threads, 1u); ++i)
+        samplers.push_back(make_sampler(sampler, samples_per_pixel, seed));
+}
+
+
+void TileRenderer::render_tile(const Tile &tile, int first, int last)
+{
+    auto *sampler = samplers[TaskScheduler::current_worker()].get();
+    active_sampler = sampler;
+    std::uint64_t tile_samples = 0;
+
+    for (int idY=tile.y0; idY<tile.y1; ++idY)
+    {
+        for (int idX=tile.x0; idX<tile.x1; ++idX)
+        {
+            if (!accumulation.is_active(idX, idY) || (stop_flag != nullptr && *stop_flag))
+                continue;
+
+            auto pixel_index = static_cast<std::uint64_t>(idY) * size_x + idX;
+
+            // After an interrupted pass, the pixels may already have some of its samples.
+            auto start = std::max(first, accumulation.variance(idX, idY).count());
+
+            for (int s=start; s<last; ++s)
+            {
+                // Every sample has its own point (and random sequence), so that the
+                // result does not depend on the thread that renders it.
+                sampler->start_pixel_sample(pixel_index, s);
+
+                auto jitter = random_float2();
+                float u = (idX + jitter.first) / static_cast<float>(size_x);
+                float v = (idY + jitter.second) / static_cast<float>(size_y);
+
+                auto r = camera.get_ray(u, v);
+                accumulation.add(idX, idY, integrator.li(r, world));
+            }
+
+            tile_samples += std::max(last - start, 0);
+        }
+    }
+
+    active_sampler = nullptr;
+
+    samples_count += tile_samples;
+
+    rays_count += traversal_stats.rays;
+    node_visits += traversal_stats.node_visits;
+    shadow_rays_count += traversal_stats.shadow_rays;
+    shadow_node_visits += traversal_stats.shadow_node_visits;
+    traversal_stats = TraversalStats();
+}
+
+
+void TileRenderer::render_pass(TaskScheduler &scheduler, const std::vector<Tile> &tiles, int first, int last,
+                               const std::function<void(std::uint64_t)> &progress)
+{
+    TaskGroup render_group;
+
+    for (const auto &tile : tiles)
+        scheduler.submit(render_group, [this, &progress, tile, first, last]()
+        {
+            render_tile(tile, first, last);
+
+            if (progress)
+            {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                progress(samples_count);
+            }
+        });
+
+    scheduler.wait(render_group);
+}
+
+
+RenderStats TileRenderer::stats() const
+{
+    RenderStats s;
+    s.samples = samples_count;
+    s.rays = rays_count;
+    s.node_visits = node_visits;
+    s.shadow_rays = shadow_rays_count;
+    s.shadow_node_visits = shadow_node_visits;
+
+    return s;
+}
+
+
+#endif //RAYTRACING_RENDERER_H
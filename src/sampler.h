@@ -0,0 +1,469 @@
+/**
+ * Samplers.
+ *
+ * Implementations of the Sampler interface of random.h:
+ * - independent: uniform random numbers, as before;
+ * - stratified: every dimension is split in as many strata as samples
+ *   per pixel (and the 2D values in a grid, when the amount of samples
+ *   is a square), with the strata shuffled per pixel and dimension;
+ * - sobol: Owen scrambled Sobol points, padded in 2D (Burley, "Practical
+ *   Hash-based Owen Scrambling"): every pair of dimensions uses the first
+ *   two Sobol dimensions, with its own scrambling and shuffle of the samples;
+ * - halton: Owen scrambled radical inverses, one prime base per dimension.
+ *
+ * The low discrepancy samplers work best with power of two sample counts.
+ */
+
+#ifndef RAYTRACING_SAMPLER_H
+#define RAYTRACING_SAMPLER_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "random.h"
+
+
+/**
+ * Largest float below 1.
+ */
+constexpr float one_minus_epsilon = 0x1.fffffep-1f;
+
+
+/**
+ * Float in [0, 1) from the high bits of a hash.
+ */
+inline float hash_float(std::uint64_t h)
+{
+    return static_cast<float>(h >> 40u) * (1.0f / 16777216.0f);
+}
+
+
+/**
+ * Element of a random permutation of [0, n), without storing it
+ * (Kensler, "Correlated Multi-Jittered Sampling").
+ *
+ * @param i Index of the element.
+ * @param n Size of the permutation.
+ * @param p Seed of the permutation.
+ *
+ * @return The i-th element of the permutation.
+ */
+inline std::uint32_t permutation_element(std::uint32_t i, std::uint32_t n, std::uint32_t p)
+{
+    auto w = n - 1;
+    w |= w >> 1u;
+    w |= w >> 2u;
+    w |= w >> 4u;
+    w |= w >> 8u;
+    w |= w >> 16u;
+
+    do
+    {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16u;
+        i ^= (i & w) >> 4u;
+        i ^= p >> 8u;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23u;
+        i ^= (i & w) >> 1u;
+        i *= 1u | p >> 27u;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11u;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2u;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2u;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5u;
+    } while (i >= n);
+
+    // Most sample counts are powers of two.
+    return (n & w) == 0u ? (i + p) & w : (i + p) % n;
+}
+
+
+inline std::uint32_t reverse_bits(std::uint32_t x)
+{
+    x = (x << 16u) | (x >> 16u);
+    x = ((x & 0x00ff00ffu) << 8u) | ((x & 0xff00ff00u) >> 8u);
+    x = ((x & 0x0f0f0f0fu) << 4u) | ((x & 0xf0f0f0f0u) >> 4u);
+    x = ((x & 0x33333333u) << 2u) | ((x & 0xccccccccu) >> 2u);
+    x = ((x & 0x55555555u) << 1u) | ((x & 0xaaaaaaaau) >> 1u);
+
+    return x;
+}
+
+
+/**
+ * Hash where every bit only depends on the bits below it (Laine and
+ * Karras, improved by Burley), so the bit reversal of an Owen scrambling.
+ *
+ * @param x The value to permute.
+ * @param seed Seed of the permutation.
+ *
+ * @return The permuted value.
+ */
+inline std::uint32_t laine_karras_permutation(std::uint32_t x, std::uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+
+    return x;
+}
+
+
+/**
+ * Owen scrambling of the bits of a 32 bit fraction: every bit is flipped
+ * depending on the bits above it.
+ *
+ * @param x The value to scramble.
+ * @param seed Seed of the scrambling.
+ *
+ * @return The scrambled value.
+ */
+inline std::uint32_t nested_uniform_scramble(std::uint32_t x, std::uint32_t seed)
+{
+    return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+
+/**
+ * First two dimensions of the Sobol sequence, as 32 bit fractions.
+ *
+ * @param index Index of the point.
+ * @param dimension 0 or 1.
+ *
+ * @return The coordinate.
+ */
+inline std::uint32_t sobol_2d(std::uint32_t index, int dimension)
+{
+    // The first dimension is the van der Corput sequence.
+    if (dimension == 0)
+        return reverse_bits(index);
+
+    // The matrix of the second one is the Pascal matrix modulo 2.
+    std::uint32_t result = 0u;
+
+    for (std::uint32_t v = 1u << 31u; index != 0u; index >>= 1u, v ^= v >> 1u)
+        if (index & 1u)
+            result ^= v;
+
+    return result;
+}
+
+
+/**
+ * Radical inverse of a in the given base, with the digits permuted
+ * depending on the digits before them (Owen scrambling).
+ *
+ * Only the digits that tell the first count points apart are computed:
+ * past them every point is alone in its interval, and the scrambled
+ * digits that follow are a uniform jitter inside it.
+ *
+ * @param base Prime base.
+ * @param a Index of the point.
+ * @param count Amount of points, a is below it.
+ * @param hash Seed of the scrambling.
+ *
+ * @return The scrambled radical inverse, in [0, 1).
+ */
+inline float owen_scrambled_radical_inverse(std::uint32_t base, std::uint64_t a, std::uint64_t count, std::uint64_t hash)
+{
+    auto inv_base = 1.0f / static_cast<float>(base);
+    auto inv_base_m = 1.0f;
+    std::uint64_t reversed = 0u;
+
+    // The digits of count - 1, also the zeros of the smaller indices, if they fit in a float.
+    for (auto digits = count - 1; digits != 0u && 1.0f - static_cast<float>(base - 1) * inv_base_m < 1.0f; digits /= base)
+    {
+        auto next = a / base;
+        auto digit = static_cast<std::uint32_t>(a - next * base);
+        auto digit_hash = static_cast<std::uint32_t>(mix_bits(hash ^ reversed));
+
+        digit = permutation_element(digit, base, digit_hash);
+        reversed = reversed * base + digit;
+        inv_base_m *= inv_base;
+        a = next;
+    }
+
+    auto jitter = hash_float(mix_bits(hash ^ reversed ^ 0x5851f42d4c957f2dULL));
+
+    return std::min(inv_base_m * (static_cast<float>(reversed) + jitter), one_minus_epsilon);
+}
+
+
+/**
+ * Bookkeeping shared by the samplers: the current pixel sample and dimension.
+ */
+class PixelSampler : public Sampler
+{
+
+protected:
+    int samples_per_pixel;
+    std::uint64_t seed;
+
+    std::uint64_t pixel_hash = 0;
+    int sample_index = 0;
+    int dimension = 0;
+
+    /**
+     * Seed of the scrambling of a dimension, in the current pixel.
+     */
+    std::uint64_t dimension_hash(int d) const
+    {
+        return mix_bits(pixel_hash ^ (static_cast<std::uint64_t>(d) * 0x9e3779b97f4a7c15u));
+    }
+
+public:
+    PixelSampler(int samples_per_pixel, std::uint64_t seed)
+        : samples_per_pixel{std::max(samples_per_pixel, 1)}, seed{seed} {}
+
+    void start_pixel_sample(std::uint64_t pixel, int sample) override
+    {
+        pixel_hash = mix_bits(pixel ^ mix_bits(seed));
+        sample_index = sample;
+        dimension = 0;
+
+        // The generator of the thread backs the dimensions the sampler doesn't cover.
+        seed_sample(seed, pixel, static_cast<std::uint64_t>(sample));
+    }
+
+    void skip_to(int d) override { dimension = std::max(dimension, d); }
+
+};
+
+
+class IndependentSampler : public PixelSampler
+{
+
+public:
+    using PixelSampler::PixelSampler;
+
+    float get_1d() override { ++dimension; return rng.next_float(); }
+
+    std::pair<float, float> get_2d() override
+    {
+        dimension += 2;
+
+        auto u = rng.next_float();
+        return {u, rng.next_float()};
+    }
+
+};
+
+
+class StratifiedSampler : public PixelSampler
+{
+
+private:
+    int grid;
+
+public:
+    StratifiedSampler(int samples_per_pixel, std::uint64_t seed) : PixelSampler(samples_per_pixel, seed)
+    {
+        grid = static_cast<int>(std::lround(std::sqrt(static_cast<double>(this->samples_per_pixel))));
+    }
+
+    float get_1d() override
+    {
+        auto hash = dimension_hash(dimension++);
+        auto stratum = permutation_element(static_cast<std::uint32_t>(sample_index),
+                                           static_cast<std::uint32_t>(samples_per_pixel),
+                                           static_cast<std::uint32_t>(hash));
+        auto jitter = hash_float(mix_bits(hash ^ static_cast<std::uint64_t>(sample_index)));
+
+        return std::min((stratum + jitter) / samples_per_pixel, one_minus_epsilon);
+    }
+
+    std::pair<float, float> get_2d() override
+    {
+        // Without a square grid every dimension is stratified on its own (latin hypercube).
+        if (grid * grid != samples_per_pixel)
+        {
+            auto u = get_1d();
+            return {u, get_1d()};
+        }
+
+        auto hash = dimension_hash(dimension);
+        dimension += 2;
+
+        auto stratum = permutation_element(static_cast<std::uint32_t>(sample_index),
+                                           static_cast<std::uint32_t>(samples_per_pixel),
+                                           static_cast<std::uint32_t>(hash));
+        auto jitter = mix_bits(hash ^ static_cast<std::uint64_t>(sample_index));
+
+        auto x = (static_cast<int>(stratum) % grid + hash_float(jitter)) / grid;
+        auto y = (static_cast<int>(stratum) / grid + hash_float(mix_bits(jitter))) / grid;
+
+        return {std::min(x, one_minus_epsilon), std::min(y, one_minus_epsilon)};
+    }
+
+};
+
+
+class SobolSampler : public PixelSampler
+{
+
+private:
+    /**
+     * Bits of the sample indices (the amount of samples, rounded up to a power of two).
+     */
+    int index_bits = 0;
+
+    /**
+     * Scrambled coordinate of the current sample, from the shuffled index.
+     */
+    static float coordinate(std::uint32_t index, int sobol_dimension, std::uint32_t seed)
+    {
+        // The first dimension is already bit reversed.
+        auto x = sobol_dimension == 0 ? reverse_bits(laine_karras_permutation(index, seed))
+                                      : nested_uniform_scramble(sobol_2d(index, 1), seed);
+
+        return std::min(static_cast<float>(x) * 0x1p-32f, one_minus_epsilon);
+    }
+
+    /**
+     * Random permutation of the samples of the pixel, different for every
+     * pair of dimensions so that they are not correlated. The low bits of
+     * permutation_element() depend on few bits of the index, and they give
+     * the first digit of the points: a nested scrambling of the index bits
+     * (that keeps the indices below the power of two) mixes them with the others.
+     */
+    std::uint32_t shuffled_index(std::uint64_t hash) const
+    {
+        auto index = permutation_element(static_cast<std::uint32_t>(sample_index),
+                                         static_cast<std::uint32_t>(samples_per_pixel),
+                                         static_cast<std::uint32_t>(hash));
+
+        if (index_bits == 0)
+            return index;
+
+        auto shift = 32u - static_cast<std::uint32_t>(index_bits);
+
+        return nested_uniform_scramble(index << shift, static_cast<std::uint32_t>(hash >> 32u)) >> shift;
+    }
+
+public:
+    SobolSampler(int samples_per_pixel, std::uint64_t seed) : PixelSampler(samples_per_pixel, seed)
+    {
+        while ((1 << index_bits) < this->samples_per_pixel)
+            ++index_bits;
+    }
+
+    float get_1d() override
+    {
+        auto hash = dimension_hash(dimension++);
+
+        return coordinate(shuffled_index(hash), 0, static_cast<std::uint32_t>(mix_bits(hash)));
+    }
+
+    std::pair<float, float> get_2d() override
+    {
+        auto hash = dimension_hash(dimension);
+        dimension += 2;
+
+        auto index = shuffled_index(hash);
+        auto seeds = mix_bits(hash);
+
+        return {coordinate(index, 0, static_cast<std::uint32_t>(seeds)),
+                coordinate(index, 1, static_cast<std::uint32_t>(seeds >> 32u))};
+    }
+
+};
+
+
+class HaltonSampler : public PixelSampler
+{
+
+private:
+    /**
+     * Bases of the supported dimensions, the others use the generator of the thread.
+     */
+    static const std::vector<std::uint32_t>& primes()
+    {
+        static const std::vector<std::uint32_t> table = []()
+        {
+            std::vector<std::uint32_t> p;
+
+            for (std::uint32_t n=2; p.size()<256; ++n)
+                if (std::none_of(p.begin(), p.end(), [n](std::uint32_t q) { return n % q == 0; }))
+                    p.push_back(n);
+
+            return p;
+        }();
+
+        return table;
+    }
+
+public:
+    using PixelSampler::PixelSampler;
+
+    float get_1d() override
+    {
+        const auto &bases = primes();
+        auto d = dimension++;
+
+        if (d >= static_cast<int>(bases.size()))
+            return rng.next_float();
+
+        return owen_scrambled_radical_inverse(bases[d], static_cast<std::uint64_t>(sample_index),
+                                              static_cast<std::uint64_t>(samples_per_pixel), dimension_hash(d));
+    }
+
+    std::pair<float, float> get_2d() override
+    {
+        auto u = get_1d();
+        return {u, get_1d()};
+    }
+
+};
+
+
+/**
+ * Returns true if a sampler has the given name.
+ *
+ * @param name The name.
+ *
+ * @return True for independent, stratified, sobol and halton.
+ */
+bool is_sampler_name(const std::string &name)
+{
+    return name == "independent" || name == "stratified" || name == "sobol" || name == "halton";
+}
+
+
+/**
+ * Create the sampler with the given name.
+ *
+ * @param name independent, stratified, sobol or halton.
+ * @param samples_per_pixel Amount of samples per pixel.
+ * @param seed Seed of the render.
+ *
+ * @return The sampler, independent if the name is unknown.
+ */
+std::unique_ptr<Sampler> make_sampler(const std::string &name, int samples_per_pixel, std::uint64_t seed)
+{
+    if (name == "stratified")
+        return std::unique_ptr<Sampler>(new StratifiedSampler(samples_per_pixel, seed));
+
+    if (name == "sobol")
+        return std::unique_ptr<Sampler>(new SobolSampler(samples_per_pixel, seed));
+
+    if (name == "halton")
+        return std::unique_ptr<Sampler>(new HaltonSampler(samples_per_pixel, seed));
+
+    return std::unique_ptr<Sampler>(new IndependentSampler(samples_per_pixel, seed));
+}
+
+
+#endif //RAYTRACING_SAMPLER_H
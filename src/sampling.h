@@ -0,0 +1,200 @@
+/**
+ * Sampling routines.
+ *
+ * Closed-form mappings from uniform random numbers to points and
+ * directions. Each routine consumes a fixed amount of random numbers,
+ * given as parameters, so they work with any sampler (and with low
+ * discrepancy sequences), and have no data dependent loops.
+ */
+
+#ifndef RAYTRACING_SAMPLING_H
+#define RAYTRACING_SAMPLING_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "ray.h"
+#include "vec3.h"
+
+
+/**
+ * Map a point of the unit square on the unit disk, keeping the
+ * stratification (Shirley and Chiu's concentric mapping).
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ *
+ * @return Point of the disk, in the xy plane.
+ */
+inline Vec3 sample_concentric_disk(float u1, float u2)
+{
+    auto x = 2.0f * u1 - 1.0f;
+    auto y = 2.0f * u2 - 1.0f;
+
+    if (x == 0.0f && y == 0.0f)
+        return Vec3(0.0f, 0.0f, 0.0f);
+
+    auto quarter_pi = static_cast<float>(M_PI / 4.0);
+    float r, theta;
+
+    if (std::fabs(x) > std::fabs(y))
+    {
+        r = x;
+        theta = quarter_pi * (y / x);
+    }
+    else
+    {
+        r = y;
+        theta = 2.0f * quarter_pi - quarter_pi * (x / y);
+    }
+
+    return Vec3(r * std::cos(theta), r * std::sin(theta), 0.0f);
+}
+
+
+/**
+ * Cosine distributed direction around the z axis (Malley's method).
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ *
+ * @return Unit direction, with density cos(theta) / pi.
+ */
+inline Vec3 sample_cosine_hemisphere(float u1, float u2)
+{
+    auto d = sample_concentric_disk(u1, u2);
+    auto z = std::sqrt(std::max(0.0f, 1.0f - d.x() * d.x() - d.y() * d.y()));
+
+    return Vec3(d.x(), d.y(), z);
+}
+
+
+/**
+ * Density of sample_cosine_hemisphere().
+ *
+ * @param cos_theta Cosine between the direction and the z axis.
+ *
+ * @return The density, in solid angle.
+ */
+inline float cosine_hemisphere_pdf(float cos_theta)
+{
+    return cos_theta > 0.0f ? static_cast<float>(cos_theta / M_PI) : 0.0f;
+}
+
+
+/**
+ * Uniformly distributed direction.
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ *
+ * @return Unit direction, with density 1 / (4 pi).
+ */
+inline Vec3 sample_uniform_sphere(float u1, float u2)
+{
+    auto z = 1.0f - 2.0f * u1;
+    auto r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    auto phi = static_cast<float>(2.0 * M_PI) * u2;
+
+    return Vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+
+/**
+ * Density of sample_uniform_sphere().
+ *
+ * @return The density, in solid angle.
+ */
+inline float uniform_sphere_pdf()
+{
+    return static_cast<float>(1.0 / (4.0 * M_PI));
+}
+
+
+/**
+ * Uniformly distributed point inside the unit ball.
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ * @param u3 Third uniform number in [0, 1), for the radius.
+ *
+ * @return The point.
+ */
+inline Vec3 sample_uniform_ball(float u1, float u2, float u3)
+{
+    return sample_uniform_sphere(u1, u2) * std::cbrt(u3);
+}
+
+
+/**
+ * Uniformly distributed point of a triangle (square root parametrization).
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ *
+ * @return Barycentric coordinates of the point relative to the second and
+ *         third vertices, with density 1 / area.
+ */
+inline std::pair<float, float> sample_uniform_triangle(float u1, float u2)
+{
+    auto su = std::sqrt(u1);
+
+    return {1.0f - su, u2 * su};
+}
+
+
+/**
+ * Uniformly distributed direction in a cone around the z axis.
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ * @param cos_theta_max Cosine of the half angle of the cone.
+ *
+ * @return Unit direction, with density 1 / (2 pi (1 - cos_theta_max)).
+ */
+inline Vec3 sample_uniform_cone(float u1, float u2, float cos_theta_max)
+{
+    auto z = 1.0f + u2 * (cos_theta_max - 1.0f);
+    auto r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    auto phi = static_cast<float>(2.0 * M_PI) * u1;
+
+    return Vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+
+/**
+ * Direction around the z axis distributed as a normalized Phong lobe.
+ *
+ * @param u1 First uniform number in [0, 1).
+ * @param u2 Second uniform number in [0, 1).
+ * @param exponent Exponent of the lobe, 0 for a cosine-free hemisphere.
+ *
+ * @return Unit direction, with density (exponent + 1) / (2 pi) cos(theta)^exponent.
+ */
+inline Vec3 sample_phong_lobe(float u1, float u2, float exponent)
+{
+    auto z = std::pow(u2, 1.0f / (exponent + 1.0f));
+    auto r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+    auto phi = static_cast<float>(2.0 * M_PI) * u1;
+
+    return Vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+
+/**
+ * Density of sample_phong_lobe().
+ *
+ * @param cos_theta Cosine between the direction and the z axis.
+ * @param exponent Exponent of the lobe.
+ *
+ * @return The density, in solid angle.
+ */
+inline float phong_lobe_pdf(float cos_theta, float exponent)
+{
+    return cos_theta > 0.0f ? (exponent + 1.0f) * static_cast<float>(0.5 / M_PI) * std::pow(cos_theta, exponent) : 0.0f;
+}
+
+
+#endif //RAYTRACING_SAMPLING_H
@@ -0,0 +1,1064 @@
+/**
+ * Scene description.
+ *
+ * Text format of the scenes, one statement per line ('#' starts a
+ * comment), with the named textures and materials defined before use:
+ *
+ *   camera <from x y z> <at x y z> <up x y z> <vfov> [<aperture> <focus distance> [<time0> <time1>]]
+ *
+ *   texture <name> constant <r g b>
+ *   texture <name> checker <even texture> <odd texture>
+ *   texture <name> noise <scale>
+ *   texture <name> image <file, relative to the scene>
+ *
+ *   material <name> lambertian <texture>
+ *   material <name> metal <r g b> <fuzziness>
+ *   material <name> dielectric <refraction index>
+ *   material <name> light <texture>
+ *
+ *   define <name> <object>      named object, only rendered through instances
+ *   <object>                    object of the scene
+ *
+ * An object is a primitive, after any amount of wrappers, applied from
+ * the right to the left:
+ *
+ *   translate <x y z> | rotate_y <degrees> | flip | medium <density> <texture>
+ *
+ *   sphere <center x y z> <radius> <material>
+ *   moving_sphere <center0 x y z> <center1 x y z> <time0> <time1> <radius> <material>
+ *   xy_rect <x0> <x1> <y0> <y1> <z> <material>
+ *   xz_rect <x0> <x1> <z0> <z1> <y> <material>
+ *   yz_rect <y0> <y1> <z0> <z1> <x> <material>
+ *   box <min x y z> <max x y z> <material>
+ *   mesh <OBJ file, relative to the scene> <material>
+ *   instance <defined object>
+ *
+ * The numbers must be finite, and the radii of the spheres positive.
+ *
+ * The file is read with a single call and parsed in a single pass into
+ * scene records: a flat array of 32 bit words, without pointers, where
+ * the names are replaced by indices and the wrappers follow the object
+ * they apply to. The records are then executed to create the objects;
+ * they can also be saved and executed again without parsing the text
+ * (see scenecache.h). The meshes are loaded from their OBJ files when the
+ * records are executed; a mesh added to the scene adds its triangles.
+ */
+
+#ifndef RAYTRACING_SCENE_H
+#define RAYTRACING_SCENE_H
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "box.h"
+#include "camera.h"
+#include "color.h"
+#include "constantmedium.h"
+#include "hitable.h"
+#include "hitablelist.h"
+#include "material.h"
+#include "movingsphere.h"
+#include "objloader.h"
+#include "rect.h"
+#include "sphere.h"
+#include "stb_image.h"
+#include "texture.h"
+#include "trianglemesh.h"
+#include "vec3.h"
+
+
+struct Scene
+{
+    Hitable *world = nullptr;
+    Camera *camera = nullptr;
+};
+
+
+/**
+ * Operations of the scene records. Every record is the operation
+ * followed by its arguments: floats, indices of the textures, materials
+ * and defined objects in their order of definition, and paths (length
+ * then characters, padded to a word).
+ */
+enum class SceneOp : std::uint32_t
+{
+    Camera,             // 14 floats: from, at, up, vfov, aperture, focus distance, time0, time1
+    ConstantTexture,    // r g b
+    CheckerTexture,     // even odd
+    NoiseTexture,       // scale
+    ImageTexture,       // path
+    Lambertian,         // texture
+    Metal,              // r g b fuzziness
+    Dielectric,         // refraction index
+    DiffuseLight,       // texture
+    Sphere,             // center radius material
+    MovingSphere,       // center0 center1 time0 time1 radius material
+    XYRect,             // x0 x1 y0 y1 z material
+    XZRect,             // x0 x1 z0 z1 y material
+    YZRect,             // y0 y1 z0 z1 x material
+    Box,                // min max material
+    Mesh,               // path material
+    Instance,           // object
+    Translate,          // offset, wraps the last object
+    RotateY,            // angle
+    FlipNormals,        //
+    ConstantMedium,     // density texture
+    Add,                // adds the last object to the scene
+    Define,             // makes the last object an instance target
+    Count
+};
+
+
+class SceneParser
+{
+
+private:
+    const char *cursor = nullptr;
+    const char *end = nullptr;
+    int line = 1;
+
+    std::string directory;
+    std::vector<std::uint32_t> *records = nullptr;
+
+    std::unordered_map<std::string, std::uint32_t> textures;
+    std::unordered_map<std::string, std::uint32_t> materials;
+    std::unordered_map<std::string, std::uint32_t> objects;
+    bool has_camera = false;
+
+    std::string error;
+
+    bool fail(const std::string &message);
+
+    std::string_view next_word();
+    bool at_line_end();
+    bool read_float(std::vector<std::uint32_t> &out);
+    bool read_reference(const std::unordered_map<std::string, std::uint32_t> &names, const char *kind,
+                        std::vector<std::uint32_t> &out);
+    bool read_path(std::vector<std::uint32_t> &out);
+
+    /**
+     * Read the arguments of a statement, as described by a layout:
+     * 'f' for a float, 't' a texture, 'm' a material, 'o' a defined object,
+     * 'p' the path of a file.
+     */
+    bool read_arguments(const char *layout, std::vector<std::uint32_t> &out);
+
+    bool parse_camera();
+    bool parse_texture();
+    bool parse_material();
+    bool parse_object();
+
+public:
+    /**
+     * Directory constructor.
+     *
+     * @param directory Directory of the scene, where the image textures are looked for.
+     */
+    explicit SceneParser(std::string directory = std::string()) : directory{std::move(directory)} {}
+
+    /**
+     * Parse a scene description into records.
+     *
+     * @param text The scene description.
+     * @param out_records The records of the scene, replacing its content.
+     *
+     * @return True if the scene was parsed, otherwise last_error() tells why.
+     */
+    bool parse(const std::string &text, std::vector<std::uint32_t> &out_records);
+
+    /**
+     * @return The line and the cause of the parse error.
+     */
+    const std::string& last_error() const { return error; }
+
+};
+
+
+class SceneBuilder
+{
+
+private:
+    float aspect;
+
+    const std::uint32_t *cursor = nullptr;
+    const std::uint32_t *end = nullptr;
+
+    std::vector<Texture*> textures;
+    std::vector<Material*> materials;
+    std::vector<Hitable*> objects;
+    std::vector<Hitable*> stack;
+    std::vector<Hitable*> list;
+    Camera *camera = nullptr;
+
+    std::string error;
+
+    bool fail(const std::string &message);
+
+    float next_float() { float value; std::memcpy(&value, cursor++, sizeof(value)); return value; }
+    Vec3 next_vec3() { auto x = next_float(); auto y = next_float(); return Vec3(x, y, next_float()); }
+    Color next_color() { auto r = next_float(); auto g = next_float(); return Color(r, g, next_float()); }
+
+    template <typename T>
+    bool next_reference(const std::vector<T*> &items, T *&value);
+    bool next_path(std::string &path);
+
+    bool pop(Hitable *&object);
+
+    /**
+     * Pop the object a wrapper applies to: a mesh needs its own BVH then.
+     */
+    bool pop_wrapped(Hitable *&object);
+
+public:
+    /**
+     * Aspect constructor.
+     *
+     * @param aspect Aspect ratio of the camera.
+     */
+    explicit SceneBuilder(float aspect) : aspect{aspect} {}
+
+    /**
+     * Create the objects of the scene. The records are only read, and
+     * can be used in place from a memory-mapped file.
+     *
+     * @param records The records of the scene.
+     * @param count Amount of words of the records.
+     * @param scene The scene, as a HitableList object, and its camera.
+     *
+     * @return True if the scene was built, otherwise last_error() tells why.
+     */
+    bool build(const std::uint32_t *records, std::size_t count, Scene &scene);
+
+    /**
+     * @return The cause of the build error.
+     */
+    const std::string& last_error() const { return error; }
+
+};
+
+
+/**
+ * Layouts of the arguments of the textures, materials and objects, by keyword.
+ */
+struct SceneStatement
+{
+    const char *keyword;
+    SceneOp op;
+    const char *layout;
+};
+
+constexpr SceneStatement scene_textures[] = {
+    {"constant", SceneOp::ConstantTexture, "fff"},
+    {"checker", SceneOp::CheckerTexture, "tt"},
+    {"noise", SceneOp::NoiseTexture, "f"},
+};
+
+constexpr SceneStatement scene_materials[] = {
+    {"lambertian", SceneOp::Lambertian, "t"},
+    {"metal", SceneOp::Metal, "ffff"},
+    {"dielectric", SceneOp::Dielectric, "f"},
+    {"light", SceneOp::DiffuseLight, "t"},
+};
+
+constexpr SceneStatement scene_primitives[] = {
+    {"sphere", SceneOp::Sphere, "ffffm"},
+    {"moving_sphere", SceneOp::MovingSphere, "fffffffffm"},
+    {"xy_rect", SceneOp::XYRect, "fffffm"},
+    {"xz_rect", SceneOp::XZRect, "fffffm"},
+    {"yz_rect", SceneOp::YZRect, "fffffm"},
+    {"box", SceneOp::Box, "ffffffm"},
+    {"mesh", SceneOp::Mesh, "pm"},
+    {"instance", SceneOp::Instance, "o"},
+};
+
+constexpr SceneStatement scene_wrappers[] = {
+    {"translate", SceneOp::Translate, "fff"},
+    {"rotate_y", SceneOp::RotateY, "f"},
+    {"flip", SceneOp::FlipNormals, ""},
+    {"medium", SceneOp::ConstantMedium, "ft"},
+};
+
+
+template <std::size_t Size>
+const SceneStatement* find_statement(const SceneStatement (&statements)[Size], std::string_view keyword)
+{
+    for (const auto &statement : statements)
+        if (keyword == statement.keyword)
+            return &statement;
+
+    return nullptr;
+}
+
+
+bool SceneParser::fail(const std::string &message)
+{
+    error = "line " + std::to_string(line) + ": " + message;
+    return false;
+}
+
+
+std::string_view SceneParser::next_word()
+{
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+        ++cursor;
+
+    // A comment lasts up to the end of the line.
+    if (cursor < end && *cursor == '#')
+        while (cursor < end && *cursor != '\n')
+            ++cursor;
+
+    auto start = cursor;
+
+    while (cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n' && *cursor != '#')
+        ++cursor;
+
+    return std::string_view(start, static_cast<std::size_t>(cursor - start));
+}
+
+
+bool SceneParser::at_line_end()
+{
+    auto saved = cursor;
+    auto word = next_word();
+    cursor = saved;
+
+    return word.empty();
+}
+
+
+bool SceneParser::read_float(std::vector<std::uint32_t> &out)
+{
+    auto word = next_word();
+
+    if (word.empty())
+        return fail("missing number");
+
+    // The words end at a separator, so strtof cannot read past them.
+    char *parsed;
+    auto value = std::strtof(word.data(), &parsed);
+
+    if (parsed != word.data() + word.size())
+        return fail("not a number: " + std::string(word));
+
+    // NaN, infinities and the values out of the range of float.
+    if (!std::isfinite(value))
+        return fail("not a finite number: " + std::string(word));
+
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    out.push_back(bits);
+
+    return true;
+}
+
+
+bool SceneParser::read_reference(const std::unordered_map<std::string, std::uint32_t> &names, const char *kind,
+                                 std::vector<std::uint32_t> &out)
+{
+    auto word = std::string(next_word());
+
+    if (word.empty())
+        return fail(std::string("missing ") + kind);
+
+    auto found = names.find(word);
+
+    if (found == names.end())
+        return fail(std::string("unknown ") + kind + ": " + word);
+
+    out.push_back(found->second);
+    return true;
+}
+
+
+bool SceneParser::read_path(std::vector<std::uint32_t> &out)
+{
+    auto filename = std::string(next_word());
+
+    if (filename.empty())
+        return fail("missing filename");
+
+    // The path is resolved now, so the records do not depend on the directory.
+    auto path = directory.empty() || filename[0] == '/' ? filename : directory + "/" + filename;
+    auto length = static_cast<std::uint32_t>(path.size());
+    auto first = out.size() + 1;
+
+    out.push_back(length);
+    out.resize(first + (length + 3) / 4, 0);
+    std::memcpy(out.data() + first, path.data(), length);
+
+    return true;
+}
+
+
+bool SceneParser::read_arguments(const char *layout, std::vector<std::uint32_t> &out)
+{
+    for (; *layout != '\0'; ++layout)
+    {
+        auto ok = *layout == 'f' ? read_float(out) :
+                  *layout == 't' ? read_reference(textures, "texture", out) :
+                  *layout == 'm' ? read_reference(materials, "material", out) :
+                  *layout == 'p' ? read_path(out) :
+                                   read_reference(objects, "object", out);
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+
+bool SceneParser::parse_camera()
+{
+    records->push_back(static_cast<std::uint32_t>(SceneOp::Camera));
+
+    if (!read_arguments("ffffffffff", *records))
+        return false;
+
+    // Default aperture, focus distance and time interval.
+    const float defaults[4] = {0.0f, 10.0f, 0.0f, 1.0f};
+
+    for (auto i=0; i<4; i+=2)
+    {
+        if (!at_line_end())
+        {
+            if (!read_arguments("ff", *records))
+                return false;
+
+            continue;
+        }
+
+        for (auto j=i; j<4; ++j)
+        {
+            std::uint32_t bits;
+            std::memcpy(&bits, &defaults[j], sizeof(bits));
+            records->push_back(bits);
+        }
+
+        break;
+    }
+
+    has_camera = true;
+    return true;
+}
+
+
+bool SceneParser::parse_texture()
+{
+    auto name = std::string(next_word());
+    auto type = next_word();
+
+    if (name.empty() || type.empty())
+        return fail("expected: texture <name> <type> ...");
+
+    if (type == "image")
+    {
+        records->push_back(static_cast<std::uint32_t>(SceneOp::ImageTexture));
+
+        if (!read_path(*records))
+            return false;
+    }
+    else
+    {
+        auto statement = find_statement(scene_textures, type);
+
+        if (statement == nullptr)
+            return fail("unknown texture type: " + std::string(type));
+
+        records->push_back(static_cast<std::uint32_t>(statement->op));
+
+        if (!read_arguments(statement->layout, *records))
+            return false;
+    }
+
+    auto index = static_cast<std::uint32_t>(textures.size());
+    textures[name] = index;
+
+    return true;
+}
+
+
+bool SceneParser::parse_material()
+{
+    auto name = std::string(next_word());
+    auto type = next_word();
+
+    if (name.empty() || type.empty())
+        return fail("expected: material <name> <type> ...");
+
+    auto statement = find_statement(scene_materials, type);
+
+    if (statement == nullptr)
+        return fail("unknown material type: " + std::string(type));
+
+    records->push_back(static_cast<std::uint32_t>(statement->op));
+
+    if (!read_arguments(statement->layout, *records))
+        return false;
+
+    auto index = static_cast<std::uint32_t>(materials.size());
+    materials[name] = index;
+
+    return true;
+}
+
+
+bool SceneParser::parse_object()
+{
+    auto type = next_word();
+
+    if (type.empty())
+        return fail("missing object");
+
+    // The wrappers apply to the object on their right: they are written after it.
+    if (auto wrapper = find_statement(scene_wrappers, type))
+    {
+        std::vector<std::uint32_t> arguments;
+
+        if (!read_arguments(wrapper->layout, arguments) || !parse_object())
+            return false;
+
+        records->push_back(static_cast<std::uint32_t>(wrapper->op));
+        records->insert(records->end(), arguments.begin(), arguments.end());
+
+        return true;
+    }
+
+    auto primitive = find_statement(scene_primitives, type);
+
+    if (primitive == nullptr)
+        return fail("unknown statement: " + std::string(type));
+
+    records->push_back(static_cast<std::uint32_t>(primitive->op));
+
+    auto first = records->size();
+
+    if (!read_arguments(primitive->layout, *records))
+        return false;
+
+    // The radius is the last number of the spheres, before their material.
+    if (primitive->op == SceneOp::Sphere || primitive->op == SceneOp::MovingSphere)
+    {
+        float radius;
+        std::memcpy(&radius, &(*records)[first + std::strlen(primitive->layout) - 2], sizeof(radius));
+
+        if (radius <= 0.0f)
+            return fail("the radius of a sphere must be positive: " + std::to_string(radius));
+    }
+
+    return true;
+}
+
+
+bool SceneParser::parse(const std::string &text, std::vector<std::uint32_t> &out_records)
+{
+    cursor = text.data();
+    end = text.data() + text.size();
+    line = 1;
+    records = &out_records;
+
+    // A parser can be used again: nothing of the previous scene is kept.
+    out_records.clear();
+    textures.clear();
+    materials.clear();
+    objects.clear();
+    has_camera = false;
+    error.clear();
+
+    while (cursor < end)
+    {
+        auto saved = cursor;
+        auto keyword = next_word();
+        auto ok = true;
+
+        if (keyword.empty())
+        {
+            // Empty line, or only a comment.
+        }
+        else if (keyword == "camera")
+        {
+            ok = parse_camera();
+        }
+        else if (keyword == "texture")
+        {
+            ok = parse_texture();
+        }
+        else if (keyword == "material")
+        {
+            ok = parse_material();
+        }
+        else if (keyword == "define")
+        {
+            auto name = std::string(next_word());
+
+            ok = !name.empty() ? parse_object() : fail("missing object name");
+
+            if (ok)
+            {
+                records->push_back(static_cast<std::uint32_t>(SceneOp::Define));
+
+                auto index = static_cast<std::uint32_t>(objects.size());
+                objects[name] = index;
+            }
+        }
+        else
+        {
+            cursor = saved;
+            ok = parse_object();
+
+            if (ok)
+                records->push_back(static_cast<std::uint32_t>(SceneOp::Add));
+        }
+
+        if (!ok)
+            return false;
+
+        if (!at_line_end())
+            return fail("unexpected: " + std::string(next_word()));
+
+        next_word();
+
+        if (cursor < end)
+        {
+            ++cursor;
+            ++line;
+        }
+    }
+
+    if (!has_camera)
+        return fail("the scene has no camera");
+
+    return true;
+}
+
+
+bool SceneBuilder::fail(const std::string &message)
+{
+    error = message;
+    return false;
+}
+
+
+template <typename T>
+bool SceneBuilder::next_reference(const std::vector<T*> &items, T *&value)
+{
+    auto index = *cursor++;
+
+    if (index >= items.size())
+        return fail("reference out of range");
+
+    value = items[index];
+    return true;
+}
+
+
+bool SceneBuilder::next_path(std::string &path)
+{
+    auto length = *cursor++;
+
+    if ((end - cursor) * 4 < static_cast<std::ptrdiff_t>(length))
+        return fail("damaged scene records");
+
+    path.assign(reinterpret_cast<const char*>(cursor), length);
+    cursor += (length + 3) / 4;
+
+    return true;
+}
+
+
+bool SceneBuilder::pop(Hitable *&object)
+{
+    if (stack.empty())
+        return fail("missing object");
+
+    object = stack.back();
+    stack.pop_back();
+
+    return true;
+}
+
+
+bool SceneBuilder::pop_wrapped(Hitable *&object)
+{
+    if (!pop(object))
+        return false;
+
+    if (auto *mesh = dynamic_cast<TriangleMesh*>(object))
+        mesh->build_bvh();
+
+    return true;
+}
+
+
+bool SceneBuilder::build(const std::uint32_t *records, std::size_t count, Scene &scene)
+{
+    // Arguments of every operation, in words; the paths are checked on their own.
+    constexpr std::uint32_t sizes[] = {14, 3, 2, 1, 1, 1, 4, 1, 1, 5, 10, 6, 6, 6, 7, 2, 1, 3, 1, 0, 2, 0, 0};
+    static_assert(sizeof(sizes) / sizeof(sizes[0]) == static_cast<std::size_t>(SceneOp::Count), "scene op sizes");
+
+    cursor = records;
+    end = records + count;
+
+    while (cursor < end)
+    {
+        auto op = static_cast<SceneOp>(*cursor++);
+
+        if (op >= SceneOp::Count || static_cast<std::size_t>(end - cursor) < sizes[static_cast<std::size_t>(op)])
+            return fail("damaged scene records");
+
+        Texture *texture;
+        Material *material;
+        Hitable *object;
+
+        switch (op)
+        {
+            case SceneOp::Camera:
+            {
+                auto lookfrom = next_vec3();
+                auto lookat = next_vec3();
+                auto up = next_vec3();
+                auto vfov = next_float();
+                auto aperture = next_float();
+                auto focus_dist = next_float();
+                auto time0 = next_float();
+                auto time1 = next_float();
+
+                camera = new Camera(lookfrom, lookat, up, vfov, aspect, aperture, focus_dist, time0, time1);
+                break;
+            }
+
+            case SceneOp::ConstantTexture:
+                textures.push_back(new ConstantTexture(next_color()));
+                break;
+
+            case SceneOp::CheckerTexture:
+            {
+                Texture *even, *odd;
+
+                if (!next_reference(textures, even) || !next_reference(textures, odd))
+                    return false;
+
+                textures.push_back(new CheckerTexture(even, odd));
+                break;
+            }
+
+            case SceneOp::NoiseTexture:
+                textures.push_back(new NoiseTexture(next_float()));
+                break;
+
+            case SceneOp::ImageTexture:
+            {
+                std::string path;
+
+                if (!next_path(path))
+                    return false;
+
+                int nx, ny, nn;
+                unsigned char *data = stbi_load(path.c_str(), &nx, &ny, &nn, 3);
+
+                if (data == nullptr)
+                    return fail("cannot load the image " + path);
+
+                textures.push_back(new ImageTexture(data, nx, ny));
+                break;
+            }
+
+            case SceneOp::Lambertian:
+                if (!next_reference(textures, texture))
+                    return false;
+
+                materials.push_back(new Lambertian(texture));
+                break;
+
+            case SceneOp::Metal:
+            {
+                auto albedo = next_color();
+                materials.push_back(new Metal(albedo, next_float()));
+                break;
+            }
+
+            case SceneOp::Dielectric:
+                materials.push_back(new Dielectric(next_float()));
+                break;
+
+            case SceneOp::DiffuseLight:
+                if (!next_reference(textures, texture))
+                    return false;
+
+                materials.push_back(new DiffuseLight(texture));
+                break;
+
+            case SceneOp::Sphere:
+            {
+                auto center = next_vec3();
+                auto radius = next_float();
+
+                if (!next_reference(materials, material))
+                    return false;
+
+                stack.push_back(new Sphere(center, radius, material));
+                break;
+            }
+
+            case SceneOp::MovingSphere:
+            {
+                auto center0 = next_vec3();
+                auto center1 = next_vec3();
+                auto time0 = next_float();
+                auto time1 = next_float();
+                auto radius = next_float();
+
+                if (!next_reference(materials, material))
+                    return false;
+
+                stack.push_back(new MovingSphere(center0, center1, time0, time1, radius, material));
+                break;
+            }
+
+            case SceneOp::XYRect:
+            case SceneOp::XZRect:
+            case SceneOp::YZRect:
+            {
+                auto a0 = next_float();
+                auto a1 = next_float();
+                auto b0 = next_float();
+                auto b1 = next_float();
+                auto k = next_float();
+
+                if (!next_reference(materials, material))
+                    return false;
+
+                if (op == SceneOp::XYRect)
+                    stack.push_back(new XY_Rect(a0, a1, b0, b1, k, material));
+                else if (op == SceneOp::XZRect)
+                    stack.push_back(new XZ_Rect(a0, a1, b0, b1, k, material));
+                else
+                    stack.push_back(new YZ_Rect(a0, a1, b0, b1, k, material));
+                break;
+            }
+
+            case SceneOp::Box:
+            {
+                auto p0 = next_vec3();
+                auto p1 = next_vec3();
+
+                if (!next_reference(materials, material))
+                    return false;
+
+                stack.push_back(new Box(p0, p1, material));
+                break;
+            }
+
+            case SceneOp::Mesh:
+            {
+                std::string path;
+
+                if (!next_path(path))
+                    return false;
+
+                if (cursor == end)
+                    return fail("damaged scene records");
+
+                if (!next_reference(materials, material))
+                    return false;
+
+                TriangleMeshData data;
+                std::string mesh_error;
+
+                if (!load_obj(path, data, mesh_error))
+                    return fail("cannot load the mesh " + mesh_error);
+
+                stack.push_back(new TriangleMesh(std::move(data), material));
+                break;
+            }
+
+            case SceneOp::Instance:
+                if (!next_reference(objects, object))
+                    return false;
+
+                stack.push_back(object);
+                break;
+
+            case SceneOp::Translate:
+            {
+                auto offset = next_vec3();
+
+                if (!pop_wrapped(object))
+                    return false;
+
+                stack.push_back(new Translate(object, offset));
+                break;
+            }
+
+            case SceneOp::RotateY:
+            {
+                auto angle = next_float();
+
+                if (!pop_wrapped(object))
+                    return false;
+
+                stack.push_back(new RotateY(object, angle));
+                break;
+            }
+
+            case SceneOp::FlipNormals:
+                if (!pop_wrapped(object))
+                    return false;
+
+                stack.push_back(new FlipNormals(object));
+                break;
+
+            case SceneOp::ConstantMedium:
+            {
+                auto density = next_float();
+
+                if (!next_reference(textures, texture) || !pop_wrapped(object))
+                    return false;
+
+                stack.push_back(new ConstantMedium(object, density, texture));
+                break;
+            }
+
+            case SceneOp::Add:
+                if (!pop(object))
+                    return false;
+
+                // The triangles of a mesh are primitives of the scene BVH.
+                if (auto *mesh = dynamic_cast<TriangleMesh*>(object))
+                    mesh->append_triangles(list);
+                else
+                    list.push_back(object);
+                break;
+
+            case SceneOp::Define:
+                if (!pop(object))
+                    return false;
+
+                objects.push_back(object);
+                break;
+
+            default:
+                return fail("damaged scene records");
+        }
+    }
+
+    if (camera == nullptr)
+        return fail("the scene has no camera");
+
+    auto **objects_list = new Hitable*[list.size()];
+    std::copy(list.begin(), list.end(), objects_list);
+
+    scene.world = new HitableList(objects_list, list.size());
+    scene.camera = camera;
+
+    return true;
+}
+
+
+/**
+ * Read a whole file with a single call.
+ *
+ * @param filename The file to read.
+ * @param text The content of the file.
+ *
+ * @return True if the file was read.
+ */
+bool read_file(const std::string &filename, std::string &text)
+{
+    std::ifstream in(filename, std::ios::binary);
+
+    if (!in)
+        return false;
+
+    in.seekg(0, std::ios::end);
+    text.resize(static_cast<std::size_t>(in.tellg()));
+    in.seekg(0, std::ios::beg);
+
+    return static_cast<bool>(in.read(&text[0], static_cast<std::streamsize>(text.size())));
+}
+
+
+/**
+ * Parse a scene description file into records.
+ *
+ * @param filename Scene filename.
+ * @param text The content of the file.
+ * @param records The records of the scene.
+ *
+ * @return True if the scene was parsed; otherwise the error is printed.
+ */
+bool parse_scene(const std::string &filename, const std::string &text, std::vector<std::uint32_t> &records)
+{
+    auto slash = filename.find_last_of("/\\");
+    SceneParser parser(slash != std::string::npos ? filename.substr(0, slash) : std::string("."));
+
+    if (!parser.parse(text, records))
+    {
+        std::cerr << "Cannot load the scene " << filename << ", " << parser.last_error() << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Create the objects of the scene from its records.
+ *
+ * @param filename Scene filename, for the error message.
+ * @param records The records of the scene.
+ * @param count Amount of words of the records.
+ * @param aspect Aspect ratio of the camera.
+ * @param scene The built scene.
+ *
+ * @return True if the scene was built; otherwise the error is printed.
+ */
+bool build_scene(const std::string &filename, const std::uint32_t *records, std::size_t count, float aspect, Scene &scene)
+{
+    SceneBuilder builder(aspect);
+
+    if (!builder.build(records, count, scene))
+    {
+        std::cerr << "Cannot load the scene " << filename << ", " << builder.last_error() << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Load a scene description file.
+ *
+ * @param filename Scene filename.
+ * @param aspect Aspect ratio of the camera.
+ * @param scene The loaded scene.
+ *
+ * @return True if the scene was loaded; otherwise the error is printed.
+ */
+bool load_scene(const std::string &filename, float aspect, Scene &scene)
+{
+    std::string text;
+    std::vector<std::uint32_t> records;
+
+    if (!read_file(filename, text))
+    {
+        std::cerr << "Cannot open the scene " << filename << "." << std::endl;
+        return false;
+    }
+
+    return parse_scene(filename, text, records) && build_scene(filename, records.data(), records.size(), aspect, scene);
+}
+
+
+#endif //RAYTRACING_SCENE_H
@@ -0,0 +1,620 @@
+/**
+ * Scene cache.
+ *
+ * Binary snapshot of a loaded scene, written after the scene file is
+ * parsed and its BVH built, and memory-mapped by the next runs:
+ * - a header, with a hash of the scene file and the BVH settings, so a
+ *   cache is only used for the same source and the same tree, and a hash
+ *   of the sections below, so a damaged file is rebuilt instead of being
+ *   traversed;
+ * - the scene records (see scene.h), executed in place from the mapping
+ *   instead of parsing the text;
+ * - the flattened BVH nodes, traversed in place from the mapping instead
+ *   of building the tree, and for every primitive referenced by the
+ *   leaves its index in the scene. The tree is only used for primitives
+ *   with the same bounds, as the files the scene refers to (the meshes)
+ *   may have changed since.
+ *
+ * The objects of the scene are polymorphic and point to their materials,
+ * so they are still created at every load; only the pointer-free parts
+ * are used in place. The sections are aligned to 64 bytes. The file is
+ * written in the layout of the machine, and is only meant as a cache.
+ */
+
+#ifndef RAYTRACING_SCENECACHE_H
+#define RAYTRACING_SCENECACHE_H
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "fileutils.h"
+#include "hitable.h"
+#include "hitablelist.h"
+#include "linearbvh.h"
+#include "nodebuffer.h"
+#include "simd.h"
+#include "widebvh.h"
+
+
+/**
+ * Read only memory mapping of a whole file.
+ */
+class MappedFile
+{
+
+private:
+    const unsigned char *bytes = nullptr;
+    std::size_t length = 0;
+
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Map the given file, unmapping the previous one.
+     *
+     * @param filename The file to map.
+     *
+     * @return True if the file was mapped.
+     */
+    bool open(const std::string &filename);
+
+    /**
+     * Unmap the file.
+     */
+    void close();
+
+    const unsigned char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+};
+
+
+bool MappedFile::open(const std::string &filename)
+{
+    close();
+
+#if defined(_WIN32)
+    file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER file_size;
+
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto *view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+    if (view == nullptr)
+    {
+        close();
+        return false;
+    }
+
+    bytes = static_cast<const unsigned char*>(view);
+    length = static_cast<std::size_t>(file_size.QuadPart);
+#else
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat status;
+
+    if (fstat(fd, &status) != 0 || status.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    auto *view = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (view == MAP_FAILED)
+        return false;
+
+    bytes = static_cast<const unsigned char*>(view);
+    length = static_cast<std::size_t>(status.st_size);
+#endif
+
+    return true;
+}
+
+
+void MappedFile::close()
+{
+#if defined(_WIN32)
+    if (bytes != nullptr)
+        UnmapViewOfFile(bytes);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (bytes != nullptr)
+        munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+
+    bytes = nullptr;
+    length = 0;
+}
+
+
+/**
+ * FNV-1a hash of the given bytes.
+ *
+ * @param data The bytes to hash.
+ * @param size Amount of bytes.
+ *
+ * @return The 64 bit hash.
+ */
+std::uint64_t hash_bytes(const void *data, std::size_t size)
+{
+    const auto *bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (std::size_t i=0; i<size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+
+/**
+ * Hash of the given bytes, 8 at a time: fast enough to check a whole
+ * cache at every load. A change of any single word changes the hash.
+ *
+ * @param data The bytes to hash.
+ * @param size Amount of bytes.
+ *
+ * @return The 64 bit hash.
+ */
+std::uint64_t hash_words(const void *data, std::size_t size)
+{
+    const auto *bytes = static_cast<const unsigned char*>(data);
+    std::uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    std::size_t i = 0;
+
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+    {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+
+    return size > i ? hash ^ hash_bytes(bytes + i, size - i) : hash;
+}
+
+
+/**
+ * What the cache depends on: the scene file and the BVH settings.
+ */
+struct SceneCacheKey
+{
+    std::uint64_t source_hash = 0;
+    std::string bvh_method;
+    int bvh_width = 0;
+    bool motion_keys = false;
+};
+
+
+struct SceneCacheHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t source_hash;
+    char bvh_method[8];
+    std::int32_t bvh_width;
+    std::uint32_t motion_keys;
+
+    /**
+     * Children per node of the saved BVH (2, 4 or 8), 0 when the
+     * BVH is not saved and has to be built.
+     */
+    std::uint32_t bvh_kind;
+    std::uint32_t node_size;
+
+    /**
+     * Hash of the bounds of the primitives of the scene, see hash_primitive_bounds().
+     */
+    std::uint64_t bounds_hash;
+
+    std::uint64_t records_offset;
+    std::uint64_t records_count;
+    std::uint64_t nodes_offset;
+    std::uint64_t nodes_count;
+    std::uint64_t primitives_offset;
+    std::uint64_t primitives_count;
+    std::uint64_t file_size;
+
+    /**
+     * Hash of the records, nodes and primitives sections, see hash_cache_sections().
+     */
+    std::uint64_t sections_hash;
+};
+
+
+constexpr char scene_cache_magic[4] = {'R', 'T', 'S', 'C'};
+constexpr std::uint32_t scene_cache_version = 3;
+constexpr std::uint64_t scene_cache_alignment = 64;
+
+
+/**
+ * Hash of the bounding boxes of the primitives of a scene, in their order.
+ *
+ * @param scene The scene list.
+ *
+ * @return The 64 bit hash.
+ */
+std::uint64_t hash_primitive_bounds(const HitableList &scene)
+{
+    std::uint64_t hash = 0;
+
+    for (std::size_t i=0; i<scene.size(); ++i)
+    {
+        AABB box = AABB::empty();
+        scene.objects()[i]->bounding_box(0.0f, 1.0f, box);
+
+        const float bounds[6] = {box.min().x(), box.min().y(), box.min().z(), box.max().x(), box.max().y(), box.max().z()};
+        hash = (hash ^ hash_bytes(bounds, sizeof(bounds))) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+
+/**
+ * Hash of the sections of a cache.
+ *
+ * @param records The records section.
+ * @param records_size Size of the records, in bytes.
+ * @param nodes The nodes section.
+ * @param nodes_size Size of the nodes, in bytes.
+ * @param primitives The primitives section.
+ * @param primitives_size Size of the primitives, in bytes.
+ *
+ * @return The 64 bit hash.
+ */
+std::uint64_t hash_cache_sections(const void *records, std::uint64_t records_size, const void *nodes, std::uint64_t nodes_size,
+                                  const void *primitives, std::uint64_t primitives_size)
+{
+    auto hash = hash_words(records, records_size);
+    hash = (hash ^ hash_words(nodes, nodes_size)) * 0x100000001b3ull;
+
+    return (hash ^ hash_words(primitives, primitives_size)) * 0x100000001b3ull;
+}
+
+
+/**
+ * Fill the header fields of the cache key.
+ */
+void set_cache_key(SceneCacheHeader &header, const SceneCacheKey &key)
+{
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, scene_cache_magic, sizeof(header.magic));
+    header.version = scene_cache_version;
+    header.source_hash = key.source_hash;
+    std::strncpy(header.bvh_method, key.bvh_method.c_str(), sizeof(header.bvh_method) - 1);
+    header.bvh_width = key.bvh_width;
+    header.motion_keys = key.motion_keys ? 1u : 0u;
+}
+
+
+/**
+ * Name of a temporary file next to the given one, unique to the writer.
+ *
+ * Many jobs may build the cache of the same scene at once, possibly on
+ * other hosts sharing the file system: each one writes its own file, so
+ * that the rename never publishes a file another writer is still filling.
+ */
+std::string unique_temporary_name(const std::string &filename)
+{
+#if defined(_WIN32)
+    auto process = static_cast<unsigned long>(_getpid());
+#else
+    auto process = static_cast<unsigned long>(getpid());
+#endif
+
+    std::random_device device;
+    auto suffix = (static_cast<unsigned long long>(device()) << 32) ^ device();
+
+    char name[64];
+    std::snprintf(name, sizeof(name), ".%lu.%016llx.tmp", process, suffix);
+
+    return filename + name;
+}
+
+
+/**
+ * Write the scene cache, through a temporary file.
+ *
+ * @param filename Cache filename.
+ * @param key Hash of the scene file and BVH settings.
+ * @param records The records of the scene.
+ * @param scene The scene list the BVH was built from.
+ * @param bvh The BVH: a LinearBVH or a WideBVH is saved, the other kinds are built again.
+ *
+ * @return True if the cache was written.
+ */
+bool write_scene_cache(const std::string &filename, const SceneCacheKey &key, const std::vector<std::uint32_t> &records,
+                       const HitableList &scene, const Hitable *bvh)
+{
+    SceneCacheHeader header;
+    set_cache_key(header, key);
+
+    const void *nodes = nullptr;
+    const std::vector<Hitable*> *primitives = nullptr;
+
+    if (auto *binary = dynamic_cast<const LinearBVH*>(bvh))
+    {
+        // The time keys are not saved.
+        if (!binary->has_motion_keys())
+        {
+            header.bvh_kind = 2;
+            header.node_size = sizeof(LinearBVHNode);
+            header.nodes_count = binary->flat_nodes().size();
+            nodes = binary->flat_nodes().data();
+            primitives = &binary->flat_primitives();
+        }
+    }
+    else if (auto *wide4 = dynamic_cast<const WideBVH<4>*>(bvh))
+    {
+        header.bvh_kind = 4;
+        header.node_size = sizeof(WideBVHNode<4>);
+        header.nodes_count = wide4->flat_nodes().size();
+        nodes = wide4->flat_nodes().data();
+        primitives = &wide4->flat_primitives();
+    }
+    else if (auto *wide8 = dynamic_cast<const WideBVH<8>*>(bvh))
+    {
+        header.bvh_kind = 8;
+        header.node_size = sizeof(WideBVHNode<8>);
+        header.nodes_count = wide8->flat_nodes().size();
+        nodes = wide8->flat_nodes().data();
+        primitives = &wide8->flat_primitives();
+    }
+
+    // The leaves reference the primitives by their index in the scene.
+    std::vector<std::uint32_t> indices;
+
+    if (primitives != nullptr)
+    {
+        header.bounds_hash = hash_primitive_bounds(scene);
+
+        std::unordered_map<const Hitable*, std::uint32_t> scene_index;
+        scene_index.reserve(scene.size());
+
+        for (std::size_t i=0; i<scene.size(); ++i)
+            scene_index[scene.objects()[i]] = static_cast<std::uint32_t>(i);
+
+        indices.reserve(primitives->size());
+
+        for (const auto *primitive : *primitives)
+            indices.push_back(scene_index.at(primitive));
+    }
+
+    auto align = [](std::uint64_t offset) { return (offset + scene_cache_alignment - 1) & ~(scene_cache_alignment - 1); };
+
+    header.records_offset = align(sizeof(header));
+    header.records_count = records.size();
+    header.nodes_offset = align(header.records_offset + records.size() * sizeof(std::uint32_t));
+    header.primitives_offset = align(header.nodes_offset + header.nodes_count * header.node_size);
+    header.primitives_count = indices.size();
+    header.file_size = header.primitives_offset + indices.size() * sizeof(std::uint32_t);
+    header.sections_hash = hash_cache_sections(records.data(), records.size() * sizeof(std::uint32_t),
+                                               nodes, header.nodes_count * header.node_size,
+                                               indices.data(), indices.size() * sizeof(std::uint32_t));
+
+    auto temporary = unique_temporary_name(filename);
+
+    {
+        std::ofstream out(temporary, std::ios::binary);
+
+        auto write_section = [&out](std::uint64_t offset, const void *data, std::uint64_t size)
+        {
+            static const char padding[scene_cache_alignment] = {};
+            out.write(padding, static_cast<std::streamsize>(offset - static_cast<std::uint64_t>(out.tellp())));
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        };
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_section(header.records_offset, records.data(), records.size() * sizeof(std::uint32_t));
+        write_section(header.nodes_offset, nodes, header.nodes_count * header.node_size);
+        write_section(header.primitives_offset, indices.data(), indices.size() * sizeof(std::uint32_t));
+
+        if (!out)
+        {
+            std::cerr << "Cannot write the scene cache " << temporary << "." << std::endl;
+            out.close();
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+
+    if (!replace_file(temporary, filename))
+    {
+        std::cerr << "Cannot write the scene cache " << filename << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+
+class SceneCache
+{
+
+private:
+    MappedFile file;
+    const SceneCacheHeader *header = nullptr;
+
+    template <typename Node>
+    NodeBuffer<Node> mapped_nodes() const
+    {
+        return NodeBuffer<Node>(reinterpret_cast<const Node*>(file.data() + header->nodes_offset), header->nodes_count);
+    }
+
+public:
+    /**
+     * Map the cache, if it exists and matches the key.
+     *
+     * @param filename Cache filename.
+     * @param key Hash of the scene file and BVH settings.
+     *
+     * @return True if the cache can be used.
+     */
+    bool open(const std::string &filename, const SceneCacheKey &key);
+
+    /**
+     * Unmap the cache, before it is written again: Windows does not
+     * replace a mapped file. The records and the BVH can't be used after.
+     */
+    void close()
+    {
+        header = nullptr;
+        file.close();
+    }
+
+    /**
+     * @return The records of the scene, in the mapping.
+     */
+    const std::uint32_t* records() const
+    {
+        return reinterpret_cast<const std::uint32_t*>(file.data() + header->records_offset);
+    }
+
+    std::size_t records_count() const { return header->records_count; }
+
+    /**
+     * Returns true if the cache holds the BVH.
+     *
+     * @return True if bvh() can be used.
+     */
+    bool has_bvh() const { return header->bvh_kind != 0; }
+
+    /**
+     * Create the BVH over the objects of the scene, with its nodes in the mapping.
+     * The cache must outlive the BVH.
+     *
+     * @param scene The scene list built from the records of the cache.
+     *
+     * @return The BVH, or nullptr if the primitives don't match the scene,
+     *         such as a mesh edited since the cache was written.
+     */
+    Hitable* bvh(const HitableList &scene) const;
+
+};
+
+
+bool SceneCache::open(const std::string &filename, const SceneCacheKey &key)
+{
+    header = nullptr;
+
+    if (!file.open(filename) || file.size() < sizeof(SceneCacheHeader))
+        return false;
+
+    SceneCacheHeader expected;
+    set_cache_key(expected, key);
+
+    const auto *h = reinterpret_cast<const SceneCacheHeader*>(file.data());
+
+    if (std::memcmp(h->magic, expected.magic, sizeof(h->magic)) != 0 || h->version != expected.version ||
+        h->source_hash != expected.source_hash || std::memcmp(h->bvh_method, expected.bvh_method, sizeof(h->bvh_method)) != 0 ||
+        h->bvh_width != expected.bvh_width || h->motion_keys != expected.motion_keys || h->file_size != file.size())
+        return false;
+
+    // A cache written on a machine with AVX2 cannot be traversed without it.
+    auto node_size = h->bvh_kind == 0 ? 0u :
+                     h->bvh_kind == 2 ? static_cast<std::uint32_t>(sizeof(LinearBVHNode)) :
+                     h->bvh_kind == 4 ? static_cast<std::uint32_t>(sizeof(WideBVHNode<4>)) :
+                     h->bvh_kind == 8 && CPUInfo().is_avx2() ? static_cast<std::uint32_t>(sizeof(WideBVHNode<8>)) : ~0u;
+
+    auto in_file = [h](std::uint64_t offset, std::uint64_t count, std::uint64_t element_size)
+    {
+        return offset % scene_cache_alignment == 0 && offset <= h->file_size &&
+               (element_size == 0 || count <= (h->file_size - offset) / element_size);
+    };
+
+    if (h->node_size != node_size ||
+        !in_file(h->records_offset, h->records_count, sizeof(std::uint32_t)) ||
+        !in_file(h->nodes_offset, h->nodes_count, h->node_size) ||
+        !in_file(h->primitives_offset, h->primitives_count, sizeof(std::uint32_t)))
+        return false;
+
+    // The nodes are traversed without checks: a damaged file is a miss.
+    const auto *data = file.data();
+
+    if (h->sections_hash != hash_cache_sections(data + h->records_offset, h->records_count * sizeof(std::uint32_t),
+                                                data + h->nodes_offset, h->nodes_count * h->node_size,
+                                                data + h->primitives_offset, h->primitives_count * sizeof(std::uint32_t)))
+        return false;
+
+    header = h;
+    return true;
+}
+
+
+Hitable* SceneCache::bvh(const HitableList &scene) const
+{
+    if (header->bounds_hash != hash_primitive_bounds(scene))
+        return nullptr;
+
+    const auto *indices = reinterpret_cast<const std::uint32_t*>(file.data() + header->primitives_offset);
+    std::vector<Hitable*> primitives(header->primitives_count);
+
+    for (std::size_t i=0; i<primitives.size(); ++i)
+    {
+        if (indices[i] >= scene.size())
+            return nullptr;
+
+        primitives[i] = scene.objects()[indices[i]];
+    }
+
+    if (header->bvh_kind == 2)
+        return new LinearBVH(mapped_nodes<LinearBVHNode>(), std::move(primitives));
+
+    if (header->bvh_kind == 4)
+        return new WideBVH<4>(mapped_nodes<WideBVHNode<4>>(), std::move(primitives));
+
+    return new WideBVH<8>(mapped_nodes<WideBVHNode<8>>(), std::move(primitives));
+}
+
+
+#endif //RAYTRACING_SCENECACHE_H
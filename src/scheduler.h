@@ -0,0 +1,362 @@
+/**
+ * Work-stealing task scheduler.
+ *
+ * Every worker owns a deque of tasks: the owner pushes and pops tasks
+ * at the back (LIFO, cache friendly for nested tasks), while idle
+ * workers steal from the front of a randomly chosen victim (FIFO, the
+ * oldest and usually biggest tasks).
+ *
+ * The thread that waits for a group of tasks takes part in the work,
+ * so tasks can submit sub-tasks and wait for them without deadlocks.
+ */
+
+#ifndef RAYTRACING_SCHEDULER_H
+#define RAYTRACING_SCHEDULER_H
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "random.h"
+
+
+/**
+ * Set of tasks that can be waited for.
+ */
+class TaskGroup
+{
+
+    friend class TaskScheduler;
+
+private:
+    std::atomic<int> pending{0};
+
+};
+
+
+/**
+ * Load balance counters of the scheduler.
+ */
+struct SchedulerStats
+{
+    std::uint64_t tasks = 0;
+    std::uint64_t steals = 0;
+    std::uint64_t failed_steals = 0;
+    double idle_ms = 0.0;
+    std::vector<std::uint64_t> tasks_per_worker;
+};
+
+
+class TaskScheduler
+{
+
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup *group;
+    };
+
+    struct alignas(64) Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        PCG32 victim_rng;
+
+        std::atomic<std::uint64_t> executed{0};
+        std::atomic<std::uint64_t> steals{0};
+        std::atomic<std::uint64_t> failed_steals{0};
+        std::atomic<std::uint64_t> idle_ns{0};
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> background_threads;
+
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::atomic<int> queued{0};
+    std::atomic<bool> stop{false};
+
+    static thread_local int worker_id;
+
+    void worker_loop(int id);
+    bool pop(int id, Task &task);
+    bool steal(int id, Task &task);
+    bool find_task(int id, Task &task);
+    void execute(int id, Task &task);
+
+public:
+    /**
+     * Thread count constructor.
+     *
+     * The calling thread counts as worker 0 and works while waiting,
+     * so only threads - 1 background threads are started.
+     *
+     * @param threads Amount of workers. 0 will use all the available cores.
+     */
+    explicit TaskScheduler(unsigned int threads = 0);
+
+    /**
+     * Destructor.
+     *
+     * Will stop and join the background threads.
+     */
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    /**
+     * Submit a new task into the queue of the calling worker.
+     *
+     * @param group Group the task belongs to.
+     * @param function Function to execute.
+     */
+    void submit(TaskGroup &group, std::function<void()> function);
+
+    /**
+     * Execute tasks until all the tasks of the group are completed.
+     *
+     * @param group Group to wait for.
+     */
+    void wait(TaskGroup &group);
+
+    /**
+     * Returns the amount of workers, including the waiting thread.
+     *
+     * @return Amount of workers.
+     */
+    inline unsigned int threads() const { return static_cast<unsigned int>(workers.size()); }
+
+    /**
+     * Returns the index of the worker running on the calling thread, 0 for
+     * the thread that created the scheduler. Used to keep per worker state.
+     *
+     * @return Index of the worker, in [0, threads()).
+     */
+    static int current_worker() { return worker_id; }
+
+    /**
+     * Collect the load balance counters of all the workers.
+     *
+     * @return The scheduler counters.
+     */
+    SchedulerStats stats() const;
+
+};
+
+
+thread_local int TaskScheduler::worker_id = 0;
+
+
+TaskScheduler::TaskScheduler(unsigned int threads)
+{
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (unsigned int i=0; i<threads; ++i)
+    {
+        workers.emplace_back(new Worker());
+        workers.back()->victim_rng.seed(i + 1u);
+    }
+
+    for (unsigned int i=1; i<threads; ++i)
+        background_threads.emplace_back(&TaskScheduler::worker_loop, this, static_cast<int>(i));
+}
+
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stop = true;
+    }
+    wake.notify_all();
+
+    for (auto &t : background_threads)
+        t.join();
+}
+
+
+void TaskScheduler::submit(TaskGroup &group, std::function<void()> function)
+{
+    ++group.pending;
+
+    auto &worker = *workers[worker_id];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back({std::move(function), &group});
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        ++queued;
+    }
+    wake.notify_one();
+
+    // The threads waiting for a group can run the new task.
+    done.notify_all();
+}
+
+
+void TaskScheduler::wait(TaskGroup &group)
+{
+    Task task;
+
+    while (group.pending > 0)
+    {
+        auto idle_start = std::chrono::steady_clock::now();
+
+        if (find_task(worker_id, task))
+        {
+            execute(worker_id, task);
+        }
+        else
+        {
+            // The remaining tasks of the group are running on other workers:
+            // sleep until the last of them completes, or a task is submitted.
+            {
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                done.wait(lock, [this, &group]() { return group.pending == 0 || queued > 0; });
+            }
+
+            auto idle = std::chrono::steady_clock::now() - idle_start;
+            workers[worker_id]->idle_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count();
+        }
+    }
+}
+
+
+SchedulerStats TaskScheduler::stats() const
+{
+    SchedulerStats s;
+
+    for (const auto &w : workers)
+    {
+        s.tasks += w->executed;
+        s.steals += w->steals;
+        s.failed_steals += w->failed_steals;
+        s.idle_ms += w->idle_ns / 1.0e6;
+        s.tasks_per_worker.push_back(w->executed);
+    }
+
+    return s;
+}
+
+
+void TaskScheduler::worker_loop(int id)
+{
+    worker_id = id;
+
+    Task task;
+
+    while (!stop)
+    {
+        auto idle_start = std::chrono::steady_clock::now();
+
+        if (find_task(id, task))
+        {
+            execute(id, task);
+            continue;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this]() { return stop || queued > 0; });
+        }
+
+        auto idle = std::chrono::steady_clock::now() - idle_start;
+        workers[id]->idle_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count();
+    }
+}
+
+
+bool TaskScheduler::pop(int id, Task &task)
+{
+    auto &worker = *workers[id];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+
+    if (worker.tasks.empty())
+        return false;
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+
+    return true;
+}
+
+
+bool TaskScheduler::steal(int id, Task &task)
+{
+    auto &thief = *workers[id];
+    auto n = static_cast<std::uint32_t>(workers.size());
+
+    // Random first victim, then every other worker once.
+    auto first = thief.victim_rng.next_uint() % n;
+
+    for (std::uint32_t i=0; i<n; ++i)
+    {
+        auto victim_id = (first + i) % n;
+        if (victim_id == static_cast<std::uint32_t>(id))
+            continue;
+
+        auto &victim = *workers[victim_id];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            ++thief.steals;
+
+            return true;
+        }
+    }
+
+    ++thief.failed_steals;
+
+    return false;
+}
+
+
+bool TaskScheduler::find_task(int id, Task &task)
+{
+    if (queued == 0)
+        return false;
+
+    if (pop(id, task) || steal(id, task))
+    {
+        --queued;
+        return true;
+    }
+
+    return false;
+}
+
+
+void TaskScheduler::execute(int id, Task &task)
+{
+    task.function();
+    ++workers[id]->executed;
+
+    // Locked, so that a waiting thread cannot miss the notification
+    // between its check of the group and its sleep.
+    if (--task.group->pending == 0)
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        done.notify_all();
+    }
+}
+
+
+#endif //RAYTRACING_SCHEDULER_H
@@ -14,6 +14,17 @@ void cpuid(int info[4], int InfoType) {
 }
 #endif
 
+/**
+ * Functions using AVX2 intrinsics, selected at runtime with CPUInfo,
+ * must be compiled for the AVX2 target even when the rest of the program is not.
+ */
+#if defined(_MSC_VER)
+#define RAYTRACING_TARGET_AVX2
+#else
+#define RAYTRACING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
 struct CPUInfo
 {
 //  Misc.
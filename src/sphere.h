@@ -3,6 +3,9 @@
 
 #include "hitable.h"
 #include "material.h"
+#include "onb.h"
+#include "random.h"
+#include "sampling.h"
 
 
 void get_sphere_uv(const Vec3& p, float& u, float& v)
@@ -28,7 +31,14 @@ public:
     Sphere(Vec3 center, float radius, Material *mat) : center{ center }, radius{ radius }, mat_ptr{ mat } {}
 
     bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
+    void finalize(const Ray &r, HitRecord &rec) const override;
     bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override;
+    Vec3 random(const Vec3 &origin) const override;
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
 
 };
 
@@ -41,36 +51,59 @@ bool Sphere::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
     auto c = dot(oc, oc) - radius * radius;
     auto discriminant = b * b - a * c;
 
-    if (discriminant > 0)
+    if (discriminant <= 0)
+        return false;
+
+    auto root = std::sqrt(discriminant);
+    auto temp = (-b - root) / a;
+
+    if (!(temp < tmax && temp > tmin))
     {
-        auto temp = (-b - std::sqrt(discriminant)) / a;
-
-        if (temp < tmax && temp > tmin)
-        {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
-
-            return true;
-        }
-
-        temp = (-b + std::sqrt(discriminant)) / a;
-
-        if (temp < tmax && temp > tmin)
-        {
-            rec.t = temp;
-            rec.p = r.point_at_parameter(rec.t);
-            get_sphere_uv((rec.p - center) / radius, rec.u, rec.v);
-            rec.normal = (rec.p - center) / radius;
-            rec.mat_ptr = mat_ptr;
-
-            return true;
-        }
+        temp = (-b + root) / a;
+
+        if (!(temp < tmax && temp > tmin))
+            return false;
     }
 
-    return false;
+    // The point, the normal and the uv are computed by finalize(), for the closest hit only.
+    rec.t = temp;
+    rec.object = this;
+    rec.instance = nullptr;
+    rec.deferred = true;
+
+    return true;
+}
+
+
+void Sphere::finalize(const Ray &r, HitRecord &rec) const
+{
+    rec.p = r.point_at_parameter(rec.t);
+    rec.normal = (rec.p - center) / radius;
+    get_sphere_uv(rec.normal, rec.u, rec.v);
+    rec.mat_ptr = mat_ptr;
+}
+
+
+bool Sphere::occluded(const Ray &r, float tmin, float tmax) const
+{
+    auto oc = r.origin() - center;
+    auto a = dot(r.direction(), r.direction());
+    auto b = dot(oc, r.direction());
+    auto c = dot(oc, oc) - radius * radius;
+    auto discriminant = b * b - a * c;
+
+    if (discriminant <= 0)
+        return false;
+
+    auto root = std::sqrt(discriminant);
+    auto temp = (-b - root) / a;
+
+    if (temp < tmax && temp > tmin)
+        return true;
+
+    temp = (-b + root) / a;
+
+    return temp < tmax && temp > tmin;
 }
 
 
@@ -85,4 +118,69 @@ bool Sphere::bounding_box(float t0, float t1, AABB &box) const
 }
 
 
+/*
+ * The lights are sampled uniformly in the cone of directions subtended
+ * by the sphere, seen from the origin.
+ */
+float Sphere::pdf_value(const Vec3 &origin, const Vec3 &direction) const
+{
+    HitRecord rec;
+
+    if (!hit(Ray(origin, direction), 0.001f, FLT_MAX, rec))
+        return 0.0f;
+
+    auto distance_squared = (center - origin).squared_length();
+
+    if (distance_squared <= radius * radius)
+        return 0.0f;
+
+    auto cos_theta_max = std::sqrt(1.0f - radius * radius / distance_squared);
+    auto solid_angle = static_cast<float>(2.0f * M_PI * (1.0f - cos_theta_max));
+
+    return 1.0f / solid_angle;
+}
+
+
+Vec3 Sphere::random(const Vec3 &origin) const
+{
+    auto direction = center - origin;
+    auto distance_squared = direction.squared_length();
+
+    if (distance_squared <= radius * radius)
+        return direction;
+
+    auto cos_theta_max = std::sqrt(1.0f - radius * radius / distance_squared);
+
+    auto u = random_float2();
+    return ONB(direction).local(sample_uniform_cone(u.first, u.second, cos_theta_max));
+}
+
+
+void Sphere::collect_emitters(std::vector<Emitter> &emitters)
+{
+    if (mat_ptr != nullptr && mat_ptr->is_emitter())
+        emitters.push_back({this, this});
+}
+
+
+bool Sphere::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    if (mat_ptr == nullptr || !mat_ptr->is_emitter())
+        return false;
+
+    auto area = static_cast<float>(4.0f * M_PI * radius * radius);
+
+    bounding_box(t0, t1, light.bounds);
+    light.power = mat_ptr->emitted(0.5f, 0.5f, center).luminance() * area * static_cast<float>(M_PI);
+
+    // The normals point everywhere.
+    light.axis = Vec3::Z;
+    light.cos_theta_o = -1.0f;
+    light.cos_theta_e = 0.0f;
+    light.two_sided = false;
+
+    return true;
+}
+
+
 #endif //RAYTRACING_SPHERE_H
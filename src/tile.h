@@ -0,0 +1,56 @@
+/**
+ * Tiles.
+ *
+ * The frame is split into rectangular tiles that are rendered
+ * independently, as tasks of the TaskScheduler.
+ */
+
+#ifndef RAYTRACING_TILE_H
+#define RAYTRACING_TILE_H
+
+
+#include <algorithm>
+#include <vector>
+
+
+struct Tile
+{
+    int index;
+    int x0, y0;
+    int x1, y1;
+};
+
+
+/**
+ * Split the frame into tiles of the given size.
+ * Tiles on the right and top borders are clipped to the frame size.
+ *
+ * @param width Width of the frame.
+ * @param height Height of the frame.
+ * @param tile_width Width of a single tile.
+ * @param tile_height Height of a single tile.
+ *
+ * @return The list of tiles covering the whole frame.
+ */
+std::vector<Tile> make_tiles(int width, int height, int tile_width, int tile_height)
+{
+    std::vector<Tile> tiles;
+
+    tile_width = std::max(tile_width, 1);
+    tile_height = std::max(tile_height, 1);
+
+    for (auto y=0; y<height; y+=tile_height)
+        for (auto x=0; x<width; x+=tile_width)
+        {
+            tiles.push_back({
+                static_cast<int>(tiles.size()),
+                x, y,
+                std::min(x + tile_width, width), std::min(y + tile_height, height)
+            });
+        }
+
+    return tiles;
+}
+
+
+#endif //RAYTRACING_TILE_H
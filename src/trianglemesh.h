@@ -0,0 +1,413 @@
+/**
+ * Triangle mesh.
+ *
+ * Indexed mesh: the positions, normals and texture coordinates are shared
+ * by the triangles, which hold three indices into them. Every triangle
+ * is a primitive of its own, so that the BVH of the scene splits the mesh
+ * like the rest of the geometry, but the triangles are stored in a single
+ * array owned by the mesh instead of being allocated one by one.
+ *
+ * The mesh added to a scene inserts its triangles in the scene list;
+ * used as a single object (under a wrapper), it traverses its own BVH.
+ */
+
+#ifndef RAYTRACING_TRIANGLEMESH_H
+#define RAYTRACING_TRIANGLEMESH_H
+
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bvhbuilder.h"
+#include "hitable.h"
+#include "linearbvh.h"
+#include "material.h"
+#include "random.h"
+#include "rect.h"
+#include "sampling.h"
+
+
+struct MeshUV
+{
+    float u;
+    float v;
+};
+
+
+/**
+ * Geometry of a triangle mesh.
+ */
+struct TriangleMeshData
+{
+    std::vector<Vec3> positions;
+
+    /**
+     * One normal per position, or empty to use the normals of the triangles.
+     */
+    std::vector<Vec3> normals;
+
+    /**
+     * One texture coordinate per position, or empty to use the barycentric coordinates.
+     */
+    std::vector<MeshUV> uvs;
+
+    /**
+     * Three indices of positions per triangle, counterclockwise seen from
+     * the front side.
+     */
+    std::vector<std::uint32_t> indices;
+};
+
+
+class TriangleMesh;
+
+
+class Triangle : public Hitable
+{
+
+private:
+    const TriangleMesh *mesh;
+    std::uint32_t first;
+
+    /**
+     * Möller-Trumbore intersection.
+     *
+     * @param r The ray.
+     * @param tmin Start of the interval.
+     * @param tmax End of the interval.
+     * @param t Output, distance of the hit.
+     * @param b1 Output, barycentric coordinate of the second vertex.
+     * @param b2 Output, barycentric coordinate of the third vertex.
+     *
+     * @return True if the ray hits the triangle in the interval.
+     */
+    inline bool intersect(const Ray &r, float tmin, float tmax, float &t, float &b1, float &b2) const;
+
+    const Vec3& vertex(int i) const;
+
+    /**
+     * @return Normal of the plane of the triangle, of length twice its area.
+     */
+    Vec3 face_normal() const;
+    float area() const;
+
+public:
+    /**
+     * @param mesh The mesh.
+     * @param first Position of the first index of the triangle in the indices of the mesh.
+     */
+    Triangle(const TriangleMesh *mesh, std::uint32_t first) : mesh{mesh}, first{first} {}
+
+    bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
+    void finalize(const Ray &r, HitRecord &rec) const override;
+    bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    float pdf_value(const Vec3 &origin, const Vec3 &direction) const override;
+    Vec3 random(const Vec3 &origin) const override;
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+    bool light_bounds(float t0, float t1, LightBounds &light) const override;
+
+};
+
+
+class TriangleMesh : public Hitable
+{
+
+private:
+    friend class Triangle;
+
+    TriangleMeshData data;
+    Material *material;
+
+    std::vector<Triangle> triangles;
+    AABB bounds;
+    std::unique_ptr<LinearBVH> bvh;
+
+public:
+    /**
+     * Geometry constructor.
+     *
+     * @param data The geometry, with valid indices.
+     * @param material Material of the whole mesh.
+     */
+    TriangleMesh(TriangleMeshData data, Material *material);
+
+    TriangleMesh(const TriangleMesh&) = delete;
+    TriangleMesh& operator=(const TriangleMesh&) = delete;
+
+    std::size_t size() const { return triangles.size(); }
+    const TriangleMeshData& geometry() const { return data; }
+
+    /**
+     * Append the triangles to a list of primitives, such as the scene list.
+     * The mesh must outlive them.
+     *
+     * @param list The list.
+     */
+    void append_triangles(std::vector<Hitable*> &list);
+
+    /**
+     * Build the BVH over the triangles, required to use the mesh as a
+     * single object: hit() and occluded() traverse it.
+     */
+    void build_bvh();
+
+    bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
+    bool bounding_box(float t0, float t1, AABB &box) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    void collect_emitters(std::vector<Emitter> &emitters) override;
+
+};
+
+
+TriangleMesh::TriangleMesh(TriangleMeshData data, Material *material) : data{std::move(data)}, material{material}
+{
+    auto count = static_cast<std::uint32_t>(this->data.indices.size() / 3);
+    triangles.reserve(count);
+
+    for (std::uint32_t i=0; i<count; ++i)
+        triangles.emplace_back(this, 3 * i);
+
+    bounds = AABB::empty();
+
+    for (const auto &triangle : triangles)
+    {
+        AABB box;
+        triangle.bounding_box(0.0f, 1.0f, box);
+        bounds = surrounding_box(bounds, box);
+    }
+}
+
+
+void TriangleMesh::append_triangles(std::vector<Hitable*> &list)
+{
+    list.reserve(list.size() + triangles.size());
+
+    for (auto &triangle : triangles)
+        list.push_back(&triangle);
+}
+
+
+void TriangleMesh::build_bvh()
+{
+    if (bvh || triangles.empty())
+        return;
+
+    std::vector<Hitable*> list;
+    append_triangles(list);
+
+    SAHBuilder builder(list.data(), list.size(), 0.0f, 1.0f);
+    builder.build(nullptr);
+
+    bvh.reset(new LinearBVH(builder.build_nodes(), builder.ordered_primitives()));
+}
+
+
+bool TriangleMesh::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
+{
+    assert(bvh || triangles.empty());
+    return bvh && bvh->hit(r, tmin, tmax, rec);
+}
+
+
+bool TriangleMesh::occluded(const Ray &r, float tmin, float tmax) const
+{
+    assert(bvh || triangles.empty());
+    return bvh && bvh->occluded(r, tmin, tmax);
+}
+
+
+bool TriangleMesh::bounding_box(float t0, float t1, AABB &box) const
+{
+    box = bounds;
+
+    return !triangles.empty();
+}
+
+
+void TriangleMesh::collect_emitters(std::vector<Emitter> &emitters)
+{
+    if (material == nullptr || !material->is_emitter())
+        return;
+
+    for (auto &triangle : triangles)
+        triangle.collect_emitters(emitters);
+}
+
+
+inline const Vec3& Triangle::vertex(int i) const
+{
+    return mesh->data.positions[mesh->data.indices[first + i]];
+}
+
+
+Vec3 Triangle::face_normal() const
+{
+    return cross(vertex(1) - vertex(0), vertex(2) - vertex(0));
+}
+
+
+float Triangle::area() const
+{
+    return 0.5f * face_normal().length();
+}
+
+
+inline bool Triangle::intersect(const Ray &r, float tmin, float tmax, float &t, float &b1, float &b2) const
+{
+    const auto &p0 = vertex(0);
+    auto e1 = vertex(1) - p0;
+    auto e2 = vertex(2) - p0;
+
+    auto pvec = cross(r.direction(), e2);
+    auto det = dot(e1, pvec);
+
+    // The ray is parallel to the plane of the triangle (or the triangle is degenerate).
+    if (det == 0.0f)
+        return false;
+
+    auto inv_det = 1.0f / det;
+    auto tvec = r.origin() - p0;
+
+    // Written to also reject NaN.
+    b1 = dot(tvec, pvec) * inv_det;
+
+    if (!(b1 >= 0.0f && b1 <= 1.0f))
+        return false;
+
+    auto qvec = cross(tvec, e1);
+    b2 = dot(r.direction(), qvec) * inv_det;
+
+    if (!(b2 >= 0.0f && b1 + b2 <= 1.0f))
+        return false;
+
+    t = dot(e2, qvec) * inv_det;
+
+    return t < tmax && t > tmin;
+}
+
+
+bool Triangle::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
+{
+    float t, b1, b2;
+
+    if (!intersect(r, tmin, tmax, t, b1, b2))
+        return false;
+
+    // The barycentric coordinates, interpolated by finalize().
+    rec.t = t;
+    rec.u = b1;
+    rec.v = b2;
+    rec.object = this;
+    rec.instance = nullptr;
+    rec.deferred = true;
+
+    return true;
+}
+
+
+void Triangle::finalize(const Ray &r, HitRecord &rec) const
+{
+    const auto &data = mesh->data;
+    auto i0 = data.indices[first];
+    auto i1 = data.indices[first + 1];
+    auto i2 = data.indices[first + 2];
+
+    auto b1 = rec.u;
+    auto b2 = rec.v;
+    auto b0 = 1.0f - b1 - b2;
+
+    rec.p = r.point_at_parameter(rec.t);
+
+    // Shading normal, unless the mesh has no normals or they cancel out.
+    auto normal = data.normals.empty() ? Vec3::ZERO : b0 * data.normals[i0] + b1 * data.normals[i1] + b2 * data.normals[i2];
+
+    if (normal.squared_length() > 0.0f)
+        rec.normal = unit_vector(normal);
+    else
+        rec.normal = unit_vector(face_normal());
+
+    if (!data.uvs.empty())
+    {
+        rec.u = b0 * data.uvs[i0].u + b1 * data.uvs[i1].u + b2 * data.uvs[i2].u;
+        rec.v = b0 * data.uvs[i0].v + b1 * data.uvs[i1].v + b2 * data.uvs[i2].v;
+    }
+
+    rec.mat_ptr = mesh->material;
+}
+
+
+bool Triangle::occluded(const Ray &r, float tmin, float tmax) const
+{
+    float t, b1, b2;
+
+    return intersect(r, tmin, tmax, t, b1, b2);
+}
+
+
+bool Triangle::bounding_box(float t0, float t1, AABB &box) const
+{
+    const auto &p0 = vertex(0);
+    const auto &p1 = vertex(1);
+    const auto &p2 = vertex(2);
+
+    // Padded, as the triangles in an axis aligned plane have flat boxes.
+    auto pad = Vec3(0.0001f, 0.0001f, 0.0001f);
+
+    box = AABB(Vec3(_mm_min_ps(p0.v, _mm_min_ps(p1.v, p2.v))) - pad,
+               Vec3(_mm_max_ps(p0.v, _mm_max_ps(p1.v, p2.v))) + pad);
+
+    return true;
+}
+
+
+float Triangle::pdf_value(const Vec3 &origin, const Vec3 &direction) const
+{
+    float t, b1, b2;
+
+    if (!intersect(Ray(origin, direction), 0.001f, FLT_MAX, t, b1, b2))
+        return 0.0f;
+
+    // The points are sampled on the area of the triangle: the conversion to
+    // solid angle uses the face normal, not the interpolated shading normal.
+    auto normal = face_normal();
+    auto length = normal.length();
+    auto cosine = std::fabs(dot(direction, normal)) / (direction.length() * length);
+
+    if (cosine <= 0.0f)
+        return 0.0f;
+
+    auto distance_squared = t * t * direction.squared_length();
+
+    return distance_squared / (cosine * 0.5f * length);
+}
+
+
+Vec3 Triangle::random(const Vec3 &origin) const
+{
+    auto u = random_float2();
+    auto b = sample_uniform_triangle(u.first, u.second);
+    auto point = (1.0f - b.first - b.second) * vertex(0) + b.first * vertex(1) + b.second * vertex(2);
+
+    return point - origin;
+}
+
+
+void Triangle::collect_emitters(std::vector<Emitter> &emitters)
+{
+    if (mesh->material != nullptr && mesh->material->is_emitter())
+        emitters.push_back({this, this});
+}
+
+
+bool Triangle::light_bounds(float t0, float t1, LightBounds &light) const
+{
+    return rect_light_bounds(*this, mesh->material, area(), unit_vector(face_normal()), light);
+}
+
+
+#endif //RAYTRACING_TRIANGLEMESH_H
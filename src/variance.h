@@ -0,0 +1,88 @@
+/**
+ * Pixel variance.
+ *
+ * Running mean and variance of the luminance of the samples of a pixel
+ * (Welford's algorithm), used by the adaptive sampling to stop tracing a
+ * pixel once the error of its estimate is below a threshold.
+ */
+
+#ifndef RAYTRACING_VARIANCE_H
+#define RAYTRACING_VARIANCE_H
+
+
+#include <algorithm>
+#include <cmath>
+
+
+class PixelVariance
+{
+
+private:
+    int n = 0;
+    double mean_value = 0.0;
+    double m2 = 0.0;
+
+public:
+    PixelVariance() = default;
+
+    /**
+     * State constructor, to restore a saved estimate.
+     *
+     * @param n Amount of samples.
+     * @param mean Mean of the samples.
+     * @param m2 Sum of the squared differences from the mean.
+     */
+    PixelVariance(int n, double mean, double m2) : n{n}, mean_value{mean}, m2{m2} {}
+
+    /**
+     * Add a sample.
+     *
+     * @param x Luminance of the sample.
+     */
+    void add(float x)
+    {
+        ++n;
+
+        auto delta = x - mean_value;
+        mean_value += delta / n;
+        m2 += delta * (x - mean_value);
+    }
+
+    int count() const { return n; }
+
+    float mean() const { return static_cast<float>(mean_value); }
+
+    /**
+     * @return The exact state of the estimate, to save it.
+     */
+    double exact_mean() const { return mean_value; }
+    double squared_differences() const { return m2; }
+
+    /**
+     * @return Unbiased variance of the samples.
+     */
+    float variance() const { return n > 1 ? static_cast<float>(m2 / (n - 1)) : 0.0f; }
+
+    /**
+     * @return Standard error of the mean of the samples.
+     */
+    float standard_error() const { return n > 0 ? std::sqrt(variance() / n) : 0.0f; }
+
+    /**
+     * Standard error of the pixel as displayed, after the gamma correction:
+     * the same error is more visible in the dark pixels.
+     *
+     * @return The error, in [0, 1] display units.
+     */
+    float display_error() const
+    {
+        constexpr auto inv_gamma = 1.0f / 2.2f;
+        auto slope = inv_gamma * std::pow(std::max(mean(), 1e-4f), inv_gamma - 1.0f);
+
+        return slope * standard_error();
+    }
+
+};
+
+
+#endif //RAYTRACING_VARIANCE_H
@@ -0,0 +1,468 @@
+/**
+ * Wide BVH.
+ *
+ * The binary LinearBVH is collapsed into a tree where every node has up
+ * to N children (4 for SSE, 8 for AVX2). The children bounds are stored
+ * in SoA form, so all of them are tested against the ray with one SIMD
+ * slab test.
+ */
+
+#ifndef RAYTRACING_WIDEBVH_H
+#define RAYTRACING_WIDEBVH_H
+
+
+#include <cstdint>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <immintrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+#include "hitable.h"
+#include "linearbvh.h"
+#include "nodebuffer.h"
+#include "simd.h"
+
+
+template <int N>
+struct alignas(32) WideBVHNode
+{
+    /**
+     * Children bounds: min x, y, z then max x, y, z.
+     * Unused slots have an inverted (empty) box, that no ray can hit.
+     */
+    float bounds[6][N];
+
+    /**
+     * Index of the child node for interior children (count == 0),
+     * offset in the primitives array for leaves.
+     */
+    std::uint32_t offset[N];
+    std::uint32_t count[N];
+};
+
+
+/**
+ * SIMD slab test of the N children of a node.
+ */
+template <int N>
+struct WideBVHOps;
+
+
+template <>
+struct WideBVHOps<4>
+{
+    /**
+     * @param node The node with the children to test.
+     * @param origin Origin of the ray.
+     * @param inv_dir Inverse of the direction of the ray.
+     * @param near Index in the bounds of the near plane, per axis.
+     * @param far Index in the bounds of the far plane, per axis.
+     * @param tmin Minimum distance along the ray.
+     * @param tmax Maximum distance along the ray.
+     * @param tnear Output, entry distance of every child.
+     *
+     * @return Bit mask of the children hit by the ray.
+     */
+    static inline int intersect(const WideBVHNode<4> &node, const float origin[3], const float inv_dir[3],
+                                const int near[3], const int far[3], float tmin, float tmax, float tnear[4])
+    {
+        auto t0 = _mm_set1_ps(tmin);
+        auto t1 = _mm_set1_ps(tmax);
+
+        for (auto a=0; a<3; ++a)
+        {
+            auto o = _mm_set1_ps(origin[a]);
+            auto inv = _mm_set1_ps(inv_dir[a]);
+
+            auto tn = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[near[a]]), o), inv);
+            auto tf = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[far[a]]), o), inv);
+
+            // The second operand is returned when the first is NaN (0 * inf).
+            t0 = _mm_max_ps(tn, t0);
+            t1 = _mm_min_ps(tf, t1);
+        }
+
+        _mm_storeu_ps(tnear, t0);
+
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+    }
+};
+
+
+template <>
+struct WideBVHOps<8>
+{
+    RAYTRACING_TARGET_AVX2
+    static inline int intersect(const WideBVHNode<8> &node, const float origin[3], const float inv_dir[3],
+                                const int near[3], const int far[3], float tmin, float tmax, float tnear[8])
+    {
+        auto t0 = _mm256_set1_ps(tmin);
+        auto t1 = _mm256_set1_ps(tmax);
+
+        for (auto a=0; a<3; ++a)
+        {
+            auto o = _mm256_set1_ps(origin[a]);
+            auto inv = _mm256_set1_ps(inv_dir[a]);
+
+            auto tn = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[near[a]]), o), inv);
+            auto tf = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[far[a]]), o), inv);
+
+            t0 = _mm256_max_ps(tn, t0);
+            t1 = _mm256_min_ps(tf, t1);
+        }
+
+        _mm256_storeu_ps(tnear, t0);
+
+        return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+    }
+};
+
+
+template <int N>
+class WideBVH : public Hitable
+{
+
+private:
+    struct StackEntry
+    {
+        std::uint32_t offset;
+        std::uint32_t count;
+        float tnear;
+    };
+
+    /**
+     * The wide tree is never deeper than the binary one
+     * (see BVHBuildOptions::max_sah_depth), and every level pushes at most N - 1 entries.
+     */
+    static constexpr int stack_size = 96 * (N - 1) + 1;
+
+    NodeBuffer<WideBVHNode<N>> nodes;
+    std::vector<Hitable*> primitives;
+    AABB box;
+
+    std::uint32_t collapse(const NodeBuffer<LinearBVHNode> &binary, std::uint32_t index);
+    void set_child(WideBVHNode<N> &node, int slot, const LinearBVHNode &child, std::uint32_t offset, std::uint32_t count);
+    void clear_children(WideBVHNode<N> &node);
+
+    /**
+     * Closest hit traversal, or any hit (occlusion) traversal without a record.
+     */
+    template <bool AnyHit>
+    inline bool traverse(const Ray &r, float tmin, float tmax, HitRecord *rec) const;
+
+public:
+    /**
+     * Collapse the given binary BVH.
+     *
+     * @param binary The binary BVH.
+     */
+    explicit WideBVH(const LinearBVH &binary);
+
+    /**
+     * Use already collapsed nodes, such as the ones of a scene cache.
+     *
+     * @param nodes The nodes, the root is the first one.
+     * @param primitives Primitives, in the order referenced by the leaves.
+     */
+    WideBVH(NodeBuffer<WideBVHNode<N>> nodes, std::vector<Hitable*> primitives);
+
+    bool hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const override;
+    bool bounding_box(float t0, float t1, AABB &b) const override;
+    bool occluded(const Ray &r, float tmin, float tmax) const override;
+
+    /**
+     * Returns the amount of nodes.
+     *
+     * @return Amount of nodes.
+     */
+    std::size_t size() const { return nodes.size(); }
+
+    /**
+     * Returns the collapsed nodes, the root is the first one.
+     *
+     * @return The nodes.
+     */
+    const NodeBuffer<WideBVHNode<N>>& flat_nodes() const { return nodes; }
+
+    /**
+     * Returns the primitives, in the order referenced by the leaves.
+     *
+     * @return The primitives.
+     */
+    const std::vector<Hitable*>& flat_primitives() const { return primitives; }
+
+};
+
+
+template <int N>
+WideBVH<N>::WideBVH(const LinearBVH &binary) : primitives{binary.flat_primitives()}
+{
+    const auto &binary_nodes = binary.flat_nodes();
+
+    if (binary_nodes.empty())
+        return;
+
+    box = binary_nodes[0].box();
+    nodes.reserve(binary_nodes.size() / (N - 1) + 1);
+
+    if (binary_nodes[0].primitives_count > 0)
+    {
+        // A single leaf: the root node has only one child.
+        nodes.emplace_back();
+        clear_children(nodes[0]);
+        set_child(nodes[0], 0, binary_nodes[0], binary_nodes[0].primitives_offset, binary_nodes[0].primitives_count);
+    }
+    else
+    {
+        collapse(binary_nodes, 0);
+    }
+}
+
+
+template <int N>
+WideBVH<N>::WideBVH(NodeBuffer<WideBVHNode<N>> nodes, std::vector<Hitable*> primitives)
+    : nodes{std::move(nodes)}, primitives{std::move(primitives)}
+{
+    if (this->nodes.empty())
+        return;
+
+    // The bounds of the tree are the ones of the children of the root.
+    box = AABB::empty();
+    const auto &root = this->nodes.data()[0];
+
+    for (auto slot=0; slot<N; ++slot)
+    {
+        if (root.bounds[0][slot] > root.bounds[3][slot])
+            continue;
+
+        box = surrounding_box(box, AABB(Vec3(root.bounds[0][slot], root.bounds[1][slot], root.bounds[2][slot]),
+                                        Vec3(root.bounds[3][slot], root.bounds[4][slot], root.bounds[5][slot])));
+    }
+}
+
+
+template <int N>
+void WideBVH<N>::set_child(WideBVHNode<N> &node, int slot, const LinearBVHNode &child, std::uint32_t offset, std::uint32_t count)
+{
+    for (auto a=0; a<3; ++a)
+    {
+        node.bounds[a][slot] = child.bounds_min[a];
+        node.bounds[a + 3][slot] = child.bounds_max[a];
+    }
+
+    node.offset[slot] = offset;
+    node.count[slot] = count;
+}
+
+
+template <int N>
+void WideBVH<N>::clear_children(WideBVHNode<N> &node)
+{
+    for (auto slot=0; slot<N; ++slot)
+    {
+        for (auto a=0; a<3; ++a)
+        {
+            node.bounds[a][slot] = FLT_MAX;
+            node.bounds[a + 3][slot] = -FLT_MAX;
+        }
+
+        node.offset[slot] = 0;
+        node.count[slot] = 0;
+    }
+}
+
+
+template <int N>
+std::uint32_t WideBVH<N>::collapse(const NodeBuffer<LinearBVHNode> &binary, std::uint32_t index)
+{
+    // Open the biggest interior child until there are N children.
+    std::uint32_t children[N];
+    auto children_count = 2;
+
+    children[0] = index + 1;
+    children[1] = binary[index].second_child_offset;
+
+    while (children_count < N)
+    {
+        auto best = -1;
+        auto best_area = -1.0f;
+
+        for (auto i=0; i<children_count; ++i)
+        {
+            const auto &child = binary[children[i]];
+            if (child.primitives_count == 0 && child.box().surface_area() > best_area)
+            {
+                best = i;
+                best_area = child.box().surface_area();
+            }
+        }
+
+        if (best < 0)
+            break;
+
+        auto opened = children[best];
+        children[best] = opened + 1;
+        children[children_count++] = binary[opened].second_child_offset;
+    }
+
+    auto wide_index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    clear_children(nodes[wide_index]);
+
+    for (auto slot=0; slot<children_count; ++slot)
+    {
+        const auto &child = binary[children[slot]];
+
+        if (child.primitives_count > 0)
+        {
+            set_child(nodes[wide_index], slot, child, child.primitives_offset, child.primitives_count);
+        }
+        else
+        {
+            auto child_index = collapse(binary, children[slot]);
+            set_child(nodes[wide_index], slot, child, child_index, 0);
+        }
+    }
+
+    return wide_index;
+}
+
+
+template <int N>
+template <bool AnyHit>
+inline bool WideBVH<N>::traverse(const Ray &r, float tmin, float tmax, HitRecord *rec) const
+{
+    if (nodes.empty())
+        return false;
+
+    float origin[3] = {r.origin().x(), r.origin().y(), r.origin().z()};
+    float inv_dir[3];
+    int near[3];
+    int far[3];
+
+    for (auto a=0; a<3; ++a)
+    {
+        inv_dir[a] = 1.0f / r.direction()[a];
+        near[a] = inv_dir[a] < 0.0f ? a + 3 : a;
+        far[a] = inv_dir[a] < 0.0f ? a : a + 3;
+    }
+
+    auto hit_anything = false;
+    auto closest_so_far = tmax;
+
+    StackEntry stack[stack_size];
+    auto stack_top = 0;
+    const auto *node_data = nodes.data();
+    stack[stack_top++] = {0, 0, tmin};
+
+    while (stack_top > 0)
+    {
+        auto entry = stack[--stack_top];
+
+        if (entry.tnear > closest_so_far)
+            continue;
+
+        if (entry.count > 0)
+        {
+            for (std::uint32_t i=0; i<entry.count; ++i)
+            {
+                const auto *primitive = primitives[entry.offset + i];
+
+                if (AnyHit)
+                {
+                    if (primitive->occluded(r, tmin, closest_so_far))
+                        return true;
+                }
+                else if (primitive->hit(r, tmin, closest_so_far, *rec))
+                {
+                    hit_anything = true;
+                    closest_so_far = rec->t;
+                }
+            }
+
+            continue;
+        }
+
+        const auto &node = node_data[entry.offset];
+        ++traversal_stats.node_visits;
+
+        alignas(32) float tnear[N];
+        auto mask = WideBVHOps<N>::intersect(node, origin, inv_dir, near, far, tmin, closest_so_far, tnear);
+
+        // Push the children from the farthest to the nearest, so the nearest is visited first.
+        auto first = stack_top;
+
+        for (auto slot=0; slot<N; ++slot)
+        {
+            if (!(mask & (1 << slot)))
+                continue;
+
+            StackEntry child = {node.offset[slot], node.count[slot], tnear[slot]};
+
+            // Any hit ends the query, the order doesn't matter.
+            if (AnyHit)
+            {
+                stack[stack_top++] = child;
+                continue;
+            }
+
+            auto j = stack_top++;
+            while (j > first && stack[j - 1].tnear < child.tnear)
+            {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
+
+
+template <int N>
+bool WideBVH<N>::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
+{
+    return traverse<false>(r, tmin, tmax, &rec);
+}
+
+
+template <>
+RAYTRACING_TARGET_AVX2
+bool WideBVH<8>::hit(const Ray &r, float tmin, float tmax, HitRecord &rec) const
+{
+    return traverse<false>(r, tmin, tmax, &rec);
+}
+
+
+template <int N>
+bool WideBVH<N>::occluded(const Ray &r, float tmin, float tmax) const
+{
+    return traverse<true>(r, tmin, tmax, nullptr);
+}
+
+
+template <>
+RAYTRACING_TARGET_AVX2
+bool WideBVH<8>::occluded(const Ray &r, float tmin, float tmax) const
+{
+    return traverse<true>(r, tmin, tmax, nullptr);
+}
+
+
+template <int N>
+bool WideBVH<N>::bounding_box(float t0, float t1, AABB &b) const
+{
+    if (nodes.empty())
+        return false;
+
+    b = box;
+    return true;
+}
+
+
+#endif //RAYTRACING_WIDEBVH_H
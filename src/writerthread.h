@@ -0,0 +1,222 @@
+/**
+ * Image writer thread.
+ *
+ * Encodes and writes the images on a dedicated thread, so that the
+ * snapshots of a progressive render (and the final image) overlap with
+ * the rendering of the next pass.
+ *
+ * The framebuffers are double buffered: the renderer resolves into a
+ * free framebuffer of the pool while the thread writes the previous one,
+ * and gets it back once written. The queue is bounded, so a renderer
+ * faster than the disk waits for a free framebuffer (backpressure)
+ * instead of piling up frames in memory.
+ */
+
+#ifndef RAYTRACING_WRITERTHREAD_H
+#define RAYTRACING_WRITERTHREAD_H
+
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "framebuffer.h"
+#include "image.h"
+
+
+/**
+ * Counters of the writer thread.
+ */
+struct WriterStats
+{
+    std::size_t images = 0;
+    double write_ms = 0.0;
+    double blocked_ms = 0.0;
+};
+
+
+class ImageWriterThread
+{
+
+private:
+    struct Job
+    {
+        std::string filename;
+        Framebuffer framebuffer;
+    };
+
+    int size_x;
+    int size_y;
+    std::size_t capacity;
+
+    std::deque<Job> jobs;
+    std::vector<Framebuffer> free_buffers;
+    std::size_t buffers = 0;
+    bool writing = false;
+    bool stop = false;
+
+    WriterStats counters;
+
+    mutable std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable buffer_ready;
+    std::thread thread;
+
+    void writer_loop();
+
+public:
+    /**
+     * Size constructor.
+     *
+     * @param size_x Width of the images.
+     * @param size_y Height of the images.
+     * @param capacity Amount of framebuffers in flight (queued or being
+     *                 written), at least 1. 2 is double buffering.
+     */
+    ImageWriterThread(int size_x, int size_y, std::size_t capacity = 2);
+
+    /**
+     * Destructor.
+     *
+     * Will write the queued images and join the thread.
+     */
+    ~ImageWriterThread();
+
+    ImageWriterThread(const ImageWriterThread&) = delete;
+    ImageWriterThread& operator=(const ImageWriterThread&) = delete;
+
+    /**
+     * Take a framebuffer to resolve an image into. Blocks while all the
+     * framebuffers are queued or being written.
+     *
+     * @return A framebuffer of the size of the images, with the content
+     *         of an older image.
+     */
+    Framebuffer acquire();
+
+    /**
+     * Queue the framebuffer to be written into the given file.
+     *
+     * @param filename Output image filename.
+     * @param framebuffer Framebuffer taken with acquire().
+     */
+    void submit(const std::string &filename, Framebuffer &&framebuffer);
+
+    /**
+     * Wait until all the queued images are written.
+     */
+    void flush();
+
+    /**
+     * @return Counters of the written images and of the time the renderer
+     *         waited for a framebuffer.
+     */
+    WriterStats stats() const;
+
+};
+
+
+ImageWriterThread::ImageWriterThread(int size_x, int size_y, std::size_t capacity)
+    : size_x{size_x}, size_y{size_y}, capacity{std::max<std::size_t>(capacity, 1)}
+{
+    thread = std::thread(&ImageWriterThread::writer_loop, this);
+}
+
+
+ImageWriterThread::~ImageWriterThread()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    job_ready.notify_one();
+
+    thread.join();
+}
+
+
+Framebuffer ImageWriterThread::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (free_buffers.empty() && buffers < capacity)
+    {
+        ++buffers;
+        return Framebuffer(size_x, size_y);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    buffer_ready.wait(lock, [this]() { return !free_buffers.empty(); });
+    counters.blocked_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    auto framebuffer = std::move(free_buffers.back());
+    free_buffers.pop_back();
+
+    return framebuffer;
+}
+
+
+void ImageWriterThread::submit(const std::string &filename, Framebuffer &&framebuffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back({filename, std::move(framebuffer)});
+    }
+    job_ready.notify_one();
+}
+
+
+void ImageWriterThread::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    buffer_ready.wait(lock, [this]() { return jobs.empty() && !writing; });
+}
+
+
+WriterStats ImageWriterThread::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+
+void ImageWriterThread::writer_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        job_ready.wait(lock, [this]() { return stop || !jobs.empty(); });
+
+        if (jobs.empty())
+            return;
+
+        auto job = std::move(jobs.front());
+        jobs.pop_front();
+        writing = true;
+
+        lock.unlock();
+
+        auto start = std::chrono::high_resolution_clock::now();
+        write_image(job.filename, job.framebuffer);
+        auto write_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        lock.lock();
+
+        writing = false;
+        ++counters.images;
+        counters.write_ms += write_ms;
+        free_buffers.push_back(std::move(job.framebuffer));
+
+        buffer_ready.notify_all();
+    }
+}
+
+
+#endif //RAYTRACING_WRITERTHREAD_H
@@ -0,0 +1,42 @@
+#include "accumulation.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestAccumulation, resolve_averages_the_samples)
+{
+    AccumulationBuffer accumulation(2, 1);
+    Framebuffer framebuffer(2, 1);
+
+    accumulation.add(0, 0, Color(0.25f, 0.5f, 1.0f));
+    accumulation.add(0, 0, Color(0.75f, 0.5f, 0.0f));
+    accumulation.resolve(framebuffer);
+
+    EXPECT_FLOAT_EQ(framebuffer.at(0, 0).r(), 0.5f);
+    EXPECT_FLOAT_EQ(framebuffer.at(0, 0).b(), 0.5f);
+    EXPECT_EQ(accumulation.variance(0, 0).count(), 2);
+
+    // The pixels without samples stay black.
+    EXPECT_EQ(framebuffer.at(1, 0).g(), 0.0f);
+    EXPECT_EQ(accumulation.samples(), 2u);
+}
+
+
+TEST(TestAccumulation, noisy_pixels_keep_their_neighbours_active)
+{
+    AccumulationBuffer accumulation(8, 8);
+
+    for (auto s=0; s<16; ++s)
+    {
+        for (auto y=0; y<8; ++y)
+            for (auto x=0; x<8; ++x)
+                accumulation.add(x, y, Color(0.5f));
+
+        accumulation.add(0, 0, Color(s % 2 ? 0.0f : 1.0f));
+    }
+
+    EXPECT_EQ(accumulation.update_active(0.01f), 4);
+    EXPECT_TRUE(accumulation.is_active(1, 1));
+    EXPECT_FALSE(accumulation.is_active(2, 0));
+
+    EXPECT_EQ(accumulation.update_active(100.0f), 0);
+}
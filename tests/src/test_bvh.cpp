@@ -0,0 +1,268 @@
+#include <limits>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "sphere.h"
+#include "movingsphere.h"
+#include "hitablelist.h"
+#include "bvhbuilder.h"
+#include "lbvhbuilder.h"
+#include "linearbvh.h"
+#include "widebvh.h"
+#include "simd.h"
+#include "box.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestBVH, morton_code_interleaves_bits)
+{
+    EXPECT_EQ(morton_code_30(1u, 0u, 0u), 4u);
+    EXPECT_EQ(morton_code_30(0u, 1u, 0u), 2u);
+    EXPECT_EQ(morton_code_30(0u, 0u, 1u), 1u);
+    EXPECT_EQ(morton_code_30(1023u, 1023u, 1023u), (1u << 30) - 1u);
+
+    EXPECT_EQ(morton_code_63(1u, 1u, 1u), 7u);
+    EXPECT_EQ(morton_code_63(1u << 20, 0u, 0u), 1ull << 62);
+    EXPECT_EQ(morton_code_63((1u << 21) - 1u, (1u << 21) - 1u, (1u << 21) - 1u), (1ull << 63) - 1ull);
+}
+
+
+/**
+ * Builders (0 for SAH, otherwise the bits of the Morton codes) and widths of the BVH.
+ */
+class TestBVH_Builders : public ::testing::TestWithParam<std::tuple<int, int>> {};
+
+INSTANTIATE_TEST_CASE_P(bvh_builders, TestBVH_Builders,
+                        ::testing::Combine(::testing::Values(0, 30, 63), ::testing::Values(2, 4, 8)));
+
+TEST_P(TestBVH_Builders, same_hits_as_the_list)
+{
+    auto morton_bits = std::get<0>(GetParam());
+    auto width = std::get<1>(GetParam());
+
+    // The 8 wide BVH is only traversed with AVX2.
+    if (width == 8 && !CPUInfo().is_avx2())
+        return;
+
+    auto n = 500;
+    auto **objects = new Hitable*[n];
+
+    auto generator = PCG32(7u);
+    for (auto i=0; i<n; ++i)
+    {
+        auto center = Vec3(generator.next_float() * 20.0f - 10.0f,
+                           generator.next_float() * 20.0f - 10.0f,
+                           generator.next_float() * 20.0f - 10.0f);
+        objects[i] = new Sphere(center, generator.next_float() * 0.5f + 0.05f, nullptr);
+    }
+
+    HitableList list(objects, n);
+
+    BVHBuildOptions options;
+    options.morton_bits = morton_bits;
+    options.parallel_threshold = 64;
+
+    TaskScheduler scheduler(2);
+
+    std::vector<BVHBuildNode> nodes;
+    std::vector<BVHPrimitive> primitives;
+
+    if (morton_bits == 0)
+    {
+        SAHBuilder builder(objects, n, 0.0f, 1.0f, options);
+        builder.build(&scheduler);
+        nodes = builder.build_nodes();
+        primitives = builder.ordered_primitives();
+    }
+    else
+    {
+        LBVHBuilder builder(objects, n, 0.0f, 1.0f, options);
+        builder.build(&scheduler);
+        nodes = builder.build_nodes();
+        primitives = builder.ordered_primitives();
+    }
+
+    EXPECT_EQ(primitives.size(), static_cast<std::size_t>(n));
+
+    LinearBVH binary(nodes, primitives);
+    std::unique_ptr<Hitable> wide;
+
+    if (width == 4)
+        wide.reset(new WideBVH<4>(binary));
+    else if (width == 8)
+        wide.reset(new WideBVH<8>(binary));
+
+    const Hitable &bvh = wide ? *wide : static_cast<const Hitable&>(binary);
+
+    for (auto i=0; i<2000; ++i)
+    {
+        auto origin = Vec3(generator.next_float() * 30.0f - 15.0f, generator.next_float() * 30.0f - 15.0f, -20.0f);
+        auto direction = Vec3(generator.next_float() - 0.5f, generator.next_float() - 0.5f, 1.0f);
+        auto r = Ray(origin, direction, 0.0f);
+
+        HitRecord expected, actual;
+        auto expected_hit = list.hit(r, 0.001f, std::numeric_limits<float>::max(), expected);
+        auto actual_hit = bvh.hit(r, 0.001f, std::numeric_limits<float>::max(), actual);
+
+        ASSERT_EQ(expected_hit, actual_hit);
+        if (expected_hit)
+        {
+            EXPECT_FLOAT_EQ(expected.t, actual.t);
+        }
+
+        // Short and long shadow rays.
+        auto tmax = generator.next_float() * 40.0f;
+        ASSERT_EQ(list.occluded(r, 0.001f, tmax), bvh.occluded(r, 0.001f, tmax));
+    }
+}
+
+
+TEST(TestBVH, occluded_matches_hit)
+{
+    auto n = 400;
+    auto **objects = new Hitable*[n];
+
+    auto generator = PCG32(5u);
+    for (auto i=0; i<n; ++i)
+    {
+        auto center = Vec3(generator.next_float() * 20.0f - 10.0f,
+                           generator.next_float() * 20.0f - 10.0f,
+                           generator.next_float() * 20.0f - 10.0f);
+
+        if (i % 4 == 0)
+            objects[i] = new Translate(new RotateY(new Box(Vec3(), Vec3(0.5f, 0.5f, 0.5f), nullptr), 45.0f * generator.next_float()), center);
+        else if (i % 4 == 1)
+            objects[i] = new MovingSphere(center, center + Vec3(1.0f, 0.0f, 0.0f), 0.0f, 1.0f, 0.3f, nullptr);
+        else
+            objects[i] = new Sphere(center, generator.next_float() * 0.5f + 0.05f, nullptr);
+    }
+
+    HitableList list(objects, n);
+
+    SAHBuilder builder(objects, n, 0.0f, 1.0f);
+    builder.build();
+
+    LinearBVH binary(builder.build_nodes(), builder.ordered_primitives());
+    WideBVH<4> wide(binary);
+
+    for (auto i=0; i<2000; ++i)
+    {
+        auto origin = Vec3(generator.next_float() * 30.0f - 15.0f, generator.next_float() * 30.0f - 15.0f, -20.0f);
+        auto direction = Vec3(generator.next_float() - 0.5f, generator.next_float() - 0.5f, 1.0f);
+        auto r = Ray(origin, direction, generator.next_float());
+
+        // Short and long shadow rays.
+        auto tmax = generator.next_float() * 40.0f;
+
+        HitRecord rec;
+        auto expected = list.hit(r, 0.001f, tmax, rec);
+
+        ASSERT_EQ(expected, list.occluded(r, 0.001f, tmax));
+        ASSERT_EQ(expected, binary.occluded(r, 0.001f, tmax));
+        ASSERT_EQ(expected, wide.occluded(r, 0.001f, tmax));
+    }
+}
+
+
+TEST(TestBVH, moving_spheres_refit_and_motion_keys)
+{
+    auto n = 300;
+    auto **objects = new Hitable*[n];
+
+    auto generator = PCG32(11u);
+    for (auto i=0; i<n; ++i)
+    {
+        auto center = Vec3(generator.next_float() * 20.0f - 10.0f,
+                           generator.next_float() * 20.0f - 10.0f,
+                           generator.next_float() * 20.0f - 10.0f);
+        auto motion = Vec3(generator.next_float() * 4.0f - 2.0f, generator.next_float() * 4.0f - 2.0f, 0.0f);
+        objects[i] = new MovingSphere(center, center + motion, 0.0f, 1.0f, generator.next_float() * 0.5f + 0.05f, nullptr);
+    }
+
+    HitableList list(objects, n);
+
+    // Topology built at time 0 only, then fixed by the refit or the keys.
+    SAHBuilder builder(objects, n, 0.0f, 0.0f);
+    builder.build();
+
+    LinearBVH refitted(builder.build_nodes(), builder.ordered_primitives());
+    refitted.refit(0.0f, 1.0f);
+
+    LinearBVH keyed(builder.build_nodes(), builder.ordered_primitives());
+    keyed.set_motion_keys(0.0f, 1.0f);
+    EXPECT_TRUE(keyed.has_motion_keys());
+
+    for (auto i=0; i<2000; ++i)
+    {
+        auto origin = Vec3(generator.next_float() * 30.0f - 15.0f, generator.next_float() * 30.0f - 15.0f, -20.0f);
+        auto direction = Vec3(generator.next_float() - 0.5f, generator.next_float() - 0.5f, 1.0f);
+        auto r = Ray(origin, direction, generator.next_float());
+
+        HitRecord expected, actual_refitted, actual_keyed;
+        auto expected_hit = list.hit(r, 0.001f, std::numeric_limits<float>::max(), expected);
+
+        ASSERT_EQ(expected_hit, refitted.hit(r, 0.001f, std::numeric_limits<float>::max(), actual_refitted));
+        ASSERT_EQ(expected_hit, keyed.hit(r, 0.001f, std::numeric_limits<float>::max(), actual_keyed));
+        ASSERT_EQ(expected_hit, keyed.occluded(r, 0.001f, std::numeric_limits<float>::max()));
+
+        if (expected_hit)
+        {
+            EXPECT_FLOAT_EQ(expected.t, actual_refitted.t);
+            EXPECT_FLOAT_EQ(expected.t, actual_keyed.t);
+        }
+    }
+}
+
+
+TEST(TestBVH, sah_survives_broken_primitives)
+{
+    // A NaN center, a NaN radius and an infinite radius among valid spheres.
+    auto nan = std::numeric_limits<float>::quiet_NaN();
+    auto n = 6;
+    auto **objects = new Hitable*[n];
+    objects[0] = new Sphere(Vec3(nan, 0.0f, -1.0f), 1.0f, nullptr);
+    objects[1] = new Sphere(Vec3(0.0f, 0.0f, -1.0f), nan, nullptr);
+    objects[2] = new Sphere(Vec3(0.0f, 1.0f, -1.0f), std::numeric_limits<float>::infinity(), nullptr);
+    objects[3] = new Sphere(Vec3(0.0f, 0.0f, 0.0f), 1.0f, nullptr);
+    objects[4] = new Sphere(Vec3(2.0f, 0.0f, 0.0f), 1.0f, nullptr);
+    objects[5] = new Sphere(Vec3(4.0f, 0.0f, 0.0f), 1.0f, nullptr);
+
+    for (auto bins : {2, 4, 12})
+    {
+        BVHBuildOptions options;
+        options.bins = bins;
+        options.max_leaf_size = 1;
+
+        SAHBuilder builder(objects, n, 0.0f, 1.0f, options);
+        EXPECT_GE(builder.build(), 0);
+        EXPECT_EQ(builder.ordered_primitives().size(), static_cast<std::size_t>(n));
+    }
+}
+
+
+TEST(TestBVH, lbvh_survives_broken_primitives)
+{
+    // The same primitives, through the quantization of the Morton codes.
+    auto nan = std::numeric_limits<float>::quiet_NaN();
+    auto n = 6;
+    auto **objects = new Hitable*[n];
+    objects[0] = new Sphere(Vec3(nan, 0.0f, -1.0f), 1.0f, nullptr);
+    objects[1] = new Sphere(Vec3(0.0f, 0.0f, -1.0f), nan, nullptr);
+    objects[2] = new Sphere(Vec3(0.0f, 1.0f, -1.0f), std::numeric_limits<float>::infinity(), nullptr);
+    objects[3] = new Sphere(Vec3(0.0f, 0.0f, 0.0f), 1.0f, nullptr);
+    objects[4] = new Sphere(Vec3(2.0f, 0.0f, 0.0f), 1.0f, nullptr);
+    objects[5] = new Sphere(Vec3(4.0f, 0.0f, 0.0f), 1.0f, nullptr);
+
+    for (auto bits : {30, 63})
+    {
+        BVHBuildOptions options;
+        options.morton_bits = bits;
+        options.max_leaf_size = 1;
+
+        LBVHBuilder builder(objects, n, 0.0f, 1.0f, options);
+        EXPECT_GE(builder.build(), 0);
+        EXPECT_EQ(builder.ordered_primitives().size(), static_cast<std::size_t>(n));
+    }
+}
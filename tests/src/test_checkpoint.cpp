@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "checkpoint.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestCheckpoint, round_trip_is_exact)
+{
+    auto g = PCG32(17u);
+    AccumulationBuffer accumulation(5, 3);
+
+    for (auto s=0; s<7; ++s)
+        for (auto y=0; y<3; ++y)
+            for (auto x=0; x<5; ++x)
+                accumulation.add(x, y, Color(g.next_float(), g.next_float() * 3.0f, g.next_float()));
+
+    accumulation.update_active(0.1f);
+
+    CheckpointHeader header;
+    header.width = 5;
+    header.height = 3;
+    header.samples = 64;
+    header.seed = 42u;
+    header.sampler = "sobol";
+    header.scene_hash = 0x1234u;
+    header.settings_hash = 0x5678u;
+    header.next_sample = 7;
+    header.passes = 2;
+
+    auto filename = std::string("test_checkpoint.bin");
+    ASSERT_TRUE(write_checkpoint(filename, header, accumulation));
+
+    CheckpointHeader read_header;
+    AccumulationBuffer restored(5, 3);
+    ASSERT_TRUE(read_checkpoint(filename, read_header, restored));
+
+    EXPECT_TRUE(read_header.matches(header));
+    EXPECT_EQ(read_header.next_sample, 7);
+    EXPECT_EQ(read_header.passes, 2);
+
+    for (auto y=0; y<3; ++y)
+    {
+        for (auto x=0; x<5; ++x)
+        {
+            EXPECT_EQ(restored.sum(x, y).r(), accumulation.sum(x, y).r());
+            EXPECT_EQ(restored.sum(x, y).g(), accumulation.sum(x, y).g());
+            EXPECT_EQ(restored.sum(x, y).b(), accumulation.sum(x, y).b());
+            EXPECT_EQ(restored.variance(x, y).count(), 7);
+            EXPECT_EQ(restored.variance(x, y).exact_mean(), accumulation.variance(x, y).exact_mean());
+            EXPECT_EQ(restored.variance(x, y).squared_differences(), accumulation.variance(x, y).squared_differences());
+            EXPECT_EQ(restored.is_active(x, y), accumulation.is_active(x, y));
+        }
+    }
+
+    // Another seed, scene or integrator, or a damaged file, are rejected.
+    header.seed = 43u;
+    EXPECT_FALSE(read_header.matches(header));
+
+    header.seed = 42u;
+    header.scene_hash = 0x1235u;
+    EXPECT_FALSE(read_header.matches(header));
+
+    header.scene_hash = 0x1234u;
+    header.settings_hash = 0x5679u;
+    EXPECT_FALSE(read_header.matches(header));
+
+    std::ofstream(filename, std::ios::binary) << "RTCK";
+    EXPECT_FALSE(read_checkpoint(filename, read_header, restored));
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(TestCheckpoint, later_checkpoints_replace_the_first)
+{
+    AccumulationBuffer accumulation(4, 2);
+    accumulation.add(1, 1, Color(0.5f, 0.5f, 0.5f));
+
+    CheckpointHeader header;
+    header.width = 4;
+    header.height = 2;
+    header.samples = 16;
+
+    // Every periodic checkpoint goes to the same file.
+    auto filename = std::string("test_checkpoint_replace.bin");
+
+    for (auto pass=1; pass<=3; ++pass)
+    {
+        header.next_sample = pass;
+        ASSERT_TRUE(write_checkpoint(filename, header, accumulation)) << "pass " << pass;
+    }
+
+    CheckpointHeader read_header;
+    AccumulationBuffer restored(4, 2);
+    ASSERT_TRUE(read_checkpoint(filename, read_header, restored));
+    EXPECT_EQ(read_header.next_sample, 3);
+
+    EXPECT_FALSE(std::ifstream(filename + ".tmp").good());
+
+    // A checkpoint that cannot be written is reported, without a temporary left.
+    auto missing = std::string("test_checkpoint_missing_dir/checkpoint.bin");
+    EXPECT_FALSE(write_checkpoint(missing, header, accumulation));
+    EXPECT_FALSE(std::ifstream(missing + ".tmp").good());
+
+    std::remove(filename.c_str());
+}
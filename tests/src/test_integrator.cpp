@@ -0,0 +1,88 @@
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "integrator.h"
+#include "scene.h"
+#include "lightbvh.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+/**
+ * Mean and variance of the luminance of the estimates of an integrator along a ray.
+ */
+struct Estimate
+{
+    double mean = 0.0;
+    double variance = 0.0;
+};
+
+Estimate estimate(const Integrator &integrator, const Hitable &world, const Ray &r, int samples)
+{
+    rng.seed(17u);
+
+    auto sum = 0.0;
+    auto squares = 0.0;
+
+    for (auto i=0; i<samples; ++i)
+    {
+        double l = integrator.li(r, world).luminance();
+        sum += l;
+        squares += l * l;
+    }
+
+    Estimate e;
+    e.mean = sum / samples;
+    e.variance = squares / samples - e.mean * e.mean;
+
+    return e;
+}
+
+
+class TestIntegrator_Glossy : public ::testing::TestWithParam<float> {};
+
+INSTANTIATE_TEST_CASE_P(metal_fuzziness, TestIntegrator_Glossy, ::testing::Values(0.05f, 0.3f, 0.7f));
+
+TEST_P(TestIntegrator_Glossy, nee_agrees_with_path)
+{
+    // A light reflected by a glossy metal floor, seen by the ray below.
+    auto text = std::string("camera 0 1 -6  0 1 0  0 1 0  40\n"
+                            "texture light constant 10 10 10\n"
+                            "material light light light\n"
+                            "material floor metal 0.8 0.8 0.8 " + std::to_string(GetParam()) + "\n"
+                            "xz_rect -10 10 -10 10 0 floor\n"
+                            "flip xz_rect 1.5 2.5 -0.5 0.5 4 light\n");
+
+    std::vector<std::uint32_t> records;
+    ASSERT_TRUE(SceneParser().parse(text, records));
+
+    Scene scene;
+    ASSERT_TRUE(SceneBuilder(1.0f).build(records.data(), records.size(), scene));
+
+    BVHLightSampler lights(scene.world);
+    auto r = Ray(Vec3(-2.0f, 4.0f, 0.0f), Vec3(2.0f, -4.0f, 0.0f));
+    auto samples = 20000;
+
+    auto path = estimate(PathIntegrator(8, 3), *scene.world, r, samples);
+    auto nee = estimate(NEEIntegrator(&lights, 8, 3), *scene.world, r, samples);
+    auto mis = estimate(MISIntegrator(&lights, 8, 3), *scene.world, r, samples);
+
+    ASSERT_GT(path.mean, 0.0);
+
+    // Unbiased: the means agree within the error of the estimates.
+    auto nee_error = std::sqrt((path.variance + nee.variance) / samples);
+    auto mis_error = std::sqrt((path.variance + mis.variance) / samples);
+    EXPECT_NEAR(nee.mean, path.mean, 4.0 * nee_error);
+    EXPECT_NEAR(mis.mean, path.mean, 4.0 * mis_error);
+
+    // On the sharp lobes the light samples alone are noisier than the paths.
+    if (GetParam() < 0.1f)
+    {
+        EXPECT_LE(nee.variance, 1.5 * path.variance);
+    }
+}
@@ -0,0 +1,135 @@
+#include <vector>
+
+#include "sphere.h"
+#include "rect.h"
+#include "hitablelist.h"
+#include "material.h"
+#include "texture.h"
+#include "lightsampler.h"
+#include "lightbvh.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+
+Hitable* many_lights_scene(PCG32 &generator)
+{
+    auto n = 300;
+    auto **list = new Hitable*[n + 3];
+
+    for (auto i=0; i<n; ++i)
+    {
+        auto center = Vec3(generator.next_float() * 40.0f - 20.0f,
+                           generator.next_float() * 10.0f,
+                           generator.next_float() * 40.0f - 20.0f);
+        auto emission = Color(generator.next_float() * 10.0f + 1.0f);
+
+        list[i] = new Sphere(center, generator.next_float() * 0.5f + 0.1f, new DiffuseLight(new ConstantTexture(emission)));
+    }
+
+    auto light = new DiffuseLight(new ConstantTexture(Color(4.0f)));
+
+    list[n] = new XZ_Rect(-5, 5, -5, 5, 20, light);
+    list[n + 1] = new RotateY(new XY_Rect(-2, 2, 0, 4, -25, light), 30.0f);
+    list[n + 2] = new Translate(new FlipNormals(new YZ_Rect(0, 3, 0, 3, 25, light)), Vec3(0, 1, 0));
+
+    return new HitableList(list, n + 3);
+}
+
+
+TEST(TestLightSampler, bvh_sample_matches_pmf)
+{
+    auto generator = PCG32(11u);
+    auto scene = many_lights_scene(generator);
+
+    BVHLightSampler lights(scene);
+
+    ASSERT_EQ(lights.size(), 303u);
+    EXPECT_EQ(lights.nodes_count(), 2 * lights.size() - 1);
+
+    for (auto i=0; i<200; ++i)
+    {
+        auto p = Vec3(generator.next_float() * 60.0f - 30.0f,
+                      generator.next_float() * 30.0f - 5.0f,
+                      generator.next_float() * 60.0f - 30.0f);
+        auto n = i % 2 ? Vec3() : unit_vector(Vec3(generator.next_float() - 0.5f,
+                                                   generator.next_float() - 0.5f,
+                                                   generator.next_float() - 0.5f));
+
+        auto total = 0.0;
+        for (std::size_t light=0; light<lights.size(); ++light)
+            total += lights.pmf(p, n, static_cast<int>(light));
+
+        EXPECT_LE(total, 1.0 + 1e-4);
+
+        // Without the normal nothing is culled.
+        if (n.squared_length() == 0.0f)
+        {
+            EXPECT_NEAR(total, 1.0, 1e-4);
+        }
+
+        for (auto s=0; s<16; ++s)
+        {
+            float pmf;
+            auto light = lights.sample(p, n, generator.next_float(), pmf);
+
+            if (light < 0)
+                continue;
+
+            EXPECT_GT(pmf, 0.0f);
+            EXPECT_NEAR(pmf, lights.pmf(p, n, light), 1e-5f * std::max(pmf, 1.0f));
+        }
+    }
+}
+
+
+TEST(TestLightSampler, bvh_prefers_close_lights)
+{
+    auto **list = new Hitable*[2];
+    auto light = new DiffuseLight(new ConstantTexture(Color(1.0f)));
+
+    list[0] = new Sphere(Vec3(0, 0, 0), 0.5f, light);
+    list[1] = new Sphere(Vec3(100, 0, 0), 0.5f, light);
+
+    auto scene = new HitableList(list, 2);
+
+    BVHLightSampler bvh(scene);
+    UniformLightSampler uniform(scene);
+
+    auto p = Vec3(2, 0, 0);
+
+    EXPECT_GT(bvh.pmf(p, Vec3(), 0), 0.99f);
+    EXPECT_NEAR(bvh.pmf(p, Vec3(), 0) + bvh.pmf(p, Vec3(), 1), 1.0f, 1e-5f);
+    EXPECT_FLOAT_EQ(uniform.pmf(p, Vec3(), 0), 0.5f);
+}
+
+
+TEST(TestLightSampler, instances_are_separate_lights)
+{
+    // One light, placed twice, and the first placement added twice.
+    auto *lamp = new XZ_Rect(-1, 1, -1, 1, 0, new DiffuseLight(new ConstantTexture(Color(4.0f))));
+    auto *left = new Translate(lamp, Vec3(-5, 10, 0));
+    auto *right = new Translate(lamp, Vec3(5, 10, 0));
+    Hitable *list[] = {left, right, left};
+    HitableList scene(list, 3);
+
+    UniformLightSampler lights(&scene);
+    ASSERT_EQ(lights.size(), 2u);
+
+    auto down = Vec3(0.0f, -1.0f, 0.0f);
+    HitRecord rec;
+
+    ASSERT_TRUE(scene.hit(Ray(Vec3(-5.0f, 20.0f, 0.0f), down), 0.001f, 100.0f, rec));
+    auto left_light = lights.find(rec);
+
+    ASSERT_TRUE(scene.hit(Ray(Vec3(5.0f, 20.0f, 0.0f), down), 0.001f, 100.0f, rec));
+    auto right_light = lights.find(rec);
+
+    ASSERT_GE(left_light, 0);
+    ASSERT_GE(right_light, 0);
+    EXPECT_NE(left_light, right_light);
+
+    // The light found is the one whose shape the ray hits.
+    EXPECT_GT(lights.light(left_light).shape->pdf_value(Vec3(-5.0f, 20.0f, 0.0f), down), 0.0f);
+    EXPECT_GT(lights.light(right_light).shape->pdf_value(Vec3(5.0f, 20.0f, 0.0f), down), 0.0f);
+    EXPECT_EQ(lights.light(left_light).shape->pdf_value(Vec3(5.0f, 20.0f, 0.0f), down), 0.0f);
+}
@@ -0,0 +1,173 @@
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "objloader.h"
+#include "trianglemesh.h"
+#include "scene.h"
+#include "hitablelist.h"
+#include "gtest/gtest.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+TEST(TestMesh, reads_obj_faces)
+{
+    // A quad with a texture and a normal per corner, and a triangle with
+    // relative indices that shares two corners of the quad.
+    std::istringstream in(
+            "# quad\n"
+            "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+            "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n"
+            "vn 0 0 1\n"
+            "g quad\nusemtl white\n"
+            "f 1/1/1 2/2/1 3/3/1 4/4/1\n"
+            "f -4/-4/-1 -2/-2/-1 -1/-1/-1\n");
+
+    TriangleMeshData mesh;
+    ObjReader reader;
+    ASSERT_TRUE(reader.read(in, mesh)) << reader.last_error();
+
+    EXPECT_EQ(mesh.indices.size(), 9u);
+    EXPECT_EQ(mesh.positions.size(), 4u);
+    EXPECT_EQ(mesh.normals.size(), 4u);
+    ASSERT_EQ(mesh.uvs.size(), 4u);
+    EXPECT_EQ(mesh.uvs[2].u, 1.0f);
+
+    // The fan of the quad.
+    EXPECT_EQ(mesh.indices[3], 0u);
+    EXPECT_EQ(mesh.indices[4], 2u);
+    EXPECT_EQ(mesh.indices[5], 3u);
+
+    // The normals are dropped when a corner has none.
+    std::istringstream flat("v 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nf 1//1 2//1 3\n");
+    TriangleMeshData flat_mesh;
+    ASSERT_TRUE(ObjReader().read(flat, flat_mesh));
+    EXPECT_TRUE(flat_mesh.normals.empty());
+    EXPECT_TRUE(flat_mesh.uvs.empty());
+}
+
+
+TEST(TestMesh, reports_the_line_of_errors)
+{
+    std::istringstream in("v 0 0 0\nv 1 0 0\n\nf 1 2 3\n");
+
+    TriangleMeshData mesh;
+    ObjReader reader;
+
+    EXPECT_FALSE(reader.read(in, mesh));
+    EXPECT_EQ(reader.last_error(), "line 4: index out of range: 3");
+
+    // Non-finite coordinates never reach the BVH builders.
+    std::istringstream nan_in("v 0 0 0\nv 1 nan 0\n");
+    ObjReader nan_reader;
+    EXPECT_FALSE(nan_reader.read(nan_in, mesh));
+    EXPECT_EQ(nan_reader.last_error(), "line 2: not a finite number: nan");
+
+    std::istringstream inf_in("v 0 0 0\nvn 0 0 1\nvt 1e39 0\n");
+    ObjReader inf_reader;
+    EXPECT_FALSE(inf_reader.read(inf_in, mesh));
+    EXPECT_EQ(inf_reader.last_error(), "line 3: not a finite number: 1e39");
+}
+
+
+TEST(TestMesh, triangles_interpolate_the_vertices)
+{
+    TriangleMeshData data;
+    data.positions = {Vec3(0.0f, 0.0f, 0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f)};
+    data.normals = {Vec3(0.0f, 0.0f, 1.0f), Vec3(1.0f, 0.0f, 1.0f), Vec3(0.0f, 0.0f, 1.0f)};
+    data.uvs = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.0f, 1.0f}};
+    data.indices = {0, 1, 2};
+
+    TriangleMesh mesh(data, nullptr);
+    std::vector<Hitable*> list;
+    mesh.append_triangles(list);
+    ASSERT_EQ(list.size(), 1u);
+
+    auto r = Ray(Vec3(0.25f, 0.5f, 2.0f), Vec3(0.0f, 0.0f, -1.0f));
+    HitRecord rec;
+    ASSERT_TRUE(list[0]->hit(r, 0.001f, 10.0f, rec));
+    finalize_hit(r, rec);
+
+    EXPECT_NEAR(rec.t, 2.0f, 1e-5f);
+    EXPECT_NEAR(rec.u, 0.25f, 1e-5f);
+    EXPECT_NEAR(rec.v, 0.5f, 1e-5f);
+    EXPECT_NEAR(rec.normal.length(), 1.0f, 1e-5f);
+    EXPECT_GT(rec.normal.x(), 0.0f);
+
+    EXPECT_FALSE(list[0]->hit(Ray(Vec3(0.75f, 0.5f, 2.0f), Vec3(0.0f, 0.0f, -1.0f)), 0.001f, 10.0f, rec));
+    EXPECT_FALSE(list[0]->occluded(r, 0.001f, 1.0f));
+    EXPECT_TRUE(list[0]->occluded(r, 0.001f, 3.0f));
+
+    // As a single object, through its own BVH.
+    mesh.build_bvh();
+    EXPECT_TRUE(mesh.hit(r, 0.001f, 10.0f, rec));
+    EXPECT_EQ(rec.object, list[0]);
+}
+
+
+TEST(TestMesh, scene_adds_the_triangles)
+{
+    {
+        std::ofstream out("test_mesh.obj");
+        out << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nf 1 2 3 4\n";
+    }
+
+    auto text = std::string(
+            "camera 0 0 -10  0 0 0  0 1 0  40\n"
+            "texture white constant 0.7 0.7 0.7\n"
+            "material white lambertian white\n"
+            "mesh test_mesh.obj white\n"
+            "translate 5 0 0 mesh test_mesh.obj white\n");
+
+    std::vector<std::uint32_t> records;
+    SceneParser parser(".");
+    ASSERT_TRUE(parser.parse(text, records)) << parser.last_error();
+
+    Scene scene;
+    SceneBuilder builder(1.0f);
+    ASSERT_TRUE(builder.build(records.data(), records.size(), scene)) << builder.last_error();
+
+    // The two triangles of the first mesh, and the translated mesh.
+    auto *list = dynamic_cast<HitableList*>(scene.world);
+    ASSERT_NE(list, nullptr);
+    EXPECT_EQ(list->size(), 3u);
+
+    HitRecord rec;
+    EXPECT_TRUE(scene.world->hit(Ray(Vec3(5.5f, 0.5f, -1.0f), Vec3(0.0f, 0.0f, 1.0f)), 0.001f, 10.0f, rec));
+
+    std::remove("test_mesh.obj");
+
+    Scene missing;
+    EXPECT_FALSE(SceneBuilder(1.0f).build(records.data(), records.size(), missing));
+}
+
+
+TEST(TestMesh, light_pdf_uses_the_face_normal)
+{
+    // Shading normals tilted away from the normal of the face.
+    TriangleMeshData data;
+    data.positions = {Vec3(0.0f, 0.0f, 0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f)};
+    data.normals = {Vec3(1.0f, 0.0f, 1.0f), Vec3(1.0f, 0.0f, 1.0f), Vec3(1.0f, 0.0f, 1.0f)};
+    data.indices = {0, 1, 2};
+
+    TriangleMesh mesh(data, nullptr);
+    std::vector<Hitable*> list;
+    mesh.append_triangles(list);
+
+    auto origin = Vec3(0.2f, 0.2f, 2.0f);
+    auto direction = Vec3(0.25f, 0.25f, 0.0f) - origin;
+
+    // Area 0.5, cosine with the z axis.
+    auto distance_squared = direction.squared_length();
+    auto cosine = 2.0f / direction.length();
+    auto expected = distance_squared / (cosine * 0.5f);
+
+    EXPECT_NEAR(list[0]->pdf_value(origin, direction), expected, expected * 1e-4f);
+    EXPECT_NEAR(list[0]->pdf_value(origin, 3.0f * direction), expected, expected * 1e-4f);
+    EXPECT_EQ(list[0]->pdf_value(origin, Vec3(1.0f, 1.0f, -1.0f)), 0.0f);
+}
@@ -0,0 +1,54 @@
+#include <vector>
+
+#include "random.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestRandom, pcg32_same_seed_same_sequence)
+{
+    auto a = PCG32(42u, 7u);
+    auto b = PCG32(42u, 7u);
+
+    for (auto i=0; i<1000; ++i)
+        EXPECT_EQ(a.next_uint(), b.next_uint());
+}
+
+TEST(TestRandom, pcg32_streams_differ)
+{
+    auto a = PCG32(42u, 1u);
+    auto b = PCG32(42u, 2u);
+
+    auto equal = 0;
+    for (auto i=0; i<1000; ++i)
+        if (a.next_uint() == b.next_uint())
+            ++equal;
+
+    EXPECT_LT(equal, 5);
+}
+
+TEST(TestRandom, pcg32_float_range)
+{
+    auto g = PCG32();
+
+    for (auto i=0; i<100000; ++i)
+    {
+        auto f = g.next_float();
+
+        EXPECT_GE(f, 0.0f);
+        EXPECT_LT(f, 1.0f);
+    }
+}
+
+TEST(TestRandom, seed_sample_reproducible)
+{
+    seed_sample(3u, 100u, 5u);
+    std::vector<float> first{random_float(), random_float(), random_float()};
+
+    seed_sample(3u, 100u, 6u);
+    random_float();
+
+    seed_sample(3u, 100u, 5u);
+    std::vector<float> second{random_float(), random_float(), random_float()};
+
+    EXPECT_EQ(first, second);
+}
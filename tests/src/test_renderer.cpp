@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "renderer.h"
+#include "scene.h"
+#include "lightbvh.h"
+#include "gtest/gtest.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+/**
+ * Render the scene with the given amount of threads and passes of samples.
+ */
+AccumulationBuffer render(const std::string &text, const std::string &sampler, unsigned int threads, int passes)
+{
+    auto width = 24;
+    auto height = 18;
+    auto samples = 8;
+
+    std::vector<std::uint32_t> records;
+    EXPECT_TRUE(SceneParser().parse(text, records));
+
+    Scene scene;
+    EXPECT_TRUE(SceneBuilder(static_cast<float>(width) / height).build(records.data(), records.size(), scene));
+
+    BVHLightSampler lights(scene.world);
+    NEEIntegrator integrator(&lights, 8, 3);
+
+    TaskScheduler scheduler(threads);
+    AccumulationBuffer accumulation(width, height);
+    TileRenderer renderer(*scene.world, *scene.camera, integrator, accumulation, sampler, samples, 5u, scheduler.threads());
+
+    // Small tiles, so that the workers share every pass.
+    auto tiles = make_tiles(width, height, 4, 4);
+
+    for (auto pass=0; pass<passes; ++pass)
+        renderer.render_pass(scheduler, tiles, pass * samples / passes, (pass + 1) * samples / passes);
+
+    EXPECT_EQ(renderer.stats().samples, static_cast<std::uint64_t>(width) * height * samples);
+
+    return accumulation;
+}
+
+
+TEST(TestRenderer, same_image_with_any_thread_count)
+{
+    auto text = std::string("camera 0 1 -6  0 1 0  0 1 0  40\n"
+                            "texture white constant 0.73 0.73 0.73\n"
+                            "texture light constant 4 4 4\n"
+                            "material white lambertian white\n"
+                            "material light light light\n"
+                            "material mirror metal 0.8 0.85 0.88 0.05\n"
+                            "material glass dielectric 1.5\n"
+                            "xz_rect -5 5 -5 5 0 white\n"
+                            "flip xz_rect -1 1 -1 1 4 light\n"
+                            "sphere -1 1 0 1 mirror\n"
+                            "sphere 1.2 0.7 -0.5 0.7 glass\n"
+                            "sphere 0.3 0.3 -1.5 0.3 white\n");
+
+    for (const auto *sampler : {"independent", "sobol"})
+    {
+        auto expected = render(text, sampler, 1, 1);
+
+        auto lit = 0;
+        for (auto y=0; y<expected.height(); ++y)
+            for (auto x=0; x<expected.width(); ++x)
+                if (expected.sum(x, y).luminance() > 0.0f)
+                    ++lit;
+
+        EXPECT_GT(lit, expected.width() * expected.height() / 4);
+
+        for (auto threads : {2u, 4u, 8u})
+        {
+            auto actual = render(text, sampler, threads, 2);
+
+            auto different = 0;
+            for (auto y=0; y<expected.height(); ++y)
+                for (auto x=0; x<expected.width(); ++x)
+                {
+                    const auto &a = expected.sum(x, y);
+                    const auto &b = actual.sum(x, y);
+
+                    if (a.r() != b.r() || a.g() != b.g() || a.b() != b.b())
+                        ++different;
+                }
+
+            EXPECT_EQ(different, 0) << sampler << ", " << threads << " threads";
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#include <string>
+#include <vector>
+
+#include "sampler.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestSampler, values_in_unit_interval)
+{
+    for (const auto &name : {"independent", "stratified", "sobol", "halton"})
+    {
+        auto sampler = make_sampler(name, 16, 3u);
+
+        for (auto s=0; s<64; ++s)
+        {
+            sampler->start_pixel_sample(7u, s);
+
+            for (auto d=0; d<40; ++d)
+            {
+                auto u = sampler->get_1d();
+                auto v = sampler->get_2d();
+
+                ASSERT_GE(u, 0.0f);
+                ASSERT_LT(u, 1.0f);
+                ASSERT_GE(v.first, 0.0f);
+                ASSERT_LT(v.first, 1.0f);
+                ASSERT_GE(v.second, 0.0f);
+                ASSERT_LT(v.second, 1.0f);
+            }
+        }
+    }
+}
+
+
+TEST(TestSampler, one_sample_per_stratum)
+{
+    auto spp = 16;
+
+    for (const auto &name : {"stratified", "sobol", "halton"})
+    {
+        auto sampler = make_sampler(name, spp, 5u);
+
+        // Every dimension, a late one included. Halton is only stratified in 1/16 in base 2.
+        auto dimensions = std::string(name) == "halton" ? std::vector<int>{0} : std::vector<int>{0, 3, 21};
+
+        for (std::uint64_t pixel=0; pixel<8; ++pixel)
+        {
+            for (auto dimension : dimensions)
+            {
+                std::vector<int> strata(spp, 0);
+
+                for (auto s=0; s<spp; ++s)
+                {
+                    sampler->start_pixel_sample(pixel, s);
+                    sampler->skip_to(dimension);
+
+                    ++strata[static_cast<int>(sampler->get_1d() * spp)];
+                }
+
+                for (auto count : strata)
+                    EXPECT_EQ(count, 1) << name << " pixel " << pixel << " dimension " << dimension;
+            }
+        }
+    }
+}
+
+
+TEST(TestSampler, one_sample_per_cell_in_2d)
+{
+    auto spp = 16;
+
+    for (const auto &name : {"stratified", "sobol"})
+    {
+        auto sampler = make_sampler(name, spp, 9u);
+
+        for (std::uint64_t pixel=0; pixel<8; ++pixel)
+        {
+            for (auto dimension : {0, 5, 13})
+            {
+                std::vector<int> cells(spp, 0);
+
+                for (auto s=0; s<spp; ++s)
+                {
+                    sampler->start_pixel_sample(pixel, s);
+                    sampler->skip_to(dimension);
+
+                    auto u = sampler->get_2d();
+                    ++cells[static_cast<int>(u.second * 4) * 4 + static_cast<int>(u.first * 4)];
+                }
+
+                for (auto count : cells)
+                    EXPECT_EQ(count, 1) << name << " pixel " << pixel << " dimension " << dimension;
+            }
+        }
+    }
+}
+
+
+TEST(TestSampler, samples_depend_on_pixel)
+{
+    auto sampler = make_sampler("sobol", 16, 1u);
+
+    sampler->start_pixel_sample(0u, 0);
+    auto a = sampler->get_2d();
+
+    sampler->start_pixel_sample(1u, 0);
+    auto b = sampler->get_2d();
+
+    EXPECT_NE(a.first, b.first);
+    EXPECT_NE(a.second, b.second);
+}
+
+
+TEST(TestSampler, known_names)
+{
+    EXPECT_TRUE(is_sampler_name("independent"));
+    EXPECT_TRUE(is_sampler_name("stratified"));
+    EXPECT_TRUE(is_sampler_name("sobol"));
+    EXPECT_TRUE(is_sampler_name("halton"));
+    EXPECT_FALSE(is_sampler_name("sobol2"));
+}
@@ -0,0 +1,126 @@
+#include <cmath>
+
+#include "sampling.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestSampling, concentric_disk_inside_and_uniform)
+{
+    auto g = PCG32(3u);
+    auto n = 100000;
+    auto inner = 0;
+
+    for (auto i=0; i<n; ++i)
+    {
+        auto p = sample_concentric_disk(g.next_float(), g.next_float());
+
+        ASSERT_LE(p.x() * p.x() + p.y() * p.y(), 1.0f + 1e-5f);
+        EXPECT_EQ(p.z(), 0.0f);
+
+        if (p.x() * p.x() + p.y() * p.y() < 0.25f)
+            ++inner;
+    }
+
+    // The disk of radius 1/2 covers a quarter of the area.
+    EXPECT_NEAR(static_cast<double>(inner) / n, 0.25, 0.01);
+
+    // The border of the square maps on the border of the disk.
+    EXPECT_NEAR(sample_concentric_disk(1.0f, 0.5f).x(), 1.0f, 1e-6f);
+    EXPECT_NEAR(sample_concentric_disk(0.5f, 0.0f).y(), -1.0f, 1e-6f);
+}
+
+
+TEST(TestSampling, cosine_hemisphere_moments)
+{
+    auto g = PCG32(5u);
+    auto n = 100000;
+    auto mean_z = 0.0;
+
+    for (auto i=0; i<n; ++i)
+    {
+        auto d = sample_cosine_hemisphere(g.next_float(), g.next_float());
+
+        ASSERT_NEAR(d.length(), 1.0f, 1e-4f);
+        ASSERT_GE(d.z(), 0.0f);
+
+        mean_z += d.z();
+    }
+
+    // E[cos] under cos / pi is 2/3.
+    EXPECT_NEAR(mean_z / n, 2.0 / 3.0, 0.005);
+    EXPECT_FLOAT_EQ(cosine_hemisphere_pdf(1.0f), static_cast<float>(1.0 / M_PI));
+    EXPECT_EQ(cosine_hemisphere_pdf(-0.5f), 0.0f);
+}
+
+
+TEST(TestSampling, uniform_sphere_and_ball)
+{
+    auto g = PCG32(7u);
+    auto n = 100000;
+    auto mean = Vec3(0.0f, 0.0f, 0.0f);
+    auto upper = 0;
+    auto inner = 0;
+
+    for (auto i=0; i<n; ++i)
+    {
+        auto d = sample_uniform_sphere(g.next_float(), g.next_float());
+        ASSERT_NEAR(d.length(), 1.0f, 1e-4f);
+
+        mean += d;
+        if (d.z() > 0.5f)
+            ++upper;
+
+        auto p = sample_uniform_ball(g.next_float(), g.next_float(), g.next_float());
+        ASSERT_LE(p.length(), 1.0f + 1e-5f);
+
+        if (p.length() < 0.5f)
+            ++inner;
+    }
+
+    EXPECT_NEAR(mean.length() / n, 0.0, 0.01);
+
+    // The cap above z = 1/2 is a quarter of the sphere, the ball of radius 1/2 an eighth of the volume.
+    EXPECT_NEAR(static_cast<double>(upper) / n, 0.25, 0.01);
+    EXPECT_NEAR(static_cast<double>(inner) / n, 0.125, 0.01);
+}
+
+
+TEST(TestSampling, uniform_cone_inside)
+{
+    auto g = PCG32(9u);
+    auto cos_theta_max = 0.9f;
+
+    for (auto i=0; i<10000; ++i)
+    {
+        auto d = sample_uniform_cone(g.next_float(), g.next_float(), cos_theta_max);
+
+        ASSERT_NEAR(d.length(), 1.0f, 1e-4f);
+        ASSERT_GE(d.z(), cos_theta_max - 1e-5f);
+    }
+}
+
+
+TEST(TestSampling, phong_lobe_moments)
+{
+    auto g = PCG32(11u);
+    auto n = 100000;
+    auto exponent = 10.0f;
+    auto mean_z = 0.0;
+
+    for (auto i=0; i<n; ++i)
+    {
+        auto d = sample_phong_lobe(g.next_float(), g.next_float(), exponent);
+
+        ASSERT_NEAR(d.length(), 1.0f, 1e-4f);
+        ASSERT_GE(d.z(), 0.0f);
+
+        mean_z += d.z();
+    }
+
+    // E[cos] under the lobe is (n + 1) / (n + 2).
+    EXPECT_NEAR(mean_z / n, 11.0 / 12.0, 0.005);
+    EXPECT_FLOAT_EQ(phong_lobe_pdf(1.0f, exponent), static_cast<float>(11.0 / (2.0 * M_PI)));
+    EXPECT_FLOAT_EQ(phong_lobe_pdf(0.5f, 1.0f), cosine_hemisphere_pdf(0.5f));
+    EXPECT_EQ(phong_lobe_pdf(-0.5f, exponent), 0.0f);
+}
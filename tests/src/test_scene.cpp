@@ -0,0 +1,106 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "scene.h"
+#include "hitablelist.h"
+#include "gtest/gtest.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+TEST(TestScene, parses_objects_and_wrappers)
+{
+    auto text = std::string(
+            "# Two boxes\n"
+            "camera 0 0 -10  0 0 0  0 1 0  40\n"
+            "texture white constant 0.7 0.7 0.7   # gray\n"
+            "material white lambertian white\n"
+            "define unit box 0 0 0  1 1 1  white\n"
+            "\n"
+            "translate 2 0 0 rotate_y 15 instance unit\n"
+            "flip xz_rect 0 1 0 1 1 white\n"
+            "sphere 0 0 0 0.5 white\n");
+
+    std::vector<std::uint32_t> records;
+    SceneParser parser;
+    ASSERT_TRUE(parser.parse(text, records)) << parser.last_error();
+
+    Scene scene;
+    SceneBuilder builder(2.0f);
+    ASSERT_TRUE(builder.build(records.data(), records.size(), scene)) << builder.last_error();
+    ASSERT_NE(scene.camera, nullptr);
+
+    auto *list = dynamic_cast<HitableList*>(scene.world);
+    ASSERT_NE(list, nullptr);
+    EXPECT_EQ(list->size(), 3u);
+
+    // The instance is translated along x.
+    AABB box;
+    ASSERT_TRUE(list->objects()[0]->bounding_box(0.0f, 1.0f, box));
+    EXPECT_GT(box.min().x(), 1.5f);
+}
+
+
+TEST(TestScene, parser_can_be_used_again)
+{
+    auto first = std::string("camera 0 0 -10  0 0 0  0 1 0  40\n"
+                             "texture white constant 0.7 0.7 0.7\n"
+                             "material white lambertian white\n"
+                             "define unit box 0 0 0  1 1 1  white\n"
+                             "sphere 0 0 0 0.5 white\n");
+
+    std::vector<std::uint32_t> records;
+    SceneParser parser;
+    ASSERT_TRUE(parser.parse(first, records)) << parser.last_error();
+
+    std::vector<std::uint32_t> expected;
+    ASSERT_TRUE(SceneParser().parse(first, expected));
+    EXPECT_EQ(records, expected);
+
+    // The camera and the names of the first scene are gone.
+    EXPECT_FALSE(parser.parse("sphere 0 0 0 0.5 white\n", records));
+    EXPECT_EQ(parser.last_error(), "line 1: unknown material: white");
+
+    EXPECT_FALSE(parser.parse("texture gray constant 0.5 0.5 0.5\n"
+                              "material gray lambertian gray\n"
+                              "instance unit\n", records));
+    EXPECT_EQ(parser.last_error(), "line 3: unknown object: unit");
+
+    EXPECT_FALSE(parser.parse("texture gray constant 0.5 0.5 0.5\n", records));
+    EXPECT_EQ(parser.last_error(), "line 2: the scene has no camera");
+
+    // The records are replaced, not appended.
+    ASSERT_TRUE(parser.parse(first, records)) << parser.last_error();
+    EXPECT_EQ(records, expected);
+}
+
+
+TEST(TestScene, reports_the_line_of_errors)
+{
+    std::vector<std::uint32_t> records;
+    SceneParser parser;
+
+    EXPECT_FALSE(parser.parse("camera 0 0 -10  0 0 0  0 1 0  40\n\nsphere 0 0 0 1 chrome\n", records));
+    EXPECT_EQ(parser.last_error(), "line 3: unknown material: chrome");
+
+    EXPECT_FALSE(SceneParser().parse("texture white constant 1 x 1\n", records));
+    EXPECT_FALSE(SceneParser().parse("sphere 0 0 0 1\n", records));
+
+    // Numbers that would break the BVH.
+    auto header = std::string("camera 0 0 -10  0 0 0  0 1 0  40\ntexture t constant 1 1 1\nmaterial m lambertian t\n");
+
+    EXPECT_FALSE(parser.parse(header + "sphere nan 0 -1 1 m\n", records));
+    EXPECT_EQ(parser.last_error(), "line 4: not a finite number: nan");
+    EXPECT_FALSE(parser.parse(header + "sphere 0 0 0 1e99 m\n", records));
+    EXPECT_EQ(parser.last_error(), "line 4: not a finite number: 1e99");
+    EXPECT_FALSE(parser.parse(header + "sphere 0 0 0 1 m\nmoving_sphere 0 0 0  1 0 0  0 1  0 m\n", records));
+    EXPECT_EQ(parser.last_error(), "line 5: the radius of a sphere must be positive: 0.000000");
+    EXPECT_FALSE(parser.parse(header + "sphere 0 0 0 -1 m\n", records));
+
+    // Truncated records are rejected by the builder.
+    ASSERT_TRUE(SceneParser().parse("camera 0 0 -10  0 0 0  0 1 0  40\n", records));
+    Scene scene;
+    EXPECT_FALSE(SceneBuilder(1.0f).build(records.data(), records.size() - 1, scene));
+}
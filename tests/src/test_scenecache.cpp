@@ -0,0 +1,259 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "scene.h"
+#include "scenecache.h"
+#include "bvhbuilder.h"
+#include "linearbvh.h"
+#include "widebvh.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+
+TEST(TestSceneCache, cached_scene_has_the_same_hits)
+{
+    auto generator = PCG32(3u);
+    auto text = std::string("camera 0 0 -20  0 0 0  0 1 0  40\n"
+                            "texture gray constant 0.5 0.5 0.5\n"
+                            "material gray lambertian gray\n");
+
+    for (auto i=0; i<300; ++i)
+        text += "sphere " + std::to_string(generator.next_float() * 20.0f - 10.0f) + " " +
+                std::to_string(generator.next_float() * 20.0f - 10.0f) + " " +
+                std::to_string(generator.next_float() * 20.0f - 10.0f) + " 0.4 gray\n";
+
+    std::vector<std::uint32_t> records;
+    ASSERT_TRUE(SceneParser().parse(text, records));
+
+    Scene scene;
+    ASSERT_TRUE(SceneBuilder(1.0f).build(records.data(), records.size(), scene));
+    auto *list = dynamic_cast<HitableList*>(scene.world);
+
+    TaskScheduler scheduler(1);
+    SAHBuilder builder(list->objects(), list->size(), 0.0f, 1.0f);
+    builder.build(&scheduler);
+    LinearBVH binary(builder.build_nodes(), builder.ordered_primitives());
+    WideBVH<4> bvh(binary);
+
+    SceneCacheKey key;
+    key.source_hash = hash_bytes(text.data(), text.size());
+    key.bvh_method = "sah";
+    key.bvh_width = 4;
+
+    auto filename = std::string("test_scenecache.cache");
+    ASSERT_TRUE(write_scene_cache(filename, key, records, *list, &bvh));
+
+    SceneCache cache;
+    ASSERT_TRUE(cache.open(filename, key));
+    ASSERT_TRUE(cache.has_bvh());
+    ASSERT_EQ(cache.records_count(), records.size());
+
+    Scene cached_scene;
+    ASSERT_TRUE(SceneBuilder(1.0f).build(cache.records(), cache.records_count(), cached_scene));
+    auto *cached_list = dynamic_cast<HitableList*>(cached_scene.world);
+    ASSERT_EQ(cached_list->size(), list->size());
+
+    auto *cached_bvh = cache.bvh(*cached_list);
+    ASSERT_NE(cached_bvh, nullptr);
+
+    for (auto i=0; i<1000; ++i)
+    {
+        auto origin = Vec3(generator.next_float() * 30.0f - 15.0f, generator.next_float() * 30.0f - 15.0f, -20.0f);
+        auto direction = Vec3(generator.next_float() - 0.5f, generator.next_float() - 0.5f, 1.0f);
+        auto r = Ray(origin, direction, 0.0f);
+
+        HitRecord expected, actual;
+        auto expected_hit = bvh.hit(r, 0.001f, std::numeric_limits<float>::max(), expected);
+        auto actual_hit = cached_bvh->hit(r, 0.001f, std::numeric_limits<float>::max(), actual);
+
+        ASSERT_EQ(expected_hit, actual_hit);
+        if (expected_hit)
+        {
+            EXPECT_EQ(expected.t, actual.t);
+        }
+    }
+
+    // Another source, or other BVH settings, don't use the cache.
+    auto other = key;
+    other.source_hash ^= 1u;
+    EXPECT_FALSE(SceneCache().open(filename, other));
+
+    other = key;
+    other.bvh_width = 2;
+    EXPECT_FALSE(SceneCache().open(filename, other));
+
+    // A cache rejected for its primitives is closed, then written again over itself.
+    std::vector<std::uint32_t> cached_records(cache.records(), cache.records() + cache.records_count());
+    delete cached_bvh;
+    cache.close();
+
+    ASSERT_TRUE(write_scene_cache(filename, key, cached_records, *list, &bvh));
+    EXPECT_FALSE(std::ifstream(filename + ".tmp").good());
+
+    SceneCache rewritten;
+    ASSERT_TRUE(rewritten.open(filename, key));
+    EXPECT_EQ(rewritten.records_count(), records.size());
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(TestSceneCache, damaged_cache_is_a_miss)
+{
+    auto generator = PCG32(5u);
+    auto text = std::string("camera 0 0 -20  0 0 0  0 1 0  40\n"
+                            "texture gray constant 0.5 0.5 0.5\n"
+                            "material gray lambertian gray\n");
+
+    for (auto i=0; i<100; ++i)
+        text += "sphere " + std::to_string(generator.next_float() * 20.0f - 10.0f) + " " +
+                std::to_string(generator.next_float() * 20.0f - 10.0f) + " 0 0.4 gray\n";
+
+    std::vector<std::uint32_t> records;
+    ASSERT_TRUE(SceneParser().parse(text, records));
+
+    Scene scene;
+    ASSERT_TRUE(SceneBuilder(1.0f).build(records.data(), records.size(), scene));
+    auto *list = dynamic_cast<HitableList*>(scene.world);
+
+    SAHBuilder builder(list->objects(), list->size(), 0.0f, 1.0f);
+    builder.build();
+    LinearBVH bvh(builder.build_nodes(), builder.ordered_primitives());
+
+    SceneCacheKey key;
+    key.source_hash = hash_bytes(text.data(), text.size());
+    key.bvh_method = "sah";
+    key.bvh_width = 2;
+
+    auto filename = std::string("test_scenecache_damaged.cache");
+    ASSERT_TRUE(write_scene_cache(filename, key, records, *list, &bvh));
+
+    std::string bytes;
+    ASSERT_TRUE(read_file(filename, bytes));
+
+    SceneCacheHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+
+    auto write_damaged = [&](const std::string &damaged)
+    {
+        std::ofstream out(filename, std::ios::binary);
+        out.write(damaged.data(), static_cast<std::streamsize>(damaged.size()));
+    };
+
+    // A single bit in every section.
+    for (auto offset : {header.records_offset, header.nodes_offset + 4, header.primitives_offset})
+    {
+        auto damaged = bytes;
+        damaged[offset] ^= 0x10;
+        write_damaged(damaged);
+
+        EXPECT_FALSE(SceneCache().open(filename, key)) << "offset " << offset;
+    }
+
+    // Random bytes anywhere: the cache is rejected, or still traced safely.
+    for (auto i=0; i<60; ++i)
+    {
+        auto damaged = bytes;
+
+        for (auto j=0; j<4; ++j)
+            damaged[generator.next_uint() % damaged.size()] = static_cast<char>(generator.next_uint());
+
+        write_damaged(damaged);
+
+        SceneCache cache;
+
+        if (!cache.open(filename, key))
+            continue;
+
+        Scene cached_scene;
+
+        if (!SceneBuilder(1.0f).build(cache.records(), cache.records_count(), cached_scene))
+            continue;
+
+        auto *cached_list = dynamic_cast<HitableList*>(cached_scene.world);
+        std::unique_ptr<Hitable> cached_bvh(cache.has_bvh() ? cache.bvh(*cached_list) : nullptr);
+
+        if (cached_bvh)
+        {
+            HitRecord rec;
+            cached_bvh->hit(Ray(Vec3(0.0f, 0.0f, -20.0f), Vec3(0.0f, 0.0f, 1.0f)), 0.001f, 100.0f, rec);
+        }
+    }
+
+    std::remove(filename.c_str());
+}
+
+
+TEST(TestSceneCache, concurrent_writers_publish_whole_files)
+{
+    auto generator = PCG32(9u);
+    auto text = std::string("camera 0 0 -20  0 0 0  0 1 0  40\n"
+                            "texture gray constant 0.5 0.5 0.5\n"
+                            "material gray lambertian gray\n");
+
+    for (auto i=0; i<2000; ++i)
+        text += "sphere " + std::to_string(generator.next_float() * 20.0f - 10.0f) + " " +
+                std::to_string(generator.next_float() * 20.0f - 10.0f) + " 0 0.1 gray\n";
+
+    std::vector<std::uint32_t> records;
+    ASSERT_TRUE(SceneParser().parse(text, records));
+
+    Scene scene;
+    ASSERT_TRUE(SceneBuilder(1.0f).build(records.data(), records.size(), scene));
+    auto *list = dynamic_cast<HitableList*>(scene.world);
+
+    SAHBuilder builder(list->objects(), list->size(), 0.0f, 1.0f);
+    builder.build();
+    LinearBVH bvh(builder.build_nodes(), builder.ordered_primitives());
+
+    SceneCacheKey key;
+    key.source_hash = hash_bytes(text.data(), text.size());
+    key.bvh_method = "sah";
+    key.bvh_width = 2;
+
+    // Jobs starting on the same scene write the cache while others map it.
+    auto filename = std::string("test_scenecache_concurrent.cache");
+    std::atomic<int> written{0};
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> writers;
+
+    for (auto w=0; w<4; ++w)
+        writers.emplace_back([&]()
+        {
+            for (auto i=0; i<10; ++i)
+                if (write_scene_cache(filename, key, records, *list, &bvh))
+                    ++written;
+        });
+
+    for (auto i=0; i<200; ++i)
+    {
+        SceneCache cache;
+
+        if (cache.open(filename, key) && cache.records_count() != records.size())
+            ++mismatches;
+    }
+
+    for (auto &writer : writers)
+        writer.join();
+
+    EXPECT_EQ(written.load(), 40);
+    EXPECT_EQ(mismatches.load(), 0);
+
+    SceneCache cache;
+    ASSERT_TRUE(cache.open(filename, key));
+    EXPECT_TRUE(cache.has_bvh());
+    EXPECT_EQ(cache.records_count(), records.size());
+
+    std::remove(filename.c_str());
+}
@@ -0,0 +1,148 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+#include "scheduler.h"
+#include "gtest/gtest.h"
+
+
+/**
+ * Sum of [first, last) splitting the range in nested tasks, as the parallel BVH build does.
+ */
+std::uint64_t nested_sum(TaskScheduler &scheduler, std::uint64_t first, std::uint64_t last)
+{
+    if (last - first <= 16)
+    {
+        auto sum = std::uint64_t(0);
+        for (auto i=first; i<last; ++i)
+            sum += i;
+
+        return sum;
+    }
+
+    auto middle = first + (last - first) / 2;
+    std::uint64_t left = 0, right = 0;
+
+    TaskGroup group;
+    scheduler.submit(group, [&]() { left = nested_sum(scheduler, first, middle); });
+    scheduler.submit(group, [&]() { right = nested_sum(scheduler, middle, last); });
+    scheduler.wait(group);
+
+    return left + right;
+}
+
+
+TEST(TestScheduler, nested_tasks_wait_for_their_subtasks)
+{
+    for (auto threads : {1u, 2u, 4u})
+    {
+        TaskScheduler scheduler(threads);
+
+        std::uint64_t n = 20000;
+        EXPECT_EQ(nested_sum(scheduler, 0, n), n * (n - 1) / 2) << threads << " threads";
+    }
+}
+
+
+TEST(TestScheduler, wait_returns_when_other_workers_complete_the_group)
+{
+    TaskScheduler scheduler(4);
+
+    // Each task holds its worker until the other one has started, so the
+    // waiting thread cannot run both: the second is stolen, and completes
+    // last while the waiting thread has nothing left to do.
+    std::atomic<int> started{0};
+    std::atomic<int> completed{0};
+    int workers[2] = {-1, -1};
+
+    TaskGroup group;
+
+    for (auto i=0; i<2; ++i)
+        scheduler.submit(group, [&, i]()
+        {
+            workers[i] = TaskScheduler::current_worker();
+            ++started;
+
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (started < 2 && std::chrono::steady_clock::now() < deadline)
+                std::this_thread::yield();
+
+            if (TaskScheduler::current_worker() != 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+            ++completed;
+        });
+
+    scheduler.wait(group);
+
+    EXPECT_EQ(completed.load(), 2);
+    EXPECT_EQ(started.load(), 2);
+    EXPECT_NE(workers[0], workers[1]);
+    EXPECT_GE(scheduler.stats().steals, 1u);
+}
+
+
+TEST(TestScheduler, every_task_runs_once)
+{
+    TaskScheduler scheduler(4);
+
+    auto n = 20000;
+    std::unique_ptr<std::atomic<int>[]> runs(new std::atomic<int>[n]);
+    for (auto i=0; i<n; ++i)
+        runs[i] = 0;
+
+    // Tasks submitted by the waiting thread and by the tasks themselves.
+    TaskGroup group;
+
+    for (auto i=0; i<n; i+=4)
+        scheduler.submit(group, [&, i]()
+        {
+            ++runs[i];
+
+            TaskGroup inner;
+            for (auto j=i+1; j<i+4 && j<n; ++j)
+                scheduler.submit(inner, [&, j]() { ++runs[j]; });
+            scheduler.wait(inner);
+        });
+
+    scheduler.wait(group);
+
+    auto wrong = 0;
+    for (auto i=0; i<n; ++i)
+        if (runs[i] != 1)
+            ++wrong;
+
+    EXPECT_EQ(wrong, 0);
+}
+
+
+TEST(TestScheduler, stats_add_up)
+{
+    TaskScheduler scheduler(3);
+
+    auto n = 5000u;
+    std::atomic<unsigned int> executed{0};
+
+    TaskGroup group;
+    for (auto i=0u; i<n; ++i)
+        scheduler.submit(group, [&]()
+        {
+            ++executed;
+            std::this_thread::yield();
+        });
+    scheduler.wait(group);
+
+    auto stats = scheduler.stats();
+
+    EXPECT_EQ(executed.load(), n);
+    EXPECT_EQ(stats.tasks, n);
+    ASSERT_EQ(stats.tasks_per_worker.size(), scheduler.threads());
+    EXPECT_EQ(std::accumulate(stats.tasks_per_worker.begin(), stats.tasks_per_worker.end(), std::uint64_t(0)), stats.tasks);
+
+    // Only the tasks run by the background workers are stolen, all were queued on worker 0.
+    EXPECT_EQ(stats.steals, stats.tasks - stats.tasks_per_worker[0]);
+    EXPECT_GE(stats.idle_ms, 0.0);
+}
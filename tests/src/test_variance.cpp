@@ -0,0 +1,62 @@
+#include <cmath>
+#include <vector>
+
+#include "variance.h"
+#include "random.h"
+#include "gtest/gtest.h"
+
+
+TEST(TestVariance, matches_two_pass_estimate)
+{
+    auto g = PCG32(13u);
+    auto values = std::vector<float>(1000);
+    PixelVariance variance;
+
+    for (auto &x : values)
+    {
+        x = g.next_float() * 4.0f + 1.0f;
+        variance.add(x);
+    }
+
+    auto mean = 0.0;
+    for (auto x : values)
+        mean += x;
+    mean /= values.size();
+
+    auto sum = 0.0;
+    for (auto x : values)
+        sum += (x - mean) * (x - mean);
+
+    EXPECT_EQ(variance.count(), 1000);
+    EXPECT_NEAR(variance.mean(), mean, 1e-4);
+    EXPECT_NEAR(variance.variance(), sum / (values.size() - 1), 1e-3);
+    EXPECT_NEAR(variance.standard_error(), std::sqrt(sum / (values.size() - 1) / values.size()), 1e-4);
+}
+
+
+TEST(TestVariance, constant_pixel_has_no_error)
+{
+    PixelVariance variance;
+
+    EXPECT_EQ(variance.display_error(), 0.0f);
+
+    for (auto i=0; i<16; ++i)
+        variance.add(0.25f);
+
+    EXPECT_EQ(variance.display_error(), 0.0f);
+}
+
+
+TEST(TestVariance, dark_pixels_need_a_smaller_error)
+{
+    PixelVariance dark, bright;
+
+    for (auto i=0; i<16; ++i)
+    {
+        dark.add(i % 2 ? 0.05f : 0.15f);
+        bright.add(i % 2 ? 0.85f : 0.95f);
+    }
+
+    EXPECT_NEAR(dark.standard_error(), bright.standard_error(), 1e-6f);
+    EXPECT_GT(dark.display_error(), 2.0f * bright.display_error());
+}
@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "writerthread.h"
+#include "gtest/gtest.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+
+TEST(TestWriterThread, writes_every_queued_image)
+{
+    ImageWriterThread writer(4, 2, 1);
+
+    for (auto i=0; i<3; ++i)
+    {
+        // With a single framebuffer, every acquire waits for the previous image.
+        auto framebuffer = writer.acquire();
+        framebuffer.at(0, 0) = Color(i / 2.0f);
+        writer.submit("test_writerthread_" + std::to_string(i) + ".pfm", std::move(framebuffer));
+    }
+
+    writer.flush();
+    EXPECT_EQ(writer.stats().images, 3u);
+
+    for (auto i=0; i<3; ++i)
+    {
+        auto filename = "test_writerthread_" + std::to_string(i) + ".pfm";
+        std::ifstream in(filename, std::ios::binary);
+        std::string magic, scale;
+        int width, height;
+        float red;
+
+        in >> magic >> width >> height >> scale;
+        in.get();
+        in.read(reinterpret_cast<char*>(&red), sizeof(red));
+
+        EXPECT_EQ(magic, "PF");
+        EXPECT_EQ(width, 4);
+        EXPECT_EQ(height, 2);
+        EXPECT_FLOAT_EQ(red, i / 2.0f);
+
+        std::remove(filename.c_str());
+    }
+}
+
+
+TEST(TestWriterThread, snapshots_replace_the_image)
+{
+    ImageWriterThread writer(4, 2, 2);
+
+    // The progressive snapshots all go to the same file.
+    auto filename = std::string("test_writerthread_snapshot.pfm");
+
+    for (auto i=0; i<3; ++i)
+    {
+        auto framebuffer = writer.acquire();
+        framebuffer.at(0, 0) = Color(i / 2.0f);
+        writer.submit(filename, std::move(framebuffer));
+    }
+
+    writer.flush();
+
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic, scale;
+    int width, height;
+    float red;
+
+    in >> magic >> width >> height >> scale;
+    in.get();
+    in.read(reinterpret_cast<char*>(&red), sizeof(red));
+
+    EXPECT_EQ(magic, "PF");
+    EXPECT_FLOAT_EQ(red, 1.0f);
+    EXPECT_FALSE(std::ifstream(filename + ".tmp").good());
+
+    in.close();
+    std::remove(filename.c_str());
+}